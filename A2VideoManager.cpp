@@ -23,6 +23,7 @@
 #include "MockingboardManager.h"
 #include "LogTextManager.h"
 #include "EventRecorder.h"
+#include "GPUProfiler.h"
 #include "GRAddr2XY.h"
 #include "imgui.h"
 #include "SDL_rect.h"
@@ -1478,6 +1479,7 @@ bool A2VideoManager::Render(GLuint &_texUnit)
 		this->ForceBeamFullScreenRender();
 
 	GLenum glerr;
+	auto gpuProfiler = GPUProfiler::GetInstance();
 
 	// Initialization routine runs only once on init (or re-init)
 	if (bShouldInitializeRender) {
@@ -1645,9 +1647,12 @@ bool A2VideoManager::Render(GLuint &_texUnit)
 			glClearColor(0.f, 0.f, 0.f, 0.f);
 			glClear(GL_COLOR_BUFFER_BIT);
 		}
+		gpuProfiler->BeginPass(GPUPass_e::LEGACY);
 		windowsbeam[A2VIDEOBEAM_LEGACY]->Render(current_frame_idx);
+		gpuProfiler->EndPass(GPUPass_e::LEGACY);
 		if (p_b_ntsc && (eA2MonitorType == A2_MON_COLOR))
 		{
+			gpuProfiler->BeginPass(GPUPass_e::NTSC);
 			glBindFramebuffer(GL_FRAMEBUFFER, FBO_A2Video);
 
 			legacyNTSCQuad->SetInputTextureUnit(_TEXUNIT_PRE_NTSC);
@@ -1666,6 +1671,7 @@ bool A2VideoManager::Render(GLuint &_texUnit)
 			_s.SetUniform("NTSC_COMB_STR", p_f_ntscCombStrength);
 			_s.SetUniform("NTSC_GAMMA_CORRECTION", p_f_ntscGammaCorrection);
 			legacyNTSCQuad->Render(current_frame_idx);
+			gpuProfiler->EndPass(GPUPass_e::NTSC);
 		}
 		// std::cerr << "Rendered legacy to viewport " << fb_width << "x" << fb_height << " - " << current_frame_idx << std::endl;
 		if ((glerr = glGetError()) != GL_NO_ERROR) {
@@ -1679,7 +1685,9 @@ bool A2VideoManager::Render(GLuint &_texUnit)
 		// Only SHR is active, just bind the correct output for the postprocessor
 		windowsbeam[A2VIDEOBEAM_SHR]->monitorColorType = eA2MonitorType;
 		windowsbeam[A2VIDEOBEAM_SHR]->bIsMergedMode = (vrams_read->mode == A2Mode_e::MERGED);
+		gpuProfiler->BeginPass(GPUPass_e::SHR);
 		windowsbeam[A2VIDEOBEAM_SHR]->Render(current_frame_idx);
+		gpuProfiler->EndPass(GPUPass_e::SHR);
 		// std::cerr << "Rendered SHR to viewport " << fb_width << "x" << fb_height << " - " << current_frame_idx << std::endl;
 		if ((glerr = glGetError()) != GL_NO_ERROR) {
 			std::cerr << "SHR Mode draw error: " << glerr << std::endl;
@@ -1690,7 +1698,9 @@ bool A2VideoManager::Render(GLuint &_texUnit)
 	// ===============================================================================
 	if (vidhdWindowBeam->GetVideoMode() != VIDHDMODE_NONE)	// VidHD
 	{
+		gpuProfiler->BeginPass(GPUPass_e::VIDHD);
 		vidhdWindowBeam->Render();
+		gpuProfiler->EndPass(GPUPass_e::VIDHD);
 		if ((glerr = glGetError()) != GL_NO_ERROR) {
 			std::cerr << "VidHD draw error: " << glerr << std::endl;
 		}
@@ -1717,6 +1727,7 @@ bool A2VideoManager::Render(GLuint &_texUnit)
 	}
 	
 	// Render the debugging textures as necessary
+	gpuProfiler->BeginPass(GPUPass_e::DEBUG);
 	if (bRenderTEXT1) {
 		glViewport(0, 0, _A2VIDEO_LEGACY_WIDTH, _A2VIDEO_LEGACY_HEIGHT);
 		glBindFramebuffer(GL_FRAMEBUFFER, FBO_debug[0]);
@@ -1780,6 +1791,7 @@ bool A2VideoManager::Render(GLuint &_texUnit)
 			debugWin.Render();
 		}
 	}
+	gpuProfiler->EndPass(GPUPass_e::DEBUG);
 
 	// all done, the texture for this Apple 2 beam cycle frame is rendered
 	rendered_frame_idx = vrams_read->frame_idx;
@@ -0,0 +1,143 @@
+#include "AudioRenderer.h"
+#include "common.h"
+#include "SoundManager.h"
+#include "MockingboardManager.h"
+#include "CycleCounter.h"
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+static void WriteLE16(std::ofstream& file, uint16_t value)
+{
+	const char _bytes[2] = { (char)(value & 0xFF), (char)(value >> 8) };
+	file.write(_bytes, sizeof(_bytes));
+}
+
+static void WriteLE32(std::ofstream& file, uint32_t value)
+{
+	const char _bytes[4] = { (char)(value & 0xFF), (char)((value >> 8) & 0xFF),
+		(char)((value >> 16) & 0xFF), (char)(value >> 24) };
+	file.write(_bytes, sizeof(_bytes));
+}
+
+// WAVE_FORMAT_IEEE_FLOAT needs the extended fmt chunk and a fact chunk
+void AudioRenderer::WriteWavHeader(std::ofstream& file, uint32_t sampleRate, uint32_t dataBytes)
+{
+	const uint16_t _channels = 2;
+	const uint16_t _bitsPerSample = 32;
+	const uint16_t _blockAlign = _channels * _bitsPerSample / 8;
+	file.write("RIFF", 4);
+	WriteLE32(file, 4 + (8 + 18) + (8 + 4) + (8 + dataBytes));
+	file.write("WAVE", 4);
+	file.write("fmt ", 4);
+	WriteLE32(file, 18);
+	WriteLE16(file, 3);				// WAVE_FORMAT_IEEE_FLOAT
+	WriteLE16(file, _channels);
+	WriteLE32(file, sampleRate);
+	WriteLE32(file, sampleRate * _blockAlign);
+	WriteLE16(file, _blockAlign);
+	WriteLE16(file, _bitsPerSample);
+	WriteLE16(file, 0);				// no extension
+	file.write("fact", 4);
+	WriteLE32(file, 4);
+	WriteLE32(file, dataBytes / _blockAlign);
+	file.write("data", 4);
+	WriteLE32(file, dataBytes);
+}
+
+bool AudioRenderer::Render(const std::vector<SDHREvent>& events, const std::string& wavPath)
+{
+	return Render(events.size(), [&events](size_t i) { return events[i]; }, wavPath);
+}
+
+bool AudioRenderer::Render(uint64_t count, const std::function<SDHREvent(size_t)>& getEvent, const std::string& wavPath)
+{
+	eventCount = count;
+	sampleCount = 0;
+	feedSeconds = 0.0;
+	mixSeconds = 0.0;
+	sampleRate = SoundManager::GetInstance()->GetSampleRate();
+
+	std::ofstream file(wavPath, std::ios::binary);
+	if (!file.is_open())
+	{
+		std::cerr << "Audio render: can't create " << wavPath << std::endl;
+		return false;
+	}
+	WriteWavHeader(file, sampleRate, 0);	// rewritten with the real size at the end
+
+	auto soundManager = SoundManager::GetInstance();
+	auto mockingboardManager = MockingboardManager::GetInstance();
+	// Blocks are the size of the audio device buffer the settings ask for
+	const uint32_t _blockSamples = soundManager->GetBufferSize();
+	soundManager->BeginPlay();
+	// Apply the beeper reset now, so it doesn't throw away the first fed blocks
+	std::vector<float> _block(_blockSamples * 2);
+	soundManager->MixBlock(_block.data(), 0);
+
+	// Every event is one cycle, except delay events. The clock is the one of the recording's region.
+	const double _cpuFrequency = (CycleCounter::GetInstance()->GetVideoRegion() == VideoRegion_e::PAL)
+		? static_cast<double>(_A2_CPU_FREQUENCY_PAL) : static_cast<double>(_A2_CPU_FREQUENCY_NTSC);
+	const double _cyclesPerBlock = _blockSamples * _cpuFrequency / sampleRate;
+	// The WAV sizes are 32 bits, stop before they overflow
+	const uint64_t _maxSamples = (UINT32_MAX - 64) / (2 * sizeof(float));
+	size_t _nextEvent = 0;
+	uint64_t _fedCycles = 0;
+	for (uint64_t _blockIdx = 0; ; ++_blockIdx)
+	{
+		auto _tFeed = std::chrono::steady_clock::now();
+		const uint64_t _feedEnd = static_cast<uint64_t>((_blockIdx + AR_FEED_AHEAD_BLOCKS) * _cyclesPerBlock);
+		for (; (_nextEvent < eventCount) && (_fedCycles < _feedEnd); ++_nextEvent)
+		{
+			const SDHREvent _event = getEvent(_nextEvent);
+			if (_event.is_delay)
+			{
+				soundManager->AdvanceCycles(_event.DelayCycles());
+				_fedCycles += _event.DelayCycles();
+				continue;
+			}
+			soundManager->EventReceived((_event.addr & 0xFFF0) == 0xC030);
+			mockingboardManager->EventReceived(_event.addr, _event.data, _event.rw);
+			++_fedCycles;
+		}
+		// Done when the blocks cover all the cycles
+		if ((_nextEvent >= eventCount) && (_blockIdx * _cyclesPerBlock >= _fedCycles))
+			break;
+		if (sampleCount + _blockSamples > _maxSamples)
+		{
+			std::cerr << "Audio render: stopped at the WAV size limit, " << (eventCount - _nextEvent) << " events left" << std::endl;
+			break;
+		}
+		auto _tMix = std::chrono::steady_clock::now();
+		soundManager->MixBlock(_block.data(), _blockSamples);
+		auto _tEnd = std::chrono::steady_clock::now();
+		feedSeconds += std::chrono::duration<double>(_tMix - _tFeed).count();
+		mixSeconds += std::chrono::duration<double>(_tEnd - _tMix).count();
+
+		file.write(reinterpret_cast<const char*>(_block.data()), _block.size() * sizeof(float));
+		sampleCount += _blockSamples;
+	}
+	soundManager->StopPlay();
+
+	file.seekp(0);
+	WriteWavHeader(file, sampleRate, static_cast<uint32_t>(sampleCount * 2 * sizeof(float)));
+	if (!file.good())
+	{
+		std::cerr << "Audio render: error writing " << wavPath << std::endl;
+		return false;
+	}
+	return true;
+}
+
+std::string AudioRenderer::GetSummary()
+{
+	const double _audioSeconds = static_cast<double>(sampleCount) / sampleRate;
+	const double _totalSeconds = feedSeconds + mixSeconds;
+	std::ostringstream _ss;
+	_ss << "Audio render: " << eventCount << " events, " << _audioSeconds << "s of audio in "
+		<< _totalSeconds << "s (" << (_totalSeconds > 0 ? _audioSeconds / _totalSeconds : 0) << "x realtime)"
+		<< " - feed " << feedSeconds * 1000.0 << "ms, mix " << mixSeconds * 1000.0 << "ms";
+	return _ss.str();
+}
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef AUDIORENDERER_H
+#define AUDIORENDERER_H
+
+/*
+	Renders the beeper and Mockingboard output of a list of bus events into a WAV file,
+	as fast as the CPU allows and without any audio device.
+
+	The events go through the exact same path as a live or replayed bus: SoundManager and
+	MockingboardManager receive every event, and SoundManager::MixBlock() produces the blocks
+	the audio callback would have played. The bus is kept AR_FEED_AHEAD_BLOCKS blocks ahead of
+	the mixer, like the real callback that runs behind the bus, so the beeper and
+	Mockingboard render latencies behave like they do live. The result is deterministic, which
+	makes it usable for byte-for-byte regression checks of the audio engines.
+
+	The samples are written as 32-bit float stereo, bit-exact with what SoundManager mixes.
+	SoundManager::SetSink(AudioSink_e::Offline) must have been called before the sound singletons
+	are created.
+*/
+
+#include "SDHRNetworking.h"	// for SDHREvent
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <functional>
+
+constexpr uint32_t AR_FEED_AHEAD_BLOCKS = 2;	// blocks of bus events fed before a block is mixed
+
+class AudioRenderer
+{
+public:
+	AudioRenderer() {};
+
+	// Returns false if the file couldn't be written
+	bool Render(const std::vector<SDHREvent>& events, const std::string& wavPath);
+	// Same, for events that don't fit in memory. getEvent is called in order.
+	bool Render(uint64_t count, const std::function<SDHREvent(size_t)>& getEvent, const std::string& wavPath);
+
+	// Stats of the last Render()
+	uint64_t GetEventCount() { return eventCount; };
+	uint64_t GetSampleCount() { return sampleCount; };
+	uint32_t GetSampleRate() { return sampleRate; };
+	double GetFeedSeconds() { return feedSeconds; };	// beeper toggles and 6522 decoding
+	double GetMixSeconds() { return mixSeconds; };		// beeper steps, Ayumi, SSI263 and the final mix
+	std::string GetSummary();
+
+	// 32-bit float stereo WAV header, also used by the SoundManager File sink
+	static void WriteWavHeader(std::ofstream& file, uint32_t sampleRate, uint32_t dataBytes);
+
+private:
+	uint64_t eventCount = 0;
+	uint64_t sampleCount = 0;
+	uint32_t sampleRate = 44100;
+	double feedSeconds = 0.0;
+	double mixSeconds = 0.0;
+};
+
+#endif // AUDIORENDERER_H
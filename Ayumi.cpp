@@ -4,7 +4,15 @@
 #include <string.h>
 #include <math.h>
 
-static const double AY_dac_table[] = {
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AYUMI_SIMD_NEON
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define AYUMI_SIMD_SSE
+#endif
+
+static const float AY_dac_table[] = {
 	0.0, 0.0,
 	0.00999465934234, 0.00999465934234,
 	0.0144502937362, 0.0144502937362,
@@ -23,7 +31,7 @@ static const double AY_dac_table[] = {
 	1.0, 1.0
 };
 
-static const double YM_dac_table[] = {
+static const float YM_dac_table[] = {
 	0.0, 0.0,
 	0.00465400167849, 0.00772106507973,
 	0.0109559777218, 0.0139620050355,
@@ -42,6 +50,62 @@ static const double YM_dac_table[] = {
 	0.879926756695, 1.0
 };
 
+// First half of the symmetric 192 tap low-pass FIR that decimates the 8x oversampled
+// signal. Tap k and tap 192-k are equal. Every 8th tap is 0 except the center one.
+static const float FIR_coefficients[AYUMI_FIR_SIZE / 2 + 1] = {
+	0.0, -0.0000046183113992051936, -0.00001117761640887225, -0.000018610264502005432,
+	-0.000025134586135631012, -0.000028494281690666197, -0.000026396828793275159, -0.000017094212558802156,
+	0.0, 0.000023798193576966866, 0.000051281160242202183, 0.00007762197826243427,
+	0.000096759426664120416, 0.00010240229300393402, 0.000089344614218077106, 0.000054875700118949183,
+	0.0, -0.000069839082210680165, -0.0001447966132360757, -0.00021158452917708308,
+	-0.00025535069106550544, -0.00026228714374322104, -0.00022258805927027799, -0.00013323230495695704,
+	0.0, 0.00016182578767055206, 0.00032846175385096581, 0.00047045611576184863,
+	0.00055713851457530944, 0.00056212565121518726, 0.00046901918553962478, 0.00027624866838952986,
+	0.0, -0.00032564179486838622, -0.00065182310286710388, -0.00092127787309319298,
+	-0.0010772534348943575, -0.0010737727700273478, -0.00088556645390392634, -0.00051581896090765534,
+	0.0, 0.00059548767193795277, 0.0011803558710661009, 0.0016527320270369871,
+	0.0019152679330965555, 0.0018927324805381538, 0.0015481870327877937, 0.00089470695834941306,
+	0.0, -0.0010178225878206125, -0.0020037400552054292, -0.0027874356824117317,
+	-0.003210329988021943, -0.0031540624117984395, -0.0025657163651900345, -0.0014750752642111449,
+	0.0, 0.0016624165446378462, 0.0032591192839069179, 0.0045165685815867747,
+	0.0051838984346123896, 0.0050774264697459933, 0.0041192521414141585, 0.0023628575417966491,
+	0.0, -0.0026543507866759182, -0.0051990251084333425, -0.0072020238234656924,
+	-0.0082672928192007358, -0.0081033739572956287, -0.006583111539570221, -0.0037839040415292386,
+	0.0, 0.0042781252851152507, 0.0084176358598320178, 0.01172566057463055,
+	0.013550476647788672, 0.013388189369997496, 0.010979501242341259, 0.006381274941685413,
+	0.0, -0.007421229604153888, -0.01486456304340213, -0.021143584622178104,
+	-0.02504275058758609, -0.025473530942547201, -0.021627310017882196, -0.013104323383225543,
+	0.0, 0.017065133989980476, 0.036978919264451952, 0.05823318062093958,
+	0.079072012081405949, 0.097675998716952317, 0.11236045936950932, 0.12176343577287731,
+	0.125,
+};
+
+// The FIR split into polyphase branches, zero taps removed. Output sample m is the sum of
+// coefficient * branch[AYUMI_FIR_HISTORY + m - delay] over all the taps.
+struct FIRTap {
+	int branch;
+	int delay;
+	float coefficient;
+};
+
+static struct FIRPolyphase {
+	FIRTap taps[AYUMI_FIR_SIZE];
+	int count = 0;
+	FIRPolyphase() {
+		// Output m uses oversampled sample 8m+7-k for tap k, and with k = 8*delay + p
+		// that is sample 8(m-delay) + 7-p, i.e. branch 7-p delayed by delay
+		for (int p = 0; p < AYUMI_DECIMATE_FACTOR; ++p) {
+			for (int j = 0; j < AYUMI_FIR_PHASE_TAPS; ++j) {
+				int k = j * AYUMI_DECIMATE_FACTOR + p;
+				float c = FIR_coefficients[k <= AYUMI_FIR_SIZE / 2 ? k : AYUMI_FIR_SIZE - k];
+				if (c == 0.f)
+					continue;
+				taps[count++] = { AYUMI_DECIMATE_FACTOR - 1 - p, j, c };
+			}
+		}
+	}
+} FIR_polyphase;
+
 static void slide_up(Ayumi* ay) {
 	ay->envelope += 1;
 	if (ay->envelope > 31) {
@@ -88,7 +152,7 @@ static void (* const Envelopes[][2])(Ayumi*) = {
 // Constructor
 Ayumi::Ayumi(bool isYM, double clockRate, int sampleRate) {
 	int i;
-	step = clockRate / (sampleRate * 8 * AYUMI_DECIMATE_FACTOR);
+	SetRates(clockRate, sampleRate);
 	dac_table = isYM ? YM_dac_table : AY_dac_table;
 	noise = 1;
 	SetEnvelope(1);
@@ -99,13 +163,17 @@ Ayumi::Ayumi(bool isYM, double clockRate, int sampleRate) {
 }
 
 // Public methods
+void Ayumi::SetRates(double clockRate, int sampleRate) {
+	step = clockRate / (sampleRate * 8 * AYUMI_DECIMATE_FACTOR);
+}
+
 void Ayumi::SetPan(int index, double pan, bool isEqp) {
 	if (isEqp) {
-		channels[index].pan_left = sqrt(1 - pan);
-		channels[index].pan_right = sqrt(pan);
+		channels[index].pan_left = static_cast<float>(sqrt(1 - pan));
+		channels[index].pan_right = static_cast<float>(sqrt(pan));
 	} else {
-		channels[index].pan_left = 1 - pan;
-		channels[index].pan_right = pan;
+		channels[index].pan_left = static_cast<float>(1 - pan);
+		channels[index].pan_right = static_cast<float>(pan);
 	}
 	//UpdateMixer();
 }
@@ -167,42 +235,23 @@ void Ayumi::ResetRegisters() {
 }
 
 void Ayumi::Process() {
-	int i;
-	double y1;
-	double* c_left = interpolator_left.c;
-	double* y_left = interpolator_left.y;
-	double* c_right = interpolator_right.c;
-	double* y_right = interpolator_right.y;
-	double* _fir_left = &fir_left[AYUMI_FIR_SIZE - fir_index * AYUMI_DECIMATE_FACTOR];
-	double* _fir_right = &fir_right[AYUMI_FIR_SIZE - fir_index * AYUMI_DECIMATE_FACTOR];
-	fir_index = (fir_index + 1) % (AYUMI_FIR_SIZE / AYUMI_DECIMATE_FACTOR - 1);
-	for (i = AYUMI_DECIMATE_FACTOR - 1; i >= 0; i -= 1) {
-		x += step;
-		if (x >= 1) {
-			x -= 1;
-			y_left[0] = y_left[1];
-			y_left[1] = y_left[2];
-			y_left[2] = y_left[3];
-			y_right[0] = y_right[1];
-			y_right[1] = y_right[2];
-			y_right[2] = y_right[3];
-			UpdateMixer();
-			y_left[3] = left;
-			y_right[3] = right;
-			y1 = y_left[2] - y_left[0];
-			c_left[0] = 0.5 * y_left[1] + 0.25 * (y_left[0] + y_left[2]);
-			c_left[1] = 0.5 * y1;
-			c_left[2] = 0.25 * (y_left[3] - y_left[1] - y1);
-			y1 = y_right[2] - y_right[0];
-			c_right[0] = 0.5 * y_right[1] + 0.25 * (y_right[0] + y_right[2]);
-			c_right[1] = 0.5 * y1;
-			c_right[2] = 0.25 * (y_right[3] - y_right[1] - y1);
-		}
-		_fir_left[i] = (c_left[2] * x + c_left[1]) * x + c_left[0];
-		_fir_right[i] = (c_right[2] * x + c_right[1]) * x + c_right[0];
+	float _left = 0;
+	float _right = 0;
+	ProcessBlock(&_left, &_right, 1);
+	left = _left;
+	right = _right;
+}
+
+void Ayumi::ProcessBlock(float* left, float* right, int count) {
+	while (count > 0) {
+		int n = (count < AYUMI_MAX_BLOCK ? count : AYUMI_MAX_BLOCK);
+		GenerateOversampled(n);
+		Decimate(phase_left, left, n);
+		Decimate(phase_right, right, n);
+		left += n;
+		right += n;
+		count -= n;
 	}
-	left = Decimate(_fir_left);
-	right = Decimate(_fir_right);
 }
 
 // Private methods
@@ -245,13 +294,13 @@ int Ayumi::UpdateEnvelope() {
 	return envelope;
 }
 
-void Ayumi::UpdateMixer() {
+void Ayumi::UpdateMixer(float& mixLeft, float& mixRight) {
 	int i;
 	int out;
 	int _noise = UpdateNoise();
 	int _envelope = UpdateEnvelope();
-	left = 0;
-	right = 0;
+	mixLeft = 0;
+	mixRight = 0;
 	for (i = 0; i < AYUMI_TONE_CHANNELS; i += 1) {
 		/*
 		// Old code, uses bit masking on differing types
@@ -267,102 +316,116 @@ void Ayumi::UpdateMixer() {
 			? (channels[i].e_on ? _envelope : channels[i].volume * 2 + 1)
 			: 0;
 
-		left += dac_table[out] * channels[i].pan_left;
-		right += dac_table[out] * channels[i].pan_right;
+		mixLeft += dac_table[out] * channels[i].pan_left;
+		mixRight += dac_table[out] * channels[i].pan_right;
 	}
 }
 
-double Ayumi::Decimate(double* x) {
-	double y = -0.0000046183113992051936 * (x[1] + x[191]) +
-	-0.00001117761640887225 * (x[2] + x[190]) +
-	-0.000018610264502005432 * (x[3] + x[189]) +
-	-0.000025134586135631012 * (x[4] + x[188]) +
-	-0.000028494281690666197 * (x[5] + x[187]) +
-	-0.000026396828793275159 * (x[6] + x[186]) +
-	-0.000017094212558802156 * (x[7] + x[185]) +
-	0.000023798193576966866 * (x[9] + x[183]) +
-	0.000051281160242202183 * (x[10] + x[182]) +
-	0.00007762197826243427 * (x[11] + x[181]) +
-	0.000096759426664120416 * (x[12] + x[180]) +
-	0.00010240229300393402 * (x[13] + x[179]) +
-	0.000089344614218077106 * (x[14] + x[178]) +
-	0.000054875700118949183 * (x[15] + x[177]) +
-	-0.000069839082210680165 * (x[17] + x[175]) +
-	-0.0001447966132360757 * (x[18] + x[174]) +
-	-0.00021158452917708308 * (x[19] + x[173]) +
-	-0.00025535069106550544 * (x[20] + x[172]) +
-	-0.00026228714374322104 * (x[21] + x[171]) +
-	-0.00022258805927027799 * (x[22] + x[170]) +
-	-0.00013323230495695704 * (x[23] + x[169]) +
-	0.00016182578767055206 * (x[25] + x[167]) +
-	0.00032846175385096581 * (x[26] + x[166]) +
-	0.00047045611576184863 * (x[27] + x[165]) +
-	0.00055713851457530944 * (x[28] + x[164]) +
-	0.00056212565121518726 * (x[29] + x[163]) +
-	0.00046901918553962478 * (x[30] + x[162]) +
-	0.00027624866838952986 * (x[31] + x[161]) +
-	-0.00032564179486838622 * (x[33] + x[159]) +
-	-0.00065182310286710388 * (x[34] + x[158]) +
-	-0.00092127787309319298 * (x[35] + x[157]) +
-	-0.0010772534348943575 * (x[36] + x[156]) +
-	-0.0010737727700273478 * (x[37] + x[155]) +
-	-0.00088556645390392634 * (x[38] + x[154]) +
-	-0.00051581896090765534 * (x[39] + x[153]) +
-	0.00059548767193795277 * (x[41] + x[151]) +
-	0.0011803558710661009 * (x[42] + x[150]) +
-	0.0016527320270369871 * (x[43] + x[149]) +
-	0.0019152679330965555 * (x[44] + x[148]) +
-	0.0018927324805381538 * (x[45] + x[147]) +
-	0.0015481870327877937 * (x[46] + x[146]) +
-	0.00089470695834941306 * (x[47] + x[145]) +
-	-0.0010178225878206125 * (x[49] + x[143]) +
-	-0.0020037400552054292 * (x[50] + x[142]) +
-	-0.0027874356824117317 * (x[51] + x[141]) +
-	-0.003210329988021943 * (x[52] + x[140]) +
-	-0.0031540624117984395 * (x[53] + x[139]) +
-	-0.0025657163651900345 * (x[54] + x[138]) +
-	-0.0014750752642111449 * (x[55] + x[137]) +
-	0.0016624165446378462 * (x[57] + x[135]) +
-	0.0032591192839069179 * (x[58] + x[134]) +
-	0.0045165685815867747 * (x[59] + x[133]) +
-	0.0051838984346123896 * (x[60] + x[132]) +
-	0.0050774264697459933 * (x[61] + x[131]) +
-	0.0041192521414141585 * (x[62] + x[130]) +
-	0.0023628575417966491 * (x[63] + x[129]) +
-	-0.0026543507866759182 * (x[65] + x[127]) +
-	-0.0051990251084333425 * (x[66] + x[126]) +
-	-0.0072020238234656924 * (x[67] + x[125]) +
-	-0.0082672928192007358 * (x[68] + x[124]) +
-	-0.0081033739572956287 * (x[69] + x[123]) +
-	-0.006583111539570221 * (x[70] + x[122]) +
-	-0.0037839040415292386 * (x[71] + x[121]) +
-	0.0042781252851152507 * (x[73] + x[119]) +
-	0.0084176358598320178 * (x[74] + x[118]) +
-	0.01172566057463055 * (x[75] + x[117]) +
-	0.013550476647788672 * (x[76] + x[116]) +
-	0.013388189369997496 * (x[77] + x[115]) +
-	0.010979501242341259 * (x[78] + x[114]) +
-	0.006381274941685413 * (x[79] + x[113]) +
-	-0.007421229604153888 * (x[81] + x[111]) +
-	-0.01486456304340213 * (x[82] + x[110]) +
-	-0.021143584622178104 * (x[83] + x[109]) +
-	-0.02504275058758609 * (x[84] + x[108]) +
-	-0.025473530942547201 * (x[85] + x[107]) +
-	-0.021627310017882196 * (x[86] + x[106]) +
-	-0.013104323383225543 * (x[87] + x[105]) +
-	0.017065133989980476 * (x[89] + x[103]) +
-	0.036978919264451952 * (x[90] + x[102]) +
-	0.05823318062093958 * (x[91] + x[101]) +
-	0.079072012081405949 * (x[92] + x[100]) +
-	0.097675998716952317 * (x[93] + x[99]) +
-	0.11236045936950932 * (x[94] + x[98]) +
-	0.12176343577287731 * (x[95] + x[97]) +
-	0.125 * x[96];
-	memcpy(&x[AYUMI_FIR_SIZE - AYUMI_DECIMATE_FACTOR], x, AYUMI_DECIMATE_FACTOR * sizeof(double));
-	return y;
+// Generates the 8x oversampled signal for count output samples into the polyphase branches
+void Ayumi::GenerateOversampled(int count) {
+	float y1;
+	float _mixLeft, _mixRight;
+	float* c_left = interpolator_left.c;
+	float* y_left = interpolator_left.y;
+	float* c_right = interpolator_right.c;
+	float* y_right = interpolator_right.y;
+	for (int t = AYUMI_FIR_HISTORY; t < AYUMI_FIR_HISTORY + count; t += 1) {
+		for (int q = 0; q < AYUMI_DECIMATE_FACTOR; q += 1) {
+			x += step;
+			if (x >= 1) {
+				x -= 1;
+				y_left[0] = y_left[1];
+				y_left[1] = y_left[2];
+				y_left[2] = y_left[3];
+				y_right[0] = y_right[1];
+				y_right[1] = y_right[2];
+				y_right[2] = y_right[3];
+				UpdateMixer(_mixLeft, _mixRight);
+				y_left[3] = _mixLeft;
+				y_right[3] = _mixRight;
+				y1 = y_left[2] - y_left[0];
+				c_left[0] = 0.5f * y_left[1] + 0.25f * (y_left[0] + y_left[2]);
+				c_left[1] = 0.5f * y1;
+				c_left[2] = 0.25f * (y_left[3] - y_left[1] - y1);
+				y1 = y_right[2] - y_right[0];
+				c_right[0] = 0.5f * y_right[1] + 0.25f * (y_right[0] + y_right[2]);
+				c_right[1] = 0.5f * y1;
+				c_right[2] = 0.25f * (y_right[3] - y_right[1] - y1);
+			}
+			const float _x = static_cast<float>(x);
+			phase_left[q][t] = (c_left[2] * _x + c_left[1]) * _x + c_left[0];
+			phase_right[q][t] = (c_right[2] * _x + c_right[1]) * _x + c_right[0];
+		}
+	}
+}
+
+// Applies the polyphase FIR to the branches and adds the count decimated samples to out.
+// Then keeps the last AYUMI_FIR_HISTORY samples of each branch for the next block.
+void Ayumi::Decimate(float (*phases)[AYUMI_FIR_HISTORY + AYUMI_MAX_BLOCK], float* out, int count) {
+	const FIRTap* _taps = FIR_polyphase.taps;
+	const int _tapCount = FIR_polyphase.count;
+	int m = 0;
+	// 4 accumulators of 4 samples each, so the adds don't wait on each other
+#if defined(AYUMI_SIMD_NEON)
+	for (; m + 16 <= count; m += 16) {
+		float32x4_t _acc0 = vdupq_n_f32(0.f), _acc1 = _acc0, _acc2 = _acc0, _acc3 = _acc0;
+		for (int k = 0; k < _tapCount; ++k) {
+			const float* _src = &phases[_taps[k].branch][AYUMI_FIR_HISTORY + m - _taps[k].delay];
+			const float _c = _taps[k].coefficient;
+			_acc0 = vmlaq_n_f32(_acc0, vld1q_f32(_src), _c);
+			_acc1 = vmlaq_n_f32(_acc1, vld1q_f32(_src + 4), _c);
+			_acc2 = vmlaq_n_f32(_acc2, vld1q_f32(_src + 8), _c);
+			_acc3 = vmlaq_n_f32(_acc3, vld1q_f32(_src + 12), _c);
+		}
+		vst1q_f32(out + m, vaddq_f32(vld1q_f32(out + m), _acc0));
+		vst1q_f32(out + m + 4, vaddq_f32(vld1q_f32(out + m + 4), _acc1));
+		vst1q_f32(out + m + 8, vaddq_f32(vld1q_f32(out + m + 8), _acc2));
+		vst1q_f32(out + m + 12, vaddq_f32(vld1q_f32(out + m + 12), _acc3));
+	}
+	for (; m + 4 <= count; m += 4) {
+		float32x4_t _acc = vdupq_n_f32(0.f);
+		for (int k = 0; k < _tapCount; ++k) {
+			const float* _src = &phases[_taps[k].branch][AYUMI_FIR_HISTORY + m - _taps[k].delay];
+			_acc = vmlaq_n_f32(_acc, vld1q_f32(_src), _taps[k].coefficient);
+		}
+		vst1q_f32(out + m, vaddq_f32(vld1q_f32(out + m), _acc));
+	}
+#elif defined(AYUMI_SIMD_SSE)
+	for (; m + 16 <= count; m += 16) {
+		__m128 _acc0 = _mm_setzero_ps(), _acc1 = _acc0, _acc2 = _acc0, _acc3 = _acc0;
+		for (int k = 0; k < _tapCount; ++k) {
+			const float* _src = &phases[_taps[k].branch][AYUMI_FIR_HISTORY + m - _taps[k].delay];
+			const __m128 _c = _mm_set1_ps(_taps[k].coefficient);
+			_acc0 = _mm_add_ps(_acc0, _mm_mul_ps(_mm_loadu_ps(_src), _c));
+			_acc1 = _mm_add_ps(_acc1, _mm_mul_ps(_mm_loadu_ps(_src + 4), _c));
+			_acc2 = _mm_add_ps(_acc2, _mm_mul_ps(_mm_loadu_ps(_src + 8), _c));
+			_acc3 = _mm_add_ps(_acc3, _mm_mul_ps(_mm_loadu_ps(_src + 12), _c));
+		}
+		_mm_storeu_ps(out + m, _mm_add_ps(_mm_loadu_ps(out + m), _acc0));
+		_mm_storeu_ps(out + m + 4, _mm_add_ps(_mm_loadu_ps(out + m + 4), _acc1));
+		_mm_storeu_ps(out + m + 8, _mm_add_ps(_mm_loadu_ps(out + m + 8), _acc2));
+		_mm_storeu_ps(out + m + 12, _mm_add_ps(_mm_loadu_ps(out + m + 12), _acc3));
+	}
+	for (; m + 4 <= count; m += 4) {
+		__m128 _acc = _mm_setzero_ps();
+		for (int k = 0; k < _tapCount; ++k) {
+			const float* _src = &phases[_taps[k].branch][AYUMI_FIR_HISTORY + m - _taps[k].delay];
+			_acc = _mm_add_ps(_acc, _mm_mul_ps(_mm_loadu_ps(_src), _mm_set1_ps(_taps[k].coefficient)));
+		}
+		_mm_storeu_ps(out + m, _mm_add_ps(_mm_loadu_ps(out + m), _acc));
+	}
+#endif
+	for (; m < count; ++m) {
+		float _acc = 0.f;
+		for (int k = 0; k < _tapCount; ++k)
+			_acc += _taps[k].coefficient * phases[_taps[k].branch][AYUMI_FIR_HISTORY + m - _taps[k].delay];
+		out[m] += _acc;
+	}
+	for (int q = 0; q < AYUMI_DECIMATE_FACTOR; ++q)
+		memmove(phases[q], &phases[q][count], AYUMI_FIR_HISTORY * sizeof(float));
 }
 
-double Ayumi::DCFilter(struct dc_filter* dc, int index, double x) {
+float Ayumi::DCFilter(struct dc_filter* dc, int index, float x) {
 	dc->sum += -dc->delay[index] + x;
 	dc->delay[index] = x;
 	return x - dc->sum / AYUMI_DC_FILTER_SIZE;
@@ -16,8 +16,19 @@
 constexpr int AYUMI_TONE_CHANNELS = 3;
 constexpr int AYUMI_DECIMATE_FACTOR = 8;
 constexpr int AYUMI_FIR_SIZE = 192;
+constexpr int AYUMI_FIR_PHASE_TAPS = AYUMI_FIR_SIZE / AYUMI_DECIMATE_FACTOR;	// taps per polyphase branch
+constexpr int AYUMI_FIR_HISTORY = AYUMI_FIR_PHASE_TAPS - 1;	// past samples each branch needs
+constexpr int AYUMI_MAX_BLOCK = 256;	// output samples rendered in one pass
 constexpr int AYUMI_DC_FILTER_SIZE = 1024;
 
+/*
+	The core runs in single precision and renders blocks. For each block the 8x oversampled
+	signal is generated into AYUMI_DECIMATE_FACTOR polyphase branches (branch q holds every
+	8th sample starting at q), then the 192 tap low-pass FIR is applied as 8 short filters,
+	one per branch, 4 output samples at a time with SSE or NEON. The output stays within
+	float rounding of the original double precision Ayumi.
+*/
+
 class Ayumi {
 public:
 	/** @brief Creates an ayumi structure
@@ -27,6 +38,12 @@ public:
 	 */
 	Ayumi(bool isYM = false, double clockRate = 1750000, int sampleRate = 44100);
 
+	/** @brief Changes the chip clock and output sample rate, keeping the chip state
+	 @param clockRate clock rate of the chip.
+	 @param sampleRate output sample rate
+	 */
+	void SetRates(double clockRate, int sampleRate);
+
 	/** @brief Sets the panning value for the specified sound channel
 	 @param index index of sound channel
 	 @param pan stereo panning value [0...1]
@@ -71,6 +88,12 @@ public:
 	/** @brief Renders the next stereo sample in **ay->left** and **ay->right**
 	 */
 	void Process();
+	/** @brief Renders count stereo samples and adds them to the left and right buffers
+	 @param left buffer the left channel is mixed into
+	 @param right buffer the right channel is mixed into
+	 @param count number of output samples, any size
+	 */
+	void ProcessBlock(float* left, float* right, int count);
 	
 	uint8_t latched_register = 0;	// currently latched register
 	
@@ -82,16 +105,16 @@ public:
 		bool n_off = 0;
 		bool e_on = 0;
 		int volume = 0;
-		double pan_left = 0;
-		double pan_right = 0;
+		float pan_left = 0;
+		float pan_right = 0;
 	};
 	struct interpolator {
-		double c[4] = {0};
-		double y[4] = {0};
+		float c[4] = {0};
+		float y[4] = {0};
 	};
 	struct dc_filter {
-		double sum = 0;
-		double delay[AYUMI_DC_FILTER_SIZE] = {0};
+		float sum = 0;
+		float delay[AYUMI_DC_FILTER_SIZE] = {0};
 	};
 	
 	struct tone_channel channels[AYUMI_TONE_CHANNELS];
@@ -103,21 +126,21 @@ public:
 	int envelope_shape = 0;
 	int envelope_segment = 0;
 	int envelope = 0;
-	const double* dac_table;
-	double step = 0;
+	const float* dac_table;
+	double step = 0;	// the phase accumulator stays in double so the pitch doesn't drift
 	double x = 0;
 	struct interpolator interpolator_left;
 	struct interpolator interpolator_right;
-	double fir_left[AYUMI_FIR_SIZE * 2];
-	double fir_right[AYUMI_FIR_SIZE * 2];
-	int fir_index = 0;
+	// Oversampled polyphase branches: AYUMI_FIR_HISTORY samples of history, then the block
+	float phase_left[AYUMI_DECIMATE_FACTOR][AYUMI_FIR_HISTORY + AYUMI_MAX_BLOCK] = {};
+	float phase_right[AYUMI_DECIMATE_FACTOR][AYUMI_FIR_HISTORY + AYUMI_MAX_BLOCK] = {};
 	struct dc_filter dc_left;
 	struct dc_filter dc_right;
 	int dc_index = 0;
 	/// left output sample
-	double left = 0;
+	float left = 0;
 	/// right output sample
-	double right = 0;
+	float right = 0;
 
 	// this is public because of the Envelopes dispatch table
 	void ResetSegment();
@@ -127,9 +150,10 @@ private:
 	int UpdateTone(int index);
 	int UpdateNoise();
 	int UpdateEnvelope();
-	void UpdateMixer();
-	static double Decimate(double* x);
-	static double DCFilter(struct dc_filter* dc, int index, double x);
+	void UpdateMixer(float& mixLeft, float& mixRight);
+	void GenerateOversampled(int count);
+	static void Decimate(float (*phases)[AYUMI_FIR_HISTORY + AYUMI_MAX_BLOCK], float* out, int count);
+	static float DCFilter(struct dc_filter* dc, int index, float x);
 	
 };
 
@@ -0,0 +1,123 @@
+#include "BeeperSynth.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+
+constexpr double BLEP_CUTOFF = 0.42;			// fraction of the sample rate, Nyquist is 0.5
+constexpr int BLEP_INTEGRATION_STEPS = 64;		// per sample, to integrate the sinc
+
+// Row p is the correction for a step p/BLEP_PHASES of a sample after sample n.
+// Tap j is for sample n + j + 1 - BLEP_HALF_WIDTH, and is the band-limited step minus
+// the naive step, which is already 1 from tap BLEP_HALF_WIDTH on.
+struct BlepTable
+{
+	float residual[BLEP_PHASES + 1][BLEP_TAPS];
+};
+
+// Blackman windowed sinc impulse, x in samples
+static double BlepImpulse(double x)
+{
+	if (std::abs(x) >= BLEP_HALF_WIDTH)
+		return 0.0;
+	const double _pi = 3.14159265358979323846;
+	const double _w = 0.42 + 0.5 * std::cos(_pi * x / BLEP_HALF_WIDTH) + 0.08 * std::cos(2.0 * _pi * x / BLEP_HALF_WIDTH);
+	const double _arg = 2.0 * _pi * BLEP_CUTOFF * x;
+	const double _sinc = (_arg == 0.0) ? 1.0 : std::sin(_arg) / _arg;
+	return _w * 2.0 * BLEP_CUTOFF * _sinc;
+}
+
+static BlepTable BuildBlepTable()
+{
+	// The step is the running integral of the impulse, tabulated finely then normalized to 1
+	const int _count = 2 * BLEP_HALF_WIDTH * BLEP_PHASES * BLEP_INTEGRATION_STEPS;
+	const double _dx = 1.0 / (BLEP_PHASES * BLEP_INTEGRATION_STEPS);
+	double* _step = new double[_count + 1];
+	_step[0] = 0.0;
+	for (int i = 0; i < _count; ++i)
+	{
+		const double _x = -BLEP_HALF_WIDTH + i * _dx;
+		_step[i + 1] = _step[i] + (BlepImpulse(_x) + BlepImpulse(_x + _dx)) * 0.5 * _dx;
+	}
+	const double _total = _step[_count];
+
+	BlepTable _table;
+	for (int p = 0; p <= BLEP_PHASES; ++p)
+	{
+		for (int j = 0; j < BLEP_TAPS; ++j)
+		{
+			// Distance of the tap from the step, in samples and in table entries
+			const double _x = j - BLEP_HALF_WIDTH + 1 - static_cast<double>(p) / BLEP_PHASES;
+			const int _idx = std::clamp(static_cast<int>(std::lround((_x + BLEP_HALF_WIDTH) / _dx)), 0, _count);
+			const double _naive = (j >= BLEP_HALF_WIDTH) ? 1.0 : 0.0;
+			_table.residual[p][j] = static_cast<float>(_step[_idx] / _total - _naive);
+		}
+	}
+	delete[] _step;
+	return _table;
+}
+
+static const BlepTable& GetBlepTable()
+{
+	// Built on first use, thread-safe
+	static const BlepTable s_table = BuildBlepTable();
+	return s_table;
+}
+
+BeeperSynth::BeeperSynth()
+{
+	GetBlepTable();		// build the table at startup, not in the audio callback
+	Reset();
+}
+
+void BeeperSynth::Reset(float _level)
+{
+	level = _level;
+	heldLevel = _level;
+	std::fill(std::begin(residual), std::end(residual), 0.f);
+	std::fill(std::begin(hasStep), std::end(hasStep), false);
+}
+
+void BeeperSynth::AddStep(double position, float _level)
+{
+	const float _delta = _level - level;
+	if (_delta == 0.f)
+		return;
+	level = _level;
+
+	// The step is delayed by BLEP_HALF_WIDTH samples so its correction never starts in the past.
+	// Its naive part starts at the first sample after it.
+	const int _sample = static_cast<int>(position);
+	const double _phase = (position - _sample) * BLEP_PHASES;
+	const int _p = std::min(static_cast<int>(_phase), BLEP_PHASES - 1);
+	const float _frac = static_cast<float>(_phase - _p);
+	const float* _row0 = GetBlepTable().residual[_p];
+	const float* _row1 = GetBlepTable().residual[_p + 1];
+	float* _out = residual + _sample + 1;
+	for (int j = 0; j < BLEP_TAPS; ++j)
+		_out[j] += _delta * (_row0[j] + (_row1[j] - _row0[j]) * _frac);
+
+	const int _naiveStart = _sample + 1 + BLEP_HALF_WIDTH;
+	stepLevel[_naiveStart] = _level;
+	hasStep[_naiveStart] = true;
+}
+
+void BeeperSynth::Render(float* out, int count)
+{
+	float _level = heldLevel;
+	for (int i = 0; i < count; ++i)
+	{
+		if (hasStep[i])
+			_level = stepLevel[i];
+		out[i] = _level + residual[i];
+	}
+	heldLevel = _level;
+
+	// Move what spills over into the next block to the start
+	const int _tail = BLEP_TAPS;
+	std::memmove(residual, residual + count, _tail * sizeof(float));
+	std::fill(residual + _tail, std::end(residual), 0.f);
+	std::memmove(stepLevel, stepLevel + count, _tail * sizeof(float));
+	std::memmove(hasStep, hasStep + count, _tail * sizeof(bool));
+	std::fill(hasStep + _tail, std::end(hasStep), false);
+}
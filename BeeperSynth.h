@@ -0,0 +1,48 @@
+#pragma once
+#ifndef BEEPERSYNTH_H
+#define BEEPERSYNTH_H
+
+/*
+	Band-limited synthesis of the Apple 2 speaker.
+
+	The speaker is a square wave that only changes when the Apple 2 toggles it, so instead of
+	being sampled every cycle it's described by the list of its level changes. Each change is
+	drawn as a band-limited step (BLEP): the naive step plus a short correction that rounds it
+	off below the Nyquist frequency, taken from a table of windowed sinc integrals indexed by
+	where the step falls between 2 samples. High tones don't alias and the cost only depends
+	on the number of toggles.
+
+	The correction starts BLEP_HALF_WIDTH samples before the step, so the output is delayed
+	by BLEP_HALF_WIDTH samples.
+*/
+
+#include <stdint.h>
+
+constexpr int BLEP_HALF_WIDTH = 16;		// samples on each side of a step
+constexpr int BLEP_PHASES = 64;			// table resolution between 2 samples, interpolated
+constexpr int BLEP_MAX_BLOCK = 256;		// samples rendered in one pass
+constexpr int BLEP_TAPS = 2 * BLEP_HALF_WIDTH;
+
+class BeeperSynth
+{
+public:
+	BeeperSynth();
+
+	// Drops the pending steps and holds the given level
+	void Reset(float level = 0.f);
+	// Moves the output to level at the given position of the next rendered block, in samples
+	// from its start. Positions must not go backwards within a block, and be below its length.
+	void AddStep(double position, float level);
+	// Writes the next count samples, count <= BLEP_MAX_BLOCK
+	void Render(float* out, int count);
+
+private:
+	float level = 0.f;							// level after the last added step
+	float heldLevel = 0.f;						// level at the start of the next block
+	// Indexed by sample from the start of the next block. The last steps of a block spill over
+	float residual[BLEP_MAX_BLOCK + BLEP_TAPS] = {};	// sum of the step corrections
+	float stepLevel[BLEP_MAX_BLOCK + BLEP_TAPS] = {};	// naive level from that sample on...
+	bool hasStep[BLEP_MAX_BLOCK + BLEP_TAPS] = {};		// ...if a step lands there
+};
+
+#endif // BEEPERSYNTH_H
@@ -2,9 +2,12 @@
 #include <mutex>
 #include <iostream>
 #include <chrono>
+#include <sstream>
+#include <cstring>
 #include "A2VideoManager.h"
 #include "SoundManager.h"
 #include "EventRecorder.h"
+#include "FlightRecorder.h"
 
 
 // below because "The declaration of a static data member in its class definition is not a definition"
@@ -91,6 +94,19 @@ void CycleCounter::IncrementCycles(int inc, VBLState_e vblState)
 	A2VideoManager::GetInstance()->BeamIsAtPosition(GetByteXPos(), GetScanline());
 }
 
+void CycleCounter::AdvanceCycles(uint64_t cycles)
+{
+	// Nothing changes in memory while idle, so every frame after the first complete one
+	// would be the same. Walk the beam to the end of that frame, keeping the cycles
+	// that don't make up whole frames, and skip the rest.
+	uint64_t _walk = cycles;
+	if (cycles > 3 * static_cast<uint64_t>(cycles_total))
+		_walk = (cycles % cycles_total) + 2 * static_cast<uint64_t>(cycles_total);
+	for (uint64_t i = 0; i < _walk; ++i)
+		IncrementCycles(1, VBLState_e::Unknown);
+	m_cycles_since_reset += cycles - _walk;
+}
+
 const VideoRegion_e CycleCounter::GetVideoRegion()
 {
 	return m_region;
@@ -108,6 +124,7 @@ void CycleCounter::SetVideoRegion(VideoRegion_e region)
 			cycles_vblank = cycles_total - CYCLES_SCREEN;
 			SoundManager::GetInstance()->SetPAL(true);
 			EventRecorder::GetInstance()->SetPAL(true);
+			FlightRecorder::GetInstance()->SetPAL(true);
 			std::cout << "Switched to PAL." << std::endl;
 			break;
 		case VideoRegion_e::NTSC:
@@ -115,7 +132,8 @@ void CycleCounter::SetVideoRegion(VideoRegion_e region)
 			cycles_total = CYCLES_TOTAL_NTSC;
 			cycles_vblank = cycles_total - CYCLES_SCREEN;
 			SoundManager::GetInstance()->SetPAL(false);
-			EventRecorder::GetInstance()->SetPAL(true);
+			EventRecorder::GetInstance()->SetPAL(false);
+			FlightRecorder::GetInstance()->SetPAL(false);
 			std::cout << "Switched to NTSC." << std::endl;
 			break;
 		default:
@@ -158,6 +176,40 @@ const uint32_t CycleCounter::GetScreenCycles()
 	return CYCLES_SCREEN;
 }
 
+std::string CycleCounter::SerializeState() const {
+	uint8_t _data[sizeof(m_region) + sizeof(m_cycle) + sizeof(m_prev_vbl_start) + sizeof(m_cycles_since_reset)];
+	return std::string(reinterpret_cast<const char*>(_data), SerializeState(_data));
+}
+
+size_t CycleCounter::SerializeState(uint8_t* data) const {
+	uint8_t* _p = data;
+	memcpy(_p, &m_region, sizeof(m_region));
+	_p += sizeof(m_region);
+	memcpy(_p, &m_cycle, sizeof(m_cycle));
+	_p += sizeof(m_cycle);
+	memcpy(_p, &m_prev_vbl_start, sizeof(m_prev_vbl_start));
+	_p += sizeof(m_prev_vbl_start);
+	memcpy(_p, &m_cycles_since_reset, sizeof(m_cycles_since_reset));
+	_p += sizeof(m_cycles_since_reset);
+	return _p - data;
+}
+
+void CycleCounter::DeserializeState(const std::string& data) {
+	std::istringstream in(data);
+	VideoRegion_e _region = m_region;
+	uint32_t _cycle = m_cycle;
+	in.read(reinterpret_cast<char*>(&_region), sizeof(_region));
+	in.read(reinterpret_cast<char*>(&_cycle), sizeof(_cycle));
+	in.read(reinterpret_cast<char*>(&m_prev_vbl_start), sizeof(m_prev_vbl_start));
+	in.read(reinterpret_cast<char*>(&m_cycles_since_reset), sizeof(m_cycles_since_reset));
+	// Switching regions moves the beam, so do it first
+	if ((_region == VideoRegion_e::NTSC) || (_region == VideoRegion_e::PAL))
+		SetVideoRegion(_region);
+	m_cycle = _cycle % cycles_total;
+	bIsVBL = (m_cycle >= CYCLES_SCREEN);
+	bIsHBL = (GetByteXPos() < CYCLES_SC_HBL);
+}
+
 void CycleCounter::SetVBLStart(uint32_t _vblStart)
 {
 	// Don't allow a VBL start that's after the screen cycles
@@ -5,6 +5,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string>
 
 constexpr uint32_t SC_TOTAL_NTSC = 262;
 constexpr uint32_t SC_TOTAL_PAL = 312;
@@ -34,6 +35,9 @@ class CycleCounter
 {
 public:
 	void IncrementCycles(int inc, VBLState_e vblState);
+	// Fast-forwards over idle cycles. Only enough of them to render a whole frame
+	// go through the beam, the other whole frames are skipped.
+	void AdvanceCycles(uint64_t cycles);
 	const bool IsVBL();
 	const bool IsHBL();
 	const bool IsInBlank();
@@ -54,6 +58,12 @@ public:
 	// Get cycles since reset
 	uint64_t GetCyclesSinceReset() { return m_cycles_since_reset; };
 	
+	// De/serialization of the region and beam position, for replay keyframes.
+	// The pointer version writes the same bytes without allocating, and returns their size.
+	std::string SerializeState() const;
+	size_t SerializeState(uint8_t* data) const;
+	void DeserializeState(const std::string& data);
+	
 	// public singleton code
 	static CycleCounter* GetInstance()
 	{
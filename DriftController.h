@@ -0,0 +1,72 @@
+#pragma once
+#ifndef DRIFTCONTROLLER_H
+#define DRIFTCONTROLLER_H
+
+#include <algorithm>
+
+/**************************************************************/
+/* Locks an audio consumer to the Apple 2 bus clock.          */
+/* The bus and the audio device run on different crystals, so */
+/* a buffer between them slowly fills or drains. Update() is  */
+/* given the buffer level after each audio block and returns  */
+/* the rate at which the consumer should read the bus samples */
+/* to keep the level at the target: above 1 reads faster.     */
+/* It's a PI loop on the smoothed level. The rate never moves */
+/* more than maxAdjust from 1, which keeps pitch changes far  */
+/* below what can be heard.                                   */
+/**************************************************************/
+class DriftController
+{
+public:
+	DriftController(double targetLevel, double maxAdjust = 0.005)
+		: d_target(targetLevel), d_maxAdjust(maxAdjust), d_level(targetLevel) {};
+
+	void SetTarget(double targetLevel) {
+		d_target = targetLevel;
+		Reset();
+	}
+
+	// Call when the buffer was refilled from scratch. The integral is the estimate
+	// of the clock difference, which hasn't changed, so it's kept unless asked.
+	void Reset(bool bClearDrift = false) {
+		d_level = d_target;
+		if (bClearDrift)
+			d_integral = 0.0;
+		d_rate = std::clamp(1.0 + d_integral, 1.0 - d_maxAdjust, 1.0 + d_maxAdjust);
+	}
+
+	// The level is in samples, blockSamples is the number of samples played since the
+	// last update. The loop responds the same whatever the block size or the target.
+	double Update(double level, int blockSamples = REFERENCE_BLOCK) {
+		const double _blockScale = static_cast<double>(blockSamples) / REFERENCE_BLOCK;
+		d_level += std::min(1.0, LEVEL_SMOOTHING * _blockScale) * (level - d_level);
+		const double _error = (d_level - d_target) / REFERENCE_LEVEL;
+		d_integral = std::clamp(d_integral + KI * _blockScale * _error, -d_maxAdjust, d_maxAdjust);
+		d_rate = std::clamp(1.0 + KP * _error + d_integral, 1.0 - d_maxAdjust, 1.0 + d_maxAdjust);
+		return d_rate;
+	}
+
+	double GetRate() const { return d_rate; };
+	double GetTarget() const { return d_target; };
+	double GetSmoothedLevel() const { return d_level; };
+	// The measured clock difference, in parts per million
+	double GetDriftPPM() const { return d_integral * 1'000'000.0; };
+
+private:
+	// Tuned for updates every 256 samples at 44.1kHz, with errors counted in units of
+	// 512 samples. It absorbs a few hundred ppm of crystal difference in seconds, and
+	// USB burstiness only moves the rate by ~50ppm.
+	static constexpr int REFERENCE_BLOCK = 256;
+	static constexpr double REFERENCE_LEVEL = 512.0;
+	static constexpr double LEVEL_SMOOTHING = 0.05;
+	static constexpr double KP = 0.002;
+	static constexpr double KI = 0.00001;
+
+	double d_target;
+	double d_maxAdjust;
+	double d_level;
+	double d_integral = 0.0;
+	double d_rate = 1.0;
+};
+
+#endif // DRIFTCONTROLLER_H
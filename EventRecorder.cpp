@@ -6,6 +6,7 @@
 #include "MockingboardManager.h"
 #include "extras/MemoryLoader.h"
 #include "LogTextManager.h"
+#include "VCRFile.h"
 #include "imgui.h"
 #include "imgui_internal.h"		// for PushItemFlag
 #include "extras/ImGuiFileDialog.h"
@@ -13,8 +14,15 @@
 #include <fstream>
 #include <sstream>
 #include <chrono>
+#include <algorithm>
+#include <filesystem>
 
-constexpr uint32_t MAXRECORDING_SECONDS = 30;	// Max number of seconds to record
+constexpr uint32_t MAXRECORDING_SECONDS = 30;	// Events reserved for recordings loaded in memory, in seconds
+
+// Replay speeds offered in the UI
+static const float g_replaySpeeds[] = { 0.f, 0.25f, 0.5f, 1.f, 2.f, 4.f, 8.f, 16.f };
+static const char* g_replaySpeedNames[] = { "Max speed", "0.25x", "0.5x", "1x", "2x", "4x", "8x", "16x" };
+static const char* g_recordingFilterNames[] = { "All events", "State changes only" };
 
 // below because "The declaration of a static data member in its class definition is not a definition"
 EventRecorder* EventRecorder::s_instance;
@@ -29,7 +37,7 @@ static size_t m_current_snapshot_cycles = RECORDER_MEM_SNAPSHOT_CYCLES;
 void EventRecorder::Initialize()
 {
 	ClearRecording();
-	slowdownMultiplier = 1;
+	replaySpeed = 1.f;
 }
 
 EventRecorder::~EventRecorder()
@@ -41,56 +49,203 @@ EventRecorder::~EventRecorder()
 // Serialization and data transfer methods
 //////////////////////////////////////////////////////////////////////////
 
-void EventRecorder::MakeRAMSnapshot(size_t cycle)
+// The machine state parts are written after their 32-bit size. Writes the size of the
+// part at state + 4, and returns where the next part goes.
+static uint8_t* EndStatePart(uint8_t* state, size_t size)
+{
+	const uint32_t _size = static_cast<uint32_t>(size);
+	memcpy(state, &_size, sizeof(_size));
+	return state + sizeof(_size) + _size;
+}
+
+void EventRecorder::FillSnapshot(uint8_t* data, size_t cycle)
 {
-	(void)cycle; // mark as unused
 	auto _memsize = _A2_MEMORY_SHADOW_END;
-	ByteBuffer buffer(RECORDER_TOTALMEMSIZE);
 	// Get the MAIN chunk
-	buffer.copyFrom(MemoryManager::GetInstance()->GetApple2MemPtr(), 0, _memsize);
+	memcpy(data, MemoryManager::GetInstance()->GetApple2MemPtr(), _memsize);
 	// Get the AUX chunk
-	buffer.copyFrom(MemoryManager::GetInstance()->GetApple2MemAuxPtr(), 0x10000, _memsize);
+	memcpy(data + 0x10000, MemoryManager::GetInstance()->GetApple2MemAuxPtr(), _memsize);
+	// And the machine state, so that replays can start from any snapshot.
+	// The parts are written in place, nothing is allocated.
+	memset(data + RECORDER_STATE_OFFSET, 0, 0x10000 - RECORDER_STATE_OFFSET);
+	uint8_t* _state = data + RECORDER_STATE_OFFSET;
+	memcpy(_state, RECORDER_STATE_MAGIC, 8);
+	SetSnapshotCycle(data, cycle);
+	_state += 8 + sizeof(uint64_t);
+	_state = EndStatePart(_state, MemoryManager::GetInstance()->SerializeSwitches(_state + sizeof(uint32_t)));
+	_state = EndStatePart(_state, CycleCounter::GetInstance()->SerializeState(_state + sizeof(uint32_t)));
+	_state = EndStatePart(_state, MockingboardManager::GetInstance()->SerializeRegisters(_state + sizeof(uint32_t)));
+}
+
+void EventRecorder::SetSnapshotCycle(uint8_t* data, size_t cycle)
+{
+	const uint64_t _cycle = cycle;
+	memcpy(data + RECORDER_STATE_OFFSET + 8, &_cycle, sizeof(_cycle));
+}
+
+void EventRecorder::MakeRAMSnapshot(size_t cycle)
+{
+	ByteBuffer buffer(RECORDER_TOTALMEMSIZE);
+	FillSnapshot(buffer.data(), cycle);
 
-	v_memSnapshots.push_back(std::move(buffer));
+	// While recording, it goes straight to the file. Only the pages that changed since
+	// the last keyframe are stored, which is what makes frequent snapshots cheap.
+	if (m_writer.IsOpen())
+		m_writer.AddSnapshot(buffer.data(), buffer.size(), (cycle % RECORDER_MEM_KEYFRAME_CYCLES) < RECORDER_MEM_SNAPSHOT_CYCLES);
+	else
+		v_memSnapshots.push_back(std::move(buffer));
+}
+
+size_t EventRecorder::GetSnapshotCount()
+{
+	return m_reader.IsOpen() ? m_reader.GetSnapshotCount() : v_memSnapshots.size();
 }
 
-void EventRecorder::ApplyRAMSnapshot(size_t snapshot_index)
+size_t EventRecorder::ApplyRAMSnapshot(size_t snapshot_index)
 {
-	if (snapshot_index > (v_memSnapshots.size() - 1)) {
+	const ByteBuffer* _snapshot = nullptr;
+	if (m_reader.IsOpen())
+	{
+		if (m_reader.ReadSnapshot(snapshot_index, m_streamedSnapshot.data(), m_streamedSnapshot.size()))
+			_snapshot = &m_streamedSnapshot;
+	}
+	else if (snapshot_index < v_memSnapshots.size())
+		_snapshot = &v_memSnapshots[snapshot_index];
+	if (_snapshot == nullptr) {
 		std::cerr << "ERROR: Requested to apply nonexistent memory snapshot at index " << snapshot_index << std::endl;
-		return;
+		return 0;
 	}
 	auto _memsize = _A2_MEMORY_SHADOW_END;
 	// Set the MAIN chunk
-	v_memSnapshots.at(snapshot_index).copyTo(MemoryManager::GetInstance()->GetApple2MemPtr(), 0, _memsize);
+	_snapshot->copyTo(MemoryManager::GetInstance()->GetApple2MemPtr(), 0, _memsize);
 	// Set the AUX chunk
-	v_memSnapshots.at(snapshot_index).copyTo(MemoryManager::GetInstance()->GetApple2MemAuxPtr(), 0x10000, _memsize);
-}
-
-void EventRecorder::WriteRecordingFile(std::ofstream& file)
-{
-	// TODO: 	Start with a version
-	//			Then write PAL/NTSC
-	//			Then write VBL state for event 0
-	
-	// First store the RAM snapshot interval
-	file.write(reinterpret_cast<const char*>(&m_current_snapshot_cycles), sizeof(m_current_snapshot_cycles));
-	// Next store the event vector size
-	auto _size = v_events.size();
-	file.write(reinterpret_cast<const char*>(&_size), sizeof(_size));
-	// Next store the RAM states
-	for (const auto& snapshot : v_memSnapshots) {
-		file.write(reinterpret_cast<const char*>(snapshot.data()), (RECORDER_TOTALMEMSIZE) / sizeof(uint8_t));
+	_snapshot->copyTo(MemoryManager::GetInstance()->GetApple2MemAuxPtr(), 0x10000, _memsize);
+
+	// Older snapshots only have the memory
+	size_t _cycle = snapshot_index * m_current_snapshot_cycles;
+	const uint8_t* _state = _snapshot->data() + RECORDER_STATE_OFFSET;
+	const uint8_t* _stateEnd = _snapshot->data() + 0x10000;
+	if (memcmp(_state, RECORDER_STATE_MAGIC, 8) != 0)
+		return _cycle;
+	uint64_t _stateCycle;
+	memcpy(&_stateCycle, _state + 8, sizeof(_stateCycle));
+	_state += 8 + sizeof(uint64_t);
+	std::string _parts[3];
+	for (auto& _part : _parts)
+	{
+		uint32_t _size;
+		memcpy(&_size, _state, sizeof(_size));
+		_state += sizeof(_size);
+		if (_size > static_cast<size_t>(_stateEnd - _state))
+		{
+			std::cerr << "ERROR: Corrupt machine state in memory snapshot " << snapshot_index << std::endl;
+			return _cycle;
+		}
+		_part.assign(reinterpret_cast<const char*>(_state), _size);
+		_state += _size;
 	}
+	MemoryManager::GetInstance()->DeserializeSwitches(_parts[0]);
+	CycleCounter::GetInstance()->DeserializeState(_parts[1]);
+	MockingboardManager::GetInstance()->DeserializeRegisters(_parts[2]);
+	return static_cast<size_t>(_stateCycle);
+}
 
-	std::cout << "Writing " << _size << " events to file" << std::endl;
-	// And finally the events
-	for (const auto& event : v_events) {
-		WriteEvent(event, file);
+uint64_t EventRecorder::GetEventCount()
+{
+	if (m_reader.IsOpen())
+		return m_reader.GetEventCount();
+	return v_events.size();
+}
+
+SDHREvent EventRecorder::GetEvent(size_t index)
+{
+	if (!m_reader.IsOpen())
+		return v_events.at(index);
+	const size_t _chunkEvents = m_reader.GetHeader().chunkEvents;
+	const size_t _chunkIndex = index / _chunkEvents;
+	if ((m_replayChunk == nullptr) || (m_replayChunkIndex != _chunkIndex))
+	{
+		m_replayChunk = m_reader.GetEventChunk(_chunkIndex);
+		m_replayChunkIndex = _chunkIndex;
+	}
+	if ((m_replayChunk == nullptr) || ((index % _chunkEvents) >= m_replayChunk->size()))
+		return SDHREvent(false, false, false, true, 0, 0);	// corrupt chunk, a dummy read
+	return (*m_replayChunk)[index % _chunkEvents];
+}
+
+bool EventRecorder::WriteRecordingFile(const std::string& path)
+{
+	// A streamed recording is already in its file
+	if (m_reader.IsOpen())
+	{
+		std::error_code _ec;
+		if (std::filesystem::equivalent(path, m_reader.GetPath(), _ec))
+			return true;
+		std::filesystem::copy_file(m_reader.GetPath(), path, std::filesystem::copy_options::overwrite_existing, _ec);
+		if (_ec)
+		{
+			m_lastErrorString = "Error saving the recording: " + _ec.message();
+			return false;
+		}
+		return true;
+	}
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		m_lastErrorString = "Error opening file";
+		return false;
+	}
+	VCRHeader _header;
+	_header.region = (bIsPAL ? VideoRegion_e::PAL : VideoRegion_e::NTSC);
+	if ((v_events.size() > 0) && v_events.front().is_iigs)
+		_header.machine = VCRMachine_e::Apple2gs;
+	_header.eventCount = v_events.size();
+	_header.snapshotInterval = m_current_snapshot_cycles;
+	_header.snapshotCount = static_cast<uint32_t>(v_memSnapshots.size());
+
+	std::cout << "Writing " << v_events.size() << " events to file" << std::endl;
+	VCRFile _vcr;
+	if (!_vcr.WriteRecording(file, _header, v_events, v_memSnapshots, RECORDER_TOTALMEMSIZE))
+	{
+		m_lastErrorString = _vcr.GetLastError();
+		return false;
 	}
+	return true;
 }
 
-void EventRecorder::ReadRecordingFile(std::ifstream& file)
+bool EventRecorder::ReadRecordingFile(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		m_lastErrorString = "Error opening file";
+		return false;
+	}
+	if (!VCRFile::HasMagic(file))
+		return ReadLegacyRecordingFile(file);
+	file.close();
+
+	StopReplay();
+	ClearRecording();
+	// Only the chunks around the replay position are ever in memory
+	if (!m_reader.Open(path))
+	{
+		m_lastErrorString = m_reader.GetLastError();
+		return false;
+	}
+	const VCRHeader& _header = m_reader.GetHeader();
+	m_current_snapshot_cycles = _header.snapshotInterval;
+	std::cout << "Opened " << _header.eventCount << " events from file" << std::endl;
+
+	// Replay in the region it was recorded in
+	if ((_header.region == VideoRegion_e::PAL) || (_header.region == VideoRegion_e::NTSC))
+		CycleCounter::GetInstance()->SetVideoRegion(_header.region);
+	bHasRecording = true;
+	return true;
+}
+
+bool EventRecorder::ReadLegacyRecordingFile(std::ifstream& file)
 {
 	StopReplay();
 	ClearRecording();
@@ -100,6 +255,12 @@ void EventRecorder::ReadRecordingFile(std::ifstream& file)
 	// Next read the event vector size
 	size_t _size;
 	file.read(reinterpret_cast<char*>(&_size), sizeof(_size));
+	if (!file.good() || (m_current_snapshot_cycles == 0))
+	{
+		ClearRecording();
+		m_lastErrorString = "Not a recording file";
+		return false;
+	}
 	// Then all the RAM states
 	if (_size > 0)
 	{
@@ -109,57 +270,72 @@ void EventRecorder::ReadRecordingFile(std::ifstream& file)
 			v_memSnapshots.push_back(std::move(snapshot));
 		}
 	}
-	std::cout << "Reading " << _size << " events from file" << std::endl;
+	std::cout << "Reading " << _size << " legacy events from file" << std::endl;
 	// And finally the events
-	if (_size > 0)
+	ReadLegacyEvents(file, _size);
+	if (!file.good())
 	{
-		for (size_t i = 0; i < _size; ++i) {
-			ReadEvent(file);
-		}
+		ClearRecording();
+		m_lastErrorString = "Truncated recording file";
+		return false;
 	}
 	bHasRecording = true;
+	return true;
 }
 
-void EventRecorder::ReadTextEventsFromFile(std::ifstream& file)
+bool EventRecorder::ReadTextEventsFromFile(std::ifstream& file)
 {
 	StopReplay();
 	ClearRecording();
 	MakeRAMSnapshot(0);	// Just make a snapshot of what is now
-	v_events.reserve(1000000 * MAXRECORDING_SECONDS);
-	
-	std::string line;
-	while (std::getline(file, line)) {
-		if (line.empty() || line[0] == '#') {
-			continue; // Skip empty lines or lines starting with '#'
-		}
-		
-		std::stringstream ss(line);
-		std::string count_str, is_iigs_str, m2b0_str, m2sel_str, rw_str, addr_str, data_str;
-		
-		std::getline(ss, count_str, ',');
-		std::getline(ss, is_iigs_str, ',');
-		std::getline(ss, m2b0_str, ',');
-		std::getline(ss, m2sel_str, ',');
-		std::getline(ss, rw_str, ',');
-		std::getline(ss, addr_str, ',');
-		std::getline(ss, data_str, ',');
-		
-		auto count = std::stoul(count_str);
-		bool is_iigs = std::stoi(is_iigs_str);
-		bool m2b0 = std::stoi(m2b0_str);
-		bool m2sel = std::stoi(m2sel_str);
-		bool rw = std::stoi(rw_str);
-		uint16_t addr = static_cast<uint16_t>(std::stoul(addr_str, nullptr, 16));
-		uint8_t data = static_cast<uint8_t>(std::stoul(data_str, nullptr, 16));
-		
-		SDHREvent event(is_iigs, m2b0, m2sel, rw, addr, data);
-		for (size_t i = 0; i < count; ++i) {
-			v_events.push_back(event);
-		}
+	if (!m_textEventsReader.Read(file, v_events))
+	{
+		m_lastErrorString = m_textEventsReader.GetLastError();
+		std::cerr << "Error reading text events: " << m_lastErrorString << std::endl;
+		v_events.clear();
+		return false;
 	}
-
 	std::cout << "Read " << v_events.size() << " text events from file" << std::endl;
 	bHasRecording = true;
+	return true;
+}
+
+void EventRecorder::StartTextEventsLoad(const std::string& path)
+{
+	StopReplay();
+	ClearRecording();
+	MakeRAMSnapshot(0);	// Just make a snapshot of what is now
+	bIsLoadingText = true;
+	thread_load = std::thread([this, path]() {
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open())
+			bTextLoadSucceeded = false;
+		else
+			bTextLoadSucceeded = m_textEventsReader.Read(file, v_loadedEvents);
+		bIsLoadingText = false;
+	});
+}
+
+void EventRecorder::FinishTextEventsLoad()
+{
+	if (thread_load.joinable())
+		thread_load.join();
+	if (bTextLoadSucceeded)
+	{
+		v_events = std::move(v_loadedEvents);
+		std::cout << "Read " << v_events.size() << " text events from file" << std::endl;
+		bHasRecording = true;
+	}
+	else {
+		m_lastErrorString = m_textEventsReader.GetLastError();
+		if (m_lastErrorString.empty())
+			m_lastErrorString = "Error opening file";
+		std::cerr << "Error reading text events: " << m_lastErrorString << std::endl;
+		bImGuiOpenModal = true;
+		ImGui::OpenPopup("Recorder Error Modal");
+	}
+	v_loadedEvents = std::vector<SDHREvent>();
+	bTextLoadSucceeded = false;
 }
 
 // Reading an animation file locally
@@ -178,11 +354,10 @@ void EventRecorder::ReadTextEventsFromFile(std::ifstream& file)
 //
 // NOTE: The new PWA format extends the above to allow for any type of SHR as the first frame,
 //       including SHR, SHR4, SHR3200 or any combination of those in interlace or page flip mode
-void EventRecorder::ReadPaintWorksAnimationsFile(std::ifstream& file)
+bool EventRecorder::ReadPaintWorksAnimationsFile(std::ifstream& file)
 {
 	StopReplay();
 	ClearRecording();
-	v_events.reserve(1000000 * MAXRECORDING_SECONDS);
 	auto logManager = LogTextManager::GetInstance();
 
 	// First parse the SHR data at the start of the file
@@ -192,18 +367,21 @@ void EventRecorder::ReadPaintWorksAnimationsFile(std::ifstream& file)
 	if (file)
 		parsedCount = ParseSHRData(file, 0, &typeE1, &typeE0);
 	if (parsedCount == 0) {
-		logManager->AddLog(std::string("Error! SHR animation unknown file size"));
-		return;
+		m_lastErrorString = "SHR animation unknown file size";
+		logManager->AddLog("Error! " + m_lastErrorString);
+		return false;
 	}
 	if (typeE1 == SHRFileContent_e::UNKNOWN) {
-		logManager->AddLog(std::string("Error! Unknown SHR type"));
-		return;
+		m_lastErrorString = "Unknown SHR type";
+		logManager->AddLog("Error! " + m_lastErrorString);
+		return false;
 	}
 	file.seekg(0, std::ios::end);
 	size_t fileSize = file.tellg();
 	if (fileSize - parsedCount < 8) {	// animation data is not there!
-		logManager->AddLog(std::string("Error! Not enough animation data"));
-		return;
+		m_lastErrorString = "Not enough animation data";
+		logManager->AddLog("Error! " + m_lastErrorString);
+		return false;
 	}
 
 	std::string logText = "Loaded base SHR";
@@ -258,6 +436,7 @@ void EventRecorder::ReadPaintWorksAnimationsFile(std::ifstream& file)
 	MakeRAMSnapshot(0);	// Make a snapshot now, before doing the animations events
 	if (dbaLength > 4)
 	{
+		v_events.reserve(dbaLength / 2 + 2);	// each 4-byte entry is at most 2 events
 		uint32_t _currFrameSize = 0;	// size of the current frame, including this 4-byte value
 		uint32_t _currFramePtr = 0;		// where are we in the current frame?
 		uint16_t _off = 0;
@@ -287,9 +466,11 @@ void EventRecorder::ReadPaintWorksAnimationsFile(std::ifstream& file)
 			_dataPtr += 4;
 			if (_off == 0)	// delay
 			{
-				// add the delay between the frames using a dummy read event
-				for (size_t _d = 0; _d < ((size_t)frameDelay * _frameCycles); ++_d) {
-					v_events.push_back(SDHREvent(false, false, false, true, 0, 0));
+				// add the delay between the frames as delay events, that the replay skips through
+				for (size_t _d = (size_t)frameDelay * _frameCycles; _d > 0;) {
+					const size_t _cycles = std::min<size_t>(_d, SDHR_EVENT_MAX_DELAY);
+					v_events.push_back(SDHREvent::MakeDelay(static_cast<uint32_t>(_cycles)));
+					_d -= _cycles;
 				}
 			} else {	// proper offset, will roll over if offset > 0xE0000
 				v_events.push_back(SDHREvent(false, false, false, false, _off + 0x2000, _valHi));
@@ -299,25 +480,28 @@ void EventRecorder::ReadPaintWorksAnimationsFile(std::ifstream& file)
 		v_events.push_back(SDHREvent(false, false, false, false, 0xC004, 0));	// RAMWRTOFF
 	}
 	bHasRecording = true;
+	return true;
 }
 
-void EventRecorder::WriteEvent(const SDHREvent& event, std::ofstream& file) {
-	// Serialize and write each member of SDHREvent to the file
-	file.write(reinterpret_cast<const char*>(&event.is_iigs), sizeof(event.is_iigs));
-	file.write(reinterpret_cast<const char*>(&event.m2b0), sizeof(event.m2b0));
-	file.write(reinterpret_cast<const char*>(&event.rw), sizeof(event.rw));
-	file.write(reinterpret_cast<const char*>(&event.addr), sizeof(event.addr));
-	file.write(reinterpret_cast<const char*>(&event.data), sizeof(event.data));
-}
-
-void EventRecorder::ReadEvent(std::ifstream& file) {
-	auto event = SDHREvent(false, false, false, 0, 0, 0);
-	file.read(reinterpret_cast<char*>(&event.is_iigs), sizeof(event.is_iigs));
-	file.read(reinterpret_cast<char*>(&event.m2b0), sizeof(event.m2b0));
-	file.read(reinterpret_cast<char*>(&event.rw), sizeof(event.rw));
-	file.read(reinterpret_cast<char*>(&event.addr), sizeof(event.addr));
-	file.read(reinterpret_cast<char*>(&event.data), sizeof(event.data));
-	v_events.push_back(std::move(event));
+// Legacy events are 6 bytes: is_iigs, m2b0, rw, addr, data. They don't have m2sel.
+// They're read in blocks, a stream read per field is very slow.
+void EventRecorder::ReadLegacyEvents(std::ifstream& file, size_t count) {
+	constexpr size_t _eventSize = 6;
+	constexpr size_t _blockEvents = 64 * 1024;
+	std::vector<uint8_t> _block(_blockEvents * _eventSize);
+	while (count > 0)
+	{
+		const size_t _n = std::min(count, _blockEvents);
+		file.read(reinterpret_cast<char*>(_block.data()), _n * _eventSize);
+		if (!file.good())
+			return;
+		for (size_t i = 0; i < _n; ++i)
+		{
+			const uint8_t* _e = _block.data() + i * _eventSize;
+			v_events.emplace_back(_e[0] != 0, _e[1] != 0, false, _e[2] != 0, static_cast<uint16_t>(_e[3] | (_e[4] << 8)), _e[5]);
+		}
+		count -= _n;
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -326,7 +510,8 @@ void EventRecorder::ReadEvent(std::ifstream& file) {
 
 void EventRecorder::StopReplay()
 {
-	if (m_state == EventRecorderStates_e::PLAYING)
+	// The thread may also be paused
+	if (thread_replay.joinable())
 	{
 		bShouldStopReplay = true;
 		if (thread_replay.joinable())
@@ -362,64 +547,102 @@ void EventRecorder::RewindReplay()
 int EventRecorder::replay_events_thread(bool* shouldPauseReplay, bool* shouldStopReplay)
 {
 	using namespace std::chrono;
-	// Duration of an Apple 2 clock cycle (not stretched)
-	auto duration_ns = 1'000'000'000 / (bIsPAL ? _A2_CPU_FREQUENCY_PAL : _A2_CPU_FREQUENCY_NTSC);
-	auto targetDuration = duration_cast<high_resolution_clock::duration>(duration<double, std::nano>(slowdownMultiplier * duration_ns));
-	auto startTime = high_resolution_clock::now();
-	auto nextTime = startTime;
+	// Events are dispatched in slices of RECORDER_REPLAY_SLICE_USEC, sleeping in between.
+	// How many cycles are due is measured from an anchor time on the monotonic clock,
+	// so late wakeups only make the next slice bigger and never accumulate drift.
+	// Events are one cycle each, except delay events.
+	const double _cyclesPerSecond = (bIsPAL ? _A2_CPU_FREQUENCY_PAL : _A2_CPU_FREQUENCY_NTSC);
+	const auto _slice = microseconds(RECORDER_REPLAY_SLICE_USEC);
+	auto anchorTime = steady_clock::now();
+	uint64_t anchorCycles = 0;		// cycles dispatched since the anchor
+	float anchorSpeed = replaySpeed;
+	auto reanchor = [&]() {
+		anchorTime = steady_clock::now();
+		anchorCycles = 0;
+		anchorSpeed = replaySpeed;
+	};
 
 	while (!*shouldStopReplay)
 	{
 		if (*shouldPauseReplay)
 		{
 			SetState(EventRecorderStates_e::PAUSED);
-			std::this_thread::sleep_for(seconds(1));
+			std::this_thread::sleep_for(milliseconds(50));
 			continue;
 		}
 		if (GetState() != EventRecorderStates_e::PLAYING)
 		{
 			SetState(EventRecorderStates_e::PLAYING);
-			startTime = high_resolution_clock::now();
-			nextTime = startTime;
+			reanchor();
 		}
 		// Check if the user requested to move to a different area in the recording
 		if (bUserMovedEventSlider)
 		{
 			bUserMovedEventSlider = false;
 			// Move to the requested event. In order to do this cleanly, we need:
-			// 1. to find the closest previous memory snapshot
-			// 2. run all events between the mem snapshot and the requested event
-			// These events can be run at max speed
-			auto snapshot_index = currentReplayEvent / m_current_snapshot_cycles;
-			ApplyRAMSnapshot(snapshot_index);
-			auto first_event_index = snapshot_index * m_current_snapshot_cycles;
+			// 1. to restore the machine state at the closest previous snapshot
+			// 2. run all events between the snapshot and the requested event
+			// These events can be run at max speed, there are at most RECORDER_MEM_SNAPSHOT_CYCLES of them
+			// Recordings that weren't made live (csv, animations) may have a single snapshot
+			auto snapshot_index = std::min<size_t>(currentReplayEvent / m_current_snapshot_cycles,
+				std::max<size_t>(GetSnapshotCount(), 1) - 1);
+			auto first_event_index = ApplyRAMSnapshot(snapshot_index);
+			// In filtered recordings the snapshot may be just after the requested event
+			if ((first_event_index > currentReplayEvent) && (snapshot_index > 0))
+				first_event_index = ApplyRAMSnapshot(snapshot_index - 1);
+			first_event_index = std::min<size_t>(first_event_index, currentReplayEvent);
 			for (auto i = first_event_index; i < currentReplayEvent; i++)
 			{
-				auto e = v_events.at(i);
+				auto e = GetEvent(i);
 				process_single_event(e);
 			}
+			reanchor();
 		}
 
-		if ((v_events.size() > 0) && (currentReplayEvent < v_events.size()))
+		const uint64_t _eventCount = GetEventCount();
+		if (currentReplayEvent >= _eventCount)
 		{
-			if (*shouldStopReplay)	// In case a stop was sent while sleeping
-				break;
-			auto e = v_events.at(currentReplayEvent);
-			process_single_event(e);
-			currentReplayEvent += 1;
-			// wait 1 clock cycle before adding the next event, compensating for drift
-			nextTime += targetDuration;
-			while (true)
+			currentReplayEvent = 0;
+			ApplyRAMSnapshot(0);
+			reanchor();
+			continue;
+		}
+
+		// Find how far the replay should be by now
+		const float _speed = replaySpeed;
+		if (_speed != anchorSpeed)
+			reanchor();
+		uint64_t _targetCycles;
+		size_t _maxEvents = _eventCount - currentReplayEvent;
+		if (_speed <= 0.f)
+		{
+			_targetCycles = UINT64_MAX;
+			_maxEvents = std::min<size_t>(_maxEvents, RECORDER_REPLAY_MAX_BATCH);
+		}
+		else {
+			const double _elapsed = duration<double>(steady_clock::now() - anchorTime).count();
+			_targetCycles = static_cast<uint64_t>(_elapsed * _cyclesPerSecond * _speed);
+			// If the replay couldn't keep up, drop the lag rather than rush to catch up
+			const uint64_t _maxLag = static_cast<uint64_t>(_cyclesPerSecond * _speed * RECORDER_REPLAY_MAX_LAG_USEC / 1'000'000);
+			if (_targetCycles > anchorCycles + _maxLag)
 			{
-				if (high_resolution_clock::now() >= nextTime)
-					break;
+				reanchor();
+				_targetCycles = 0;
 			}
-			startTime = nextTime;
 		}
-		else {
-			currentReplayEvent = 0;
-			ApplyRAMSnapshot(0);
+
+		// Dispatch them, stopping early if the user wants something else
+		for (size_t i = 0; (i < _maxEvents) && (anchorCycles < _targetCycles); ++i)
+		{
+			if (*shouldStopReplay || *shouldPauseReplay || bUserMovedEventSlider)
+				break;
+			auto e = GetEvent(currentReplayEvent);
+			process_single_event(e);
+			anchorCycles += event_cycles(e);
+			currentReplayEvent += 1;
 		}
+		if (_speed > 0.f)
+			std::this_thread::sleep_for(_slice);
 	}
 	SetState(EventRecorderStates_e::STOPPED);
 	return 0;
@@ -429,27 +652,66 @@ int EventRecorder::replay_events_thread(bool* shouldPauseReplay, bool* shouldSto
 // Recording methods
 //////////////////////////////////////////////////////////////////////////
 
-void EventRecorder::StartRecording()
+bool EventRecorder::StartRecording()
 {
+	StopReplay();
 	ClearRecording();
-	v_events.reserve(1000000 * MAXRECORDING_SECONDS);
+	// The events go to disk as they come, so a recording can last as long as the disk allows
+	std::error_code _ec;
+	std::filesystem::create_directories(std::filesystem::path(RECORDER_STREAM_FILE).parent_path(), _ec);
+	VCRHeader _header;
+	_header.region = (bIsPAL ? VideoRegion_e::PAL : VideoRegion_e::NTSC);
+	_header.snapshotInterval = RECORDER_MEM_SNAPSHOT_CYCLES;
+	if (m_recordingFilter == RecordingFilter_e::STATE_CHANGES)
+		_header.flags |= VCR_FLAG_FILTERED;
+	if (!m_writer.Open(RECORDER_STREAM_FILE, _header))
+	{
+		m_lastErrorString = m_writer.GetLastError();
+		return false;
+	}
 	SetState(EventRecorderStates_e::RECORDING);
+	return true;
 }
 
 void EventRecorder::StopRecording()
 {
-	bHasRecording = true;
-	SaveRecording();
-	SetState(EventRecorderStates_e::STOPPED);
+	{
+		// Wait for the event being recorded, if any
+		std::lock_guard<std::mutex> _lock(recordMutex);
+		// Keep the time of the events filtered out at the end
+		if (m_pendingDelay > 0)
+			FlushRecordingDelay(false);
+		SetState(EventRecorderStates_e::STOPPED);
+	}
+	const bool _bWritten = m_writer.Close();
+	if (!_bWritten)
+		m_lastErrorString = m_writer.GetLastError();
+	// Replay it from the file
+	if (_bWritten && m_reader.Open(RECORDER_STREAM_FILE))
+	{
+		bHasRecording = true;
+		SaveRecording();
+	}
+	else if (_bWritten)
+		m_lastErrorString = m_reader.GetLastError();
 }
 
 void EventRecorder::ClearRecording()
 {
+	// Drop a text events file being loaded
+	if (thread_load.joinable())
+		thread_load.join();
+	v_loadedEvents = std::vector<SDHREvent>();
+	m_writer.Close();
+	m_replayChunk.reset();
+	m_reader.Close();
 	v_memSnapshots.clear();
 	v_events.clear();
 	v_events.shrink_to_fit();
 	bHasRecording = false;
 	currentReplayEvent = 0;
+	m_pendingDelay = 0;
+	m_nextSnapshotEvent = 0;
 	m_current_snapshot_cycles = RECORDER_MEM_SNAPSHOT_CYCLES;
 }
 
@@ -488,16 +750,48 @@ void EventRecorder::SetPAL(bool isPal) {
 	bIsPAL = isPal;
 }
 
+void EventRecorder::SetRecordingFilter(RecordingFilter_e filter)
+{
+	if (IsRecording())
+		return;
+	if (filter >= RecordingFilter_e::TOTAL_COUNT)
+		filter = RecordingFilter_e::ALL_EVENTS;
+	m_recordingFilter = filter;
+}
+
+void EventRecorder::FlushRecordingDelay(bool is_iigs)
+{
+	SDHREvent _delay = SDHREvent::MakeDelay(m_pendingDelay);
+	_delay.is_iigs = is_iigs;
+	m_writer.AddEvent(_delay);
+	++currentReplayEvent;
+	m_pendingDelay = 0;
+}
+
 void EventRecorder::RecordEvent(SDHREvent* sdhr_event)
 {
+	std::lock_guard<std::mutex> _lock(recordMutex);
 	if (m_state != EventRecorderStates_e::RECORDING)
 		return;
-	if ((currentReplayEvent % RECORDER_MEM_SNAPSHOT_CYCLES) == 0)
+	if (m_recordingFilter == RecordingFilter_e::STATE_CHANGES)
+	{
+		if (!IsStateChange(*sdhr_event))
+		{
+			if (++m_pendingDelay == SDHR_EVENT_MAX_DELAY)
+				FlushRecordingDelay(sdhr_event->is_iigs);
+			return;
+		}
+		if (m_pendingDelay > 0)
+			FlushRecordingDelay(sdhr_event->is_iigs);
+	}
+	// The machine state is that of before this event, so the snapshot can't go before a delay event
+	if (currentReplayEvent >= m_nextSnapshotEvent)
+	{
 		MakeRAMSnapshot(currentReplayEvent);
-	v_events.push_back(*sdhr_event);
+		m_nextSnapshotEvent = (currentReplayEvent / RECORDER_MEM_SNAPSHOT_CYCLES + 1) * RECORDER_MEM_SNAPSHOT_CYCLES;
+	}
+	m_writer.AddEvent(*sdhr_event);
 	++currentReplayEvent;
-	if (v_events.size() == (size_t)1'000'000 * MAXRECORDING_SECONDS)
-		StopRecording();
 }
 
 void EventRecorder::DisplayImGuiWindow(bool* p_open)
@@ -507,11 +801,27 @@ void EventRecorder::DisplayImGuiWindow(bool* p_open)
 		ImGui::Begin("Event Recorder", p_open);
 		ImGui::PushItemWidth(200);
 
+		if (thread_load.joinable() && !bIsLoadingText)
+			FinishTextEventsLoad();
+		if (bIsLoadingText)
+		{
+			ImGui::Text("Loading text events...");
+			ImGui::ProgressBar(m_textEventsReader.GetProgress());
+			ImGui::PopItemWidth();
+			ImGui::End();
+			return;
+		}
+
 		if (m_state == EventRecorderStates_e::RECORDING)
+		{
 			ImGui::Text("RECORDING IN PROGRESS...");
+			ImGui::Text("%llu events, %.1f MB written", (unsigned long long)m_writer.GetEventCount(),
+				m_writer.GetBytesWritten() / (1024.0 * 1024.0));
+		}
 		else {
 			if (bHasRecording)
-				ImGui::Text("Recording available");
+				ImGui::Text("Recording available: %llu events%s", (unsigned long long)GetEventCount(),
+					(m_reader.IsOpen() && (m_reader.GetHeader().flags & VCR_FLAG_FILTERED)) ? " (state changes only)" : "");
 			else
 				ImGui::Text("No recording loaded");
 		}
@@ -519,11 +829,29 @@ void EventRecorder::DisplayImGuiWindow(bool* p_open)
 		if (m_state == EventRecorderStates_e::RECORDING)
 		{
 			if (ImGui::Button("Stop Recording"))
+			{
 				this->StopRecording();
+				if (!bHasRecording)
+				{
+					bImGuiOpenModal = true;
+					ImGui::OpenPopup("Recorder Error Modal");
+				}
+			}
 		}
 		else {
 			if (ImGui::Button("Start Recording"))
-				this->StartRecording();
+			{
+				if (!this->StartRecording())
+				{
+					bImGuiOpenModal = true;
+					ImGui::OpenPopup("Recorder Error Modal");
+				}
+			}
+			ImGui::SameLine();
+			int _filter = (int)m_recordingFilter;
+			if (ImGui::Combo("##RecordingFilter", &_filter, g_recordingFilterNames, IM_ARRAYSIZE(g_recordingFilterNames)))
+				SetRecordingFilter((RecordingFilter_e)_filter);
+			ImGui::SetItemTooltip("State changes only: memory reads that change nothing are recorded as delays. Much smaller files and faster replays.");
 		}
 
 		static bool bIsInReplayMode = (this->IsInReplayMode());
@@ -539,17 +867,25 @@ void EventRecorder::DisplayImGuiWindow(bool* p_open)
 			ImGui::PushStyleVar(ImGuiStyleVar_Alpha, ImGui::GetStyle().Alpha * 0.5f); // Reduce button opacity
 			ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true); // Disable button (and make it unclickable)
 		}
-		bUserMovedEventSlider = ImGui::SliderInt("Event Timeline", reinterpret_cast<int*>(&currentReplayEvent), 0, (int)v_events.size());
+		uint64_t _sliderEvent = currentReplayEvent;
+		const uint64_t _sliderMin = 0;
+		const uint64_t _sliderMax = GetEventCount();
+		if (ImGui::SliderScalar("Event Timeline", ImGuiDataType_U64, &_sliderEvent, &_sliderMin, &_sliderMax))
+		{
+			currentReplayEvent = static_cast<size_t>(_sliderEvent);
+			bUserMovedEventSlider = true;
+		}
 		if (bIsInReplayMode)
 		{
-			if (ImGui::InputInt("X Slowdown", &slowdownMultiplier))
+			// The replay thread picks up the new speed at its next slice
+			int _speedIdx = 0;
+			for (int i = 0; i < IM_ARRAYSIZE(g_replaySpeeds); ++i)
 			{
-				if (slowdownMultiplier < 0)
-					slowdownMultiplier = 0;
-				// make sure targetDuration is updated
-				this->PauseReplay(true);
-				this->PauseReplay(false);
+				if (g_replaySpeeds[i] == replaySpeed)
+					_speedIdx = i;
 			}
+			if (ImGui::Combo("Replay Speed", &_speedIdx, g_replaySpeedNames, IM_ARRAYSIZE(g_replaySpeedNames)))
+				replaySpeed = g_replaySpeeds[_speedIdx];
 		}
 		if (thread_replay.joinable())
 		{
@@ -621,18 +957,28 @@ void EventRecorder::DisplayImGuiWindow(bool* p_open)
 			// Check if a file was selected
 			if (ImGuiFileDialog::Instance()->IsOk()) {
 				auto _fileExtension = ImGuiFileDialog::Instance()->GetCurrentFilter();
-				std::ifstream file(ImGuiFileDialog::Instance()->GetFilePathName().c_str(), std::ios::binary);
-				if (file.is_open()) {
+				std::ifstream file;
+				if (_fileExtension != ".vcr")	// recordings are streamed from their path
+					file.open(ImGuiFileDialog::Instance()->GetFilePathName().c_str(), std::ios::binary);
+				if ((_fileExtension == ".vcr") || file.is_open()) {
 					try
 					{
 						if (_fileExtension == ".vcr")
-							ReadRecordingFile(file);
-						else if (_fileExtension == ".shra")
-							ReadPaintWorksAnimationsFile(file);
-						else if (_fileExtension == "#C20000")
-							ReadPaintWorksAnimationsFile(file);
-						else if (_fileExtension == "#C20002")
-							ReadPaintWorksAnimationsFile(file);
+						{
+							if (!ReadRecordingFile(ImGuiFileDialog::Instance()->GetFilePathName()))
+							{
+								bImGuiOpenModal = true;
+								ImGui::OpenPopup("Recorder Error Modal");
+							}
+						}
+						else if ((_fileExtension == ".shra") || (_fileExtension == "#C20000") || (_fileExtension == "#C20002"))
+						{
+							if (!ReadPaintWorksAnimationsFile(file))
+							{
+								bImGuiOpenModal = true;
+								ImGui::OpenPopup("Recorder Error Modal");
+							}
+						}
 					}
 					catch (std::ifstream::failure& e)
 					{
@@ -655,20 +1001,9 @@ void EventRecorder::DisplayImGuiWindow(bool* p_open)
 		if (ImGuiFileDialog::Instance()->Display("ChooseTextEventsFileLoad")) {
 			// Check if a file was selected
 			if (ImGuiFileDialog::Instance()->IsOk()) {
-				std::ifstream file(ImGuiFileDialog::Instance()->GetFilePathName().c_str());
-				if (file.is_open()) {
-					try
-					{
-						ReadTextEventsFromFile(file);
-						
-					}
-					catch (std::ifstream::failure& e)
-					{
-						m_lastErrorString = e.what();
-						bImGuiOpenModal = true;
-						ImGui::OpenPopup("Recorder Error Modal");
-					}
-					file.close();
+				const std::string _path = ImGuiFileDialog::Instance()->GetFilePathName();
+				if (std::filesystem::exists(_path)) {
+					StartTextEventsLoad(_path);
 				}
 				else {
 					m_lastErrorString = "Error opening file";
@@ -683,22 +1018,8 @@ void EventRecorder::DisplayImGuiWindow(bool* p_open)
 		if (ImGuiFileDialog::Instance()->Display("ChooseRecordingSave")) {
 			// Check if a file was selected
 			if (ImGuiFileDialog::Instance()->IsOk()) {
-				std::ofstream file(ImGuiFileDialog::Instance()->GetFilePathName().c_str(), std::ios::binary);
-				if (file.is_open()) {
-					try
-					{
-						WriteRecordingFile(file);
-					}
-					catch (std::ofstream::failure& e)
-					{
-						m_lastErrorString = e.what();
-						bImGuiOpenModal = true;
-						ImGui::OpenPopup("Recorder Error Modal");
-					}
-					file.close();
-				}
-				else {
-					m_lastErrorString = "Error opening file";
+				if (!WriteRecordingFile(ImGuiFileDialog::Instance()->GetFilePathName()))
+				{
 					bImGuiOpenModal = true;
 					ImGui::OpenPopup("Recorder Error Modal");
 				}
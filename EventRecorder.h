@@ -4,9 +4,9 @@
 
 /*
 	Singleton event recorder class whose job is to:
-		- keep the last 30M events in a buffer
-		- store the state of RAM before the recording
-		- stop if the recording reaches max
+		- stream the events to RECORDER_STREAM_FILE while recording
+		- store the state of RAM at regular intervals during the recording
+		- optionally only record the events that change state, see RecordingFilter_e
 		- provide an ImGui interface to:
 			- turn on-off recording
 			- save and load recordings
@@ -16,12 +16,23 @@
 
 #include "common.h"
 #include "SDHRNetworking.h"	// for SDHREvent
+#include "VCRStream.h"
+#include "TextEventsReader.h"
 #include <vector>
 #include <string>
 #include <thread>
+#include <mutex>
+#include <atomic>
 
 #define RECORDER_TOTALMEMSIZE 128 * 1024		// 128k memory snapshot
-#define RECORDER_MEM_SNAPSHOT_CYCLES 1'000'000	// snapshot memory every x cycles
+#define RECORDER_MEM_SNAPSHOT_CYCLES 50'000		// snapshot memory every x cycles
+#define RECORDER_MEM_KEYFRAME_CYCLES 1'000'000	// a full snapshot every x cycles, the others are deltas of it
+#define RECORDER_STATE_OFFSET _A2_MEMORY_SHADOW_END		// machine state, in the unused end of the MAIN chunk
+#define RECORDER_STATE_MAGIC "SDDSTATE"
+#define RECORDER_REPLAY_SLICE_USEC 1'000		// replay dispatches the events of a slice, then sleeps until the next
+#define RECORDER_REPLAY_MAX_LAG_USEC 100'000	// further behind than this, replay skips the lag instead of rushing it
+#define RECORDER_REPLAY_MAX_BATCH 65'536		// events dispatched between checks at max speed
+#define RECORDER_STREAM_FILE "./recordings/last_recording.vcr"	// where recordings are streamed to
 
 enum class EventRecorderStates_e
 {
@@ -33,12 +44,29 @@ enum class EventRecorderStates_e
 	TOTAL_COUNT
 };
 
+// What gets recorded. Memory reads outside of the I/O space don't change anything, and are
+// most of the bus cycles. A filtered recording replaces each run of them with a delay event,
+// and the replay advances the clocks over it. The snapshot of an interval then is at the first
+// event that isn't a delay, which can be 1 event after the start of the interval.
+enum class RecordingFilter_e
+{
+	ALL_EVENTS = 0,
+	STATE_CHANGES,	// writes, and reads of soft switches, slot I/O and SDHR
+	TOTAL_COUNT
+};
+
 class EventRecorder
 {
 public:
 	void RecordEvent(SDHREvent* sdhr_event);
 	void DisplayImGuiWindow(bool* p_open);
 	void SetPAL(bool isPal);				// Sets PAL (true) or NTSC (false)
+	// The filter can only be changed when not recording
+	RecordingFilter_e GetRecordingFilter() { return m_recordingFilter; };
+	void SetRecordingFilter(RecordingFilter_e filter);
+	static bool IsStateChange(const SDHREvent& sdhr_event) {
+		return sdhr_event.is_delay || !sdhr_event.rw || ((sdhr_event.addr & 0xF000) == 0xC000);
+	};
 	inline const EventRecorderStates_e GetState() { return m_state; };
 	inline const bool IsRecording() { return (m_state == EventRecorderStates_e::RECORDING); };
 	inline const bool IsInReplayMode() { return (m_state >= EventRecorderStates_e::STOPPED); };
@@ -52,50 +80,91 @@ public:
 	}
 	~EventRecorder();
 
-	// This method reads a binary recording file previously saved using SaveRecording()
-	void ReadRecordingFile(std::ifstream& file);
-	// This method reads a text event file, generally used for debugging
-	void ReadTextEventsFromFile(std::ifstream& file);
-	// This method reads a PaintWorks Animations file, also for debugging
-	void ReadPaintWorksAnimationsFile(std::ifstream& file);
+	// This method opens a binary recording file previously saved using SaveRecording().
+	// A .vcr is streamed from disk during the replay, a legacy one is loaded in memory.
+	// On error it returns false and GetLastError() has the reason.
+	bool ReadRecordingFile(const std::string& path);
+	// This method reads a text event file, generally used for debugging.
+	// On error it returns false and GetLastError() has the line and the reason.
+	bool ReadTextEventsFromFile(std::ifstream& file);
+	// This method reads a PaintWorks Animations file, also for debugging.
+	// On error it returns false and GetLastError() has the reason.
+	bool ReadPaintWorksAnimationsFile(std::ifstream& file);
 	void StopReplay();
 	void StartReplay();
+	// The loaded events, one per cycle. Used to process a recording outside of the replay thread.
+	// GetEvent() is fastest in order, and must not be called by 2 threads at once.
+	uint64_t GetEventCount();
+	SDHREvent GetEvent(size_t index);
+	// Restores the machine state of the start of the recording, before processing it that way
+	void ApplyReplayStart() { ApplyRAMSnapshot(0); };
+	const std::string& GetLastError() { return m_lastErrorString; };
+	// Fills a RECORDER_TOTALMEMSIZE snapshot with the memory and the machine state before
+	// the event at cycle, and changes that event index in an existing snapshot
+	static void FillSnapshot(uint8_t* data, size_t cycle);
+	static void SetSnapshotCycle(uint8_t* data, size_t cycle);
 
 private:
 	void Initialize();
 
 	// recording
-	void StartRecording();
+	bool StartRecording();
 	void StopRecording();
 	void ClearRecording();
 	void SaveRecording();
 	void LoadRecording();
 	void LoadTextEventsFromFile();
+	// Loads a text event file on thread_load, the window shows the progress
+	void StartTextEventsLoad(const std::string& path);
+	void FinishTextEventsLoad();
 	
 	// replay
 	void PauseReplay(bool pause);
 	void RewindReplay();
 
 	// de/serialization
+	// A snapshot holds the memory and the machine state (soft switches, beam, mockingboard)
+	// before the event at cycle. Applying it returns that event index.
 	void MakeRAMSnapshot(size_t cycle);
-	void ApplyRAMSnapshot(size_t snapshot_index);
-	void WriteRecordingFile(std::ofstream& file);
-	void WriteEvent(const SDHREvent& event, std::ofstream& file);
-	void ReadEvent(std::ifstream& file);
+	size_t ApplyRAMSnapshot(size_t snapshot_index);
+	size_t GetSnapshotCount();
+	void FlushRecordingDelay(bool is_iigs);
+	bool WriteRecordingFile(const std::string& path);
+	bool ReadLegacyRecordingFile(std::ifstream& file);
+	void ReadLegacyEvents(std::ifstream& file, size_t count);
 
 	bool bIsPAL = false;						// Is the machine PAL?
 	bool bHasRecording = false;
 	EventRecorderStates_e m_state = EventRecorderStates_e::DISABLED;
 	void SetState(EventRecorderStates_e _state);
 
+	// Recordings loaded in memory: legacy files, text events and PaintWorks animations
 	std::vector<ByteBuffer> v_memSnapshots;	// memory snapshots at regular intervals
 	std::vector<SDHREvent> v_events;
 
+	// Recordings streamed to and from disk
+	VCRWriter m_writer;
+	VCRReader m_reader;
+	std::mutex recordMutex;					// between RecordEvent() and StopRecording()
+	RecordingFilter_e m_recordingFilter = RecordingFilter_e::ALL_EVENTS;
+	uint32_t m_pendingDelay = 0;			// cycles of the events filtered out since the last recorded one
+	size_t m_nextSnapshotEvent = 0;
+	std::shared_ptr<const std::vector<SDHREvent>> m_replayChunk;	// the chunk GetEvent() reads from
+	size_t m_replayChunkIndex = 0;
+	ByteBuffer m_streamedSnapshot = ByteBuffer(RECORDER_TOTALMEMSIZE);
+
+	// Text events files
+	TextEventsReader m_textEventsReader;
+	std::thread thread_load;
+	std::atomic<bool> bIsLoadingText { false };
+	bool bTextLoadSucceeded = false;
+	std::vector<SDHREvent> v_loadedEvents;	// owned by thread_load while it runs
+
 
 	// Replay thread control
 	std::thread thread_replay;
 	int replay_events_thread(bool* shouldPauseReplay, bool* shouldStopReplay);
-	int slowdownMultiplier = 1;		// How much to slow the replay down by
+	std::atomic<float> replaySpeed { 1.f };	// Replay speed factor, 0 is as fast as possible
 	bool bShouldPauseReplay = false;
 	bool bShouldStopReplay = false;
 	size_t currentReplayEvent;		// index of the event ready to replay in the vector
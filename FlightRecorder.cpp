@@ -0,0 +1,315 @@
+#include "FlightRecorder.h"
+#include "EventRecorder.h"
+#include "CycleCounter.h"
+#include "VCRStream.h"
+#include "imgui.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+
+// below because "The declaration of a static data member in its class definition is not a definition"
+FlightRecorder* FlightRecorder::s_instance;
+
+FlightRecorder::~FlightRecorder()
+{
+	std::lock_guard<std::mutex> _lock(dumpThreadMutex);
+	if (thread_dump.joinable())
+		thread_dump.join();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Recording
+//////////////////////////////////////////////////////////////////////////
+
+void FlightRecorder::RecordEvent(const SDHREvent& sdhr_event)
+{
+	// Anything but plain recording takes the slow path
+	const uint32_t _state = m_state.load(std::memory_order_acquire);
+	if (_state != FR_STATE_ENABLED)
+	{
+		if (_state & FR_STATE_FROZEN)
+		{
+			bShouldRestart = true;
+			return;
+		}
+		if (_state & FR_STATE_NEW_RINGS)
+			TakeNewRings();
+		if (!(_state & FR_STATE_ENABLED))
+			return;
+	}
+	if (v_events.empty())
+		return;
+	uint64_t _count = m_eventCount.load(std::memory_order_relaxed);
+	if (bShouldRestart)
+	{
+		// Events were dropped, start over at the next snapshot
+		_count = (_count + FR_SNAPSHOT_CYCLES - 1) / FR_SNAPSHOT_CYCLES * FR_SNAPSHOT_CYCLES;
+		m_firstEvent.store(_count, std::memory_order_relaxed);
+		bShouldRestart = false;
+	}
+	if ((_count % FR_SNAPSHOT_CYCLES) == 0)
+	{
+		const uint64_t _snapshotIdx = _count / FR_SNAPSHOT_CYCLES;
+		EventRecorder::FillSnapshot(v_snapshots[_snapshotIdx % v_snapshots.size()].data(), _count);
+		m_snapshotCount.store(_snapshotIdx + 1, std::memory_order_release);
+	}
+	v_events[_count % v_events.size()] = sdhr_event;
+	m_eventCount.store(_count + 1, std::memory_order_release);
+}
+
+void FlightRecorder::TakeNewRings()
+{
+	// Allocate() only holds the lock to swap the rings
+	std::lock_guard<std::mutex> _lock(newRingsMutex);
+	v_events.swap(v_newEvents);
+	v_snapshots.swap(v_newSnapshots);
+	m_eventCount.store(0, std::memory_order_relaxed);
+	m_snapshotCount.store(0, std::memory_order_relaxed);
+	m_firstEvent.store(0, std::memory_order_relaxed);
+	bShouldRestart = false;
+	// The old rings are left in v_newEvents/v_newSnapshots, for Allocate() to free
+	m_state.fetch_and(~FR_STATE_NEW_RINGS, std::memory_order_release);
+}
+
+void FlightRecorder::Allocate(bool bEnabled)
+{
+	std::vector<SDHREvent> _events;
+	std::vector<ByteBuffer> _snapshots;
+	if (bEnabled)
+	{
+		// A snapshot is kept for every FR_SNAPSHOT_CYCLES events in the ring, plus the one
+		// being filled and the one whose events are partly overwritten
+		const size_t _capacity = static_cast<size_t>(m_seconds) * GetCPUFrequency();
+		_events.assign(_capacity, SDHREvent(false, false, false, true, 0, 0));
+		const size_t _slots = _capacity / FR_SNAPSHOT_CYCLES + 2;
+		_snapshots.reserve(_slots);
+		for (size_t i = 0; i < _slots; ++i)
+		{
+			_snapshots.emplace_back(RECORDER_TOTALMEMSIZE);
+			memset(_snapshots.back().data(), 0, RECORDER_TOTALMEMSIZE);
+		}
+	}
+	{
+		// Replaces any new rings the bus thread hasn't taken yet
+		std::lock_guard<std::mutex> _lock(newRingsMutex);
+		v_newEvents.swap(_events);
+		v_newSnapshots.swap(_snapshots);
+		m_state.fetch_or(FR_STATE_NEW_RINGS, std::memory_order_release);
+	}
+	// The bus thread takes them at its next event, unless it's idle or a dump is running.
+	// Then the old rings are freed here, or at the next Allocate().
+	for (int i = 0; (i < FR_NEW_RINGS_WAIT_MS) && (m_state & FR_STATE_NEW_RINGS); ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	std::vector<SDHREvent> _oldEvents;
+	std::vector<ByteBuffer> _oldSnapshots;
+	{
+		std::lock_guard<std::mutex> _lock(newRingsMutex);
+		if (!(m_state & FR_STATE_NEW_RINGS))
+		{
+			v_newEvents.swap(_oldEvents);
+			v_newSnapshots.swap(_oldSnapshots);
+		}
+	}
+}
+
+void FlightRecorder::SetEnabled(bool bEnabled)
+{
+	if (bEnabled == IsEnabled())
+		return;
+	if (bEnabled)
+	{
+		Allocate(true);
+		m_state.fetch_or(FR_STATE_ENABLED, std::memory_order_release);
+	}
+	else
+	{
+		m_state.fetch_and(~FR_STATE_ENABLED, std::memory_order_release);
+		Allocate(false);
+	}
+}
+
+void FlightRecorder::SetPAL(bool isPal)
+{
+	if (isPal == bIsPAL)
+		return;
+	bIsPAL = isPal;
+	if (IsEnabled())
+		Allocate(true);
+}
+
+uint32_t FlightRecorder::GetCPUFrequency()
+{
+	return bIsPAL ? _A2_CPU_FREQUENCY_PAL : _A2_CPU_FREQUENCY_NTSC;
+}
+
+void FlightRecorder::SetSeconds(uint32_t seconds)
+{
+	seconds = std::clamp(seconds, FR_MIN_SECONDS, FR_MAX_SECONDS);
+	if (seconds == m_seconds)
+		return;
+	m_seconds = seconds;
+	if (IsEnabled())
+		Allocate(true);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Dumping
+//////////////////////////////////////////////////////////////////////////
+
+bool FlightRecorder::Dump(const std::string& reason)
+{
+	// Only when plainly recording: not disabled, not already dumping, no new rings waiting.
+	// From now on RecordEvent() leaves the ring alone.
+	uint32_t _expected = FR_STATE_ENABLED;
+	if (!m_state.compare_exchange_strong(_expected, FR_STATE_ENABLED | FR_STATE_FROZEN, std::memory_order_acq_rel))
+		return false;
+	const uint64_t _eventCount = m_eventCount.load(std::memory_order_acquire);
+	const uint64_t _snapshotCount = m_snapshotCount.load(std::memory_order_acquire);
+	const uint64_t _firstEvent = m_firstEvent.load(std::memory_order_relaxed);
+	if (_eventCount == 0)
+	{
+		m_state.fetch_and(~FR_STATE_FROZEN, std::memory_order_release);
+		return false;
+	}
+	std::cout << "Flight recorder: dumping up to " << std::min<uint64_t>(_eventCount - _firstEvent, v_events.size())
+		<< " events (" << reason << ")" << std::endl;
+	std::lock_guard<std::mutex> _lock(dumpThreadMutex);
+	// The previous dump thread is done, it unfreezes the ring last
+	if (thread_dump.joinable())
+		thread_dump.join();
+	thread_dump = std::thread(&FlightRecorder::dump_thread, this, _eventCount, _snapshotCount, _firstEvent);
+	return true;
+}
+
+void FlightRecorder::dump_thread(uint64_t eventCount, uint64_t snapshotCount, uint64_t firstEvent)
+{
+	const uint64_t _capacity = v_events.size();
+	const uint64_t _slots = v_snapshots.size();
+	// Start at the first snapshot whose events are all still in the ring. The bus thread
+	// may have been writing one more event and snapshot when the ring froze, so the
+	// slots they go to are skipped too. If it was starting over, that event is up to
+	// FR_SNAPSHOT_CYCLES further.
+	const uint64_t _inFlight = eventCount + FR_SNAPSHOT_CYCLES;
+	uint64_t _oldestEvent = (_inFlight > _capacity ? _inFlight - _capacity : 0);
+	_oldestEvent = std::max(_oldestEvent, firstEvent);
+	uint64_t _firstSnapshot = (_oldestEvent + FR_SNAPSHOT_CYCLES - 1) / FR_SNAPSHOT_CYCLES;
+	if (snapshotCount + 1 > _slots)
+		_firstSnapshot = std::max(_firstSnapshot, snapshotCount + 1 - _slots);
+	const uint64_t _firstEvent = _firstSnapshot * FR_SNAPSHOT_CYCLES;
+
+	auto now_c = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+	std::tm tm_local = {};
+#ifdef _WIN32
+	localtime_s(&tm_local, &now_c);
+#else
+	localtime_r(&now_c, &tm_local);
+#endif
+	std::stringstream ss;
+	ss << "./recordings/flight_" << std::put_time(&tm_local, "%Y%m%d_%H%M%S") << ".vcr";
+	const std::string _path = ss.str();
+
+	std::string _status;
+	if ((_firstSnapshot >= snapshotCount) || (_firstEvent >= eventCount))
+		_status = "Nothing to dump";
+	else
+	{
+		std::error_code _ec;
+		std::filesystem::create_directories(std::filesystem::path(_path).parent_path(), _ec);
+		VCRHeader _header;
+		_header.region = CycleCounter::GetInstance()->GetVideoRegion();
+		if (v_events[_firstEvent % _capacity].is_iigs)
+			_header.machine = VCRMachine_e::Apple2gs;
+		_header.snapshotInterval = FR_SNAPSHOT_CYCLES;
+		VCRWriter _writer;
+		if (!_writer.Open(_path, _header))
+			_status = _writer.GetLastError();
+		else
+		{
+			// The snapshots hold the event index they were taken at, which starts over in the dump
+			ByteBuffer _snapshot(RECORDER_TOTALMEMSIZE);
+			for (uint64_t i = _firstEvent; i < eventCount; ++i)
+			{
+				if ((i % FR_SNAPSHOT_CYCLES) == 0)
+				{
+					const uint64_t _snapshotIdx = i / FR_SNAPSHOT_CYCLES;
+					memcpy(_snapshot.data(), v_snapshots[_snapshotIdx % _slots].data(), RECORDER_TOTALMEMSIZE);
+					EventRecorder::SetSnapshotCycle(_snapshot.data(), i - _firstEvent);
+					_writer.AddSnapshot(_snapshot.data(), _snapshot.size(),
+						((_snapshotIdx - _firstSnapshot) % FR_KEYFRAME_SNAPSHOTS) == 0);
+				}
+				_writer.AddEvent(v_events[i % _capacity]);
+			}
+			if (_writer.Close())
+				_status = "Dumped " + std::to_string(eventCount - _firstEvent) + " events to " + _path;
+			else
+				_status = _writer.GetLastError();
+		}
+	}
+	std::cout << "Flight recorder: " << _status << std::endl;
+	{
+		std::lock_guard<std::mutex> _lock(statusMutex);
+		m_lastDump = _status;
+	}
+	m_state.fetch_and(~FR_STATE_FROZEN, std::memory_order_release);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// ImGUI and prefs
+//////////////////////////////////////////////////////////////////////////
+
+void FlightRecorder::DisplayImGuiChunk()
+{
+	if (ImGui::BeginMenu("Flight Recorder")) {
+		bool _bEnabled = IsEnabled();
+		if (ImGui::Checkbox("Enabled", &_bEnabled))
+			SetEnabled(_bEnabled);
+		ImGui::SetItemTooltip("Always keep the last seconds of events, to save them when something goes wrong");
+		// Reallocating the ring is expensive, only do it when the slider is released
+		ImGui::PushItemWidth(150);
+		ImGui::SliderInt("Seconds", &iImGuiSeconds, FR_MIN_SECONDS, FR_MAX_SECONDS, "%d", ImGuiSliderFlags_AlwaysClamp);
+		if (ImGui::IsItemDeactivatedAfterEdit())
+			SetSeconds(static_cast<uint32_t>(iImGuiSeconds));
+		if (!ImGui::IsItemActive())
+			iImGuiSeconds = static_cast<int>(m_seconds);
+		ImGui::PopItemWidth();
+		ImGui::SetItemTooltip("%.1f MB of events per second", GetCPUFrequency() * sizeof(SDHREvent) / (1024.0 * 1024.0));
+		ImGui::Checkbox("Dump on bus overflow or SDHR error", &bDumpOnError);
+		ImGui::Separator();
+		const bool _bDumping = IsDumping();
+		const bool _bDisabled = !_bEnabled || _bDumping;
+		if (_bDisabled)
+			ImGui::BeginDisabled();
+		if (ImGui::MenuItem(_bDumping ? "Dumping..." : "Dump Now", "F11"))
+			Dump("user request");
+		if (_bDisabled)
+			ImGui::EndDisabled();
+		{
+			std::lock_guard<std::mutex> _lock(statusMutex);
+			if (!m_lastDump.empty())
+				ImGui::TextUnformatted(m_lastDump.c_str());
+		}
+		ImGui::EndMenu();
+	}
+}
+
+nlohmann::json FlightRecorder::SerializeState()
+{
+	nlohmann::json jsonState = {
+		{"enabled", IsEnabled()},
+		{"seconds", m_seconds},
+		{"dump_on_error", bDumpOnError}
+	};
+	return jsonState;
+}
+
+void FlightRecorder::DeserializeState(const nlohmann::json &jsonState)
+{
+	SetSeconds(jsonState.value("seconds", m_seconds));
+	bDumpOnError = jsonState.value("dump_on_error", bDumpOnError);
+	SetEnabled(jsonState.value("enabled", IsEnabled()));
+}
@@ -0,0 +1,113 @@
+#pragma once
+#ifndef FLIGHTRECORDER_H
+#define FLIGHTRECORDER_H
+
+/*
+	The flight recorder always keeps the last few seconds of bus events, so that when
+	something goes wrong the events that led to it can be saved and replayed.
+
+	It's a ring of events preallocated for FlightRecorder's seconds, plus a ring of memory
+	snapshots taken every FR_SNAPSHOT_CYCLES. Recording an event is a copy into the ring,
+	and every FR_SNAPSHOT_CYCLES a 128k snapshot, so it can be left on all the time.
+
+	The bus thread owns the rings and the counts, and takes no lock. It reads m_state once
+	per event. Other threads only change m_state: Dump() freezes the ring, and new rings
+	from Allocate() wait in v_newEvents/v_newSnapshots until the bus thread swaps them in.
+
+	Dump() saves the ring to a .vcr in ./recordings/ on a thread of its own, starting at
+	the oldest snapshot that still has all its events. It's called with the F11 hotkey,
+	and automatically when the bus overflows or SDHR commands fail if bDumpOnError is set.
+	While it's dumping, the ring is frozen and the new events are dropped. The ring starts
+	over at the next snapshot when the dump is done.
+*/
+
+#include "common.h"
+#include "SDHRNetworking.h"	// for SDHREvent
+#include "ByteBuffer.h"
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+constexpr uint32_t FR_SNAPSHOT_CYCLES = 250'000;	// snapshot the machine every x events
+constexpr uint32_t FR_KEYFRAME_SNAPSHOTS = 4;		// in the dump, 1 snapshot in x is a keyframe
+constexpr uint32_t FR_MIN_SECONDS = 1;
+constexpr uint32_t FR_MAX_SECONDS = 60;
+constexpr int FR_NEW_RINGS_WAIT_MS = 250;			// how long Allocate() waits for the bus thread to take the new rings
+
+// m_state flags
+constexpr uint32_t FR_STATE_ENABLED = 1;
+constexpr uint32_t FR_STATE_FROZEN = 2;				// a dump is reading the rings
+constexpr uint32_t FR_STATE_NEW_RINGS = 4;			// v_newEvents and v_newSnapshots are waiting for the bus thread
+
+class FlightRecorder
+{
+public:
+	// Called by the bus thread for every event
+	void RecordEvent(const SDHREvent& sdhr_event);
+
+	// Allocates the rings, or frees them
+	void SetEnabled(bool bEnabled);
+	bool IsEnabled() { return (m_state & FR_STATE_ENABLED) != 0; };
+	// The ring is allocated again, which starts it over
+	void SetSeconds(uint32_t seconds);
+	uint32_t GetSeconds() { return m_seconds; };
+	void SetPAL(bool isPal);				// Sets PAL (true) or NTSC (false), which sizes the ring
+	bool bDumpOnError = true;
+
+	// Starts writing the ring to a file. Returns false if there's nothing to write or
+	// a dump is already running. reason goes to the console.
+	bool Dump(const std::string& reason);
+	bool IsDumping() { return (m_state & FR_STATE_FROZEN) != 0; };
+
+	// ImGUI and prefs
+	void DisplayImGuiChunk();
+	nlohmann::json SerializeState();
+	void DeserializeState(const nlohmann::json &jsonState);
+
+	// public singleton code
+	static FlightRecorder* GetInstance()
+	{
+		if (NULL == s_instance)
+			s_instance = new FlightRecorder();
+		return s_instance;
+	}
+	~FlightRecorder();
+
+private:
+	static FlightRecorder* s_instance;
+	FlightRecorder() {};
+
+	// Builds the rings for the bus thread to take, and frees the old ones
+	void Allocate(bool bEnabled);
+	void TakeNewRings();						// bus thread
+	uint32_t GetCPUFrequency();
+	void dump_thread(uint64_t eventCount, uint64_t snapshotCount, uint64_t firstEvent);
+
+	std::atomic<uint32_t> m_state { 0 };		// FR_STATE_*
+	bool bIsPAL = false;
+	uint32_t m_seconds = 10;
+	int iImGuiSeconds = 10;						// the slider value while it's dragged
+
+	// Owned by the bus thread. Read by the dump thread while frozen.
+	std::vector<SDHREvent> v_events;			// event i is at i % size
+	std::vector<ByteBuffer> v_snapshots;		// snapshot i is before event i * FR_SNAPSHOT_CYCLES, at i % size
+	std::atomic<uint64_t> m_eventCount { 0 };	// since the ring started, only written by the bus thread
+	std::atomic<uint64_t> m_snapshotCount { 0 };	// last snapshot + 1
+	std::atomic<uint64_t> m_firstEvent { 0 };	// the ring started over here after a dump
+	bool bShouldRestart = false;				// events were dropped during a dump
+
+	// Swapped with the rings by the bus thread, only when FR_STATE_NEW_RINGS is set
+	std::mutex newRingsMutex;
+	std::vector<SDHREvent> v_newEvents;
+	std::vector<ByteBuffer> v_newSnapshots;
+
+	std::mutex dumpThreadMutex;					// for thread_dump
+	std::thread thread_dump;
+	std::mutex statusMutex;
+	std::string m_lastDump;						// the result of the last dump, for the UI
+};
+
+#endif // FLIGHTRECORDER_H
@@ -0,0 +1,419 @@
+#include "FrameCapture.h"
+
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <ctime>
+#include "imgui.h"
+#include "CycleCounter.h"
+#include "LogTextManager.h"
+#include "stb_image_write.h"	// implementation is in OpenGLHelper.cpp
+
+// below because "The declaration of a static data member in its class definition is not a definition"
+FrameCapture* FrameCapture::s_instance;
+
+static const char* g_captureFormatNames[] = { "Raw RGBA", "Y4M (YCbCr 4:4:4)", "PNG Sequence" };
+
+FrameCapture::~FrameCapture()
+{
+	StopCapture();
+	DeletePBOs();
+}
+
+void FrameCapture::SetFormat(FrameCaptureFormat_e format)
+{
+	if (bIsCapturing)
+		return;
+	if (format >= FrameCaptureFormat_e::TOTAL_COUNT)
+		format = FrameCaptureFormat_e::Y4M;
+	eFormat = format;
+}
+
+bool FrameCapture::StartCapture()
+{
+	if (bIsCapturing)
+		return true;
+
+	std::filesystem::path capturesDir = std::filesystem::current_path() / "captures";
+	std::error_code ec;
+	std::filesystem::create_directories(capturesDir, ec);
+	if (ec) {
+		LogStreamErr() << "Failed to create directory: " << capturesDir.string();
+		return false;
+	}
+
+	auto now_c = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+	std::tm tm_local = {};
+#ifdef _WIN32
+	localtime_s(&tm_local, &now_c);
+#else
+	localtime_r(&now_c, &tm_local);
+#endif
+	std::stringstream ss;
+	ss << "Apple2_Capture_" << std::put_time(&tm_local, "%Y%m%d_%H%M%S");
+	capturePath = (capturesDir / ss.str()).string();
+
+	if (eFormat == FrameCaptureFormat_e::PNG_SEQUENCE)
+	{
+		std::filesystem::create_directories(capturePath, ec);
+		if (ec) {
+			LogStreamErr() << "Failed to create directory: " << capturePath;
+			return false;
+		}
+	}
+
+	// Y4M needs the frame rate in its header. Use the Apple 2 refresh rate.
+	if (CycleCounter::GetInstance()->GetVideoRegion() == VideoRegion_e::PAL) {
+		y4mFpsNum = 50;
+		y4mFpsDen = 1;
+	} else {
+		y4mFpsNum = 60000;
+		y4mFpsDen = 1001;
+	}
+
+	streamWidth = 0;
+	streamHeight = 0;
+	streamSegment = 0;
+	pboHead = 0;
+	pboTail = 0;
+	framesRequested = 0;
+	framesWritten = 0;
+	bytesWritten = 0;
+	writeErrors = 0;
+	stallCount = 0;
+	bWriterShouldStop = false;
+	frameQueue.clear();
+	writerThread = std::thread(&FrameCapture::WriterThread, this);
+
+	bIsCapturing = true;
+	LogStream() << "FRAME CAPTURE STARTED - " << capturePath;
+	return true;
+}
+
+void FrameCapture::StopCapture()
+{
+	if (!bIsCapturing)
+		return;
+	bIsCapturing = false;
+
+	// Get back whatever the GPU still owes us, then let the writer drain its queue
+	HarvestCompletedSlots(true);
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		bWriterShouldStop = true;
+	}
+	queueCV.notify_all();
+	if (writerThread.joinable())
+		writerThread.join();
+	if (streamFile.is_open())
+		streamFile.close();
+
+	LogStream() << "FRAME CAPTURE STOPPED - " << framesWritten << " frames, " << stallCount << " stalls";
+	if (writeErrors > 0)
+		LogStreamErr() << "Frame capture had " << writeErrors << " write errors";
+}
+
+void FrameCapture::DeletePBOs()
+{
+	for (auto& slot : pboRing)
+	{
+		if (slot.fence != nullptr)
+			glDeleteSync(slot.fence);
+		if (slot.pbo != UINT_MAX)
+			glDeleteBuffers(1, &slot.pbo);
+		slot = PBOSlot();
+	}
+}
+
+void FrameCapture::CaptureFramebuffer(GLuint fbo, int width, int height, bool isNewA2Frame)
+{
+	if (!bIsCapturing)
+		return;
+	if (bOnlyNewA2Frames && !isNewA2Frame)
+	{
+		HarvestCompletedSlots(false);
+		return;
+	}
+	if (width <= 0 || height <= 0)
+		return;
+
+	// The ring is full, we must wait for the oldest readback to finish
+	PBOSlot& slot = pboRing[pboHead];
+	if (slot.bIsPending)
+	{
+		++stallCount;
+		HarvestSlot(slot);
+		pboTail = (pboTail + 1) % FC_PBO_RING_SIZE;
+	}
+
+	size_t _size = static_cast<size_t>(width) * static_cast<size_t>(height) * 4;
+	if (slot.pbo == UINT_MAX)
+		glGenBuffers(1, &slot.pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	if (slot.bufferSize != _size)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, _size, nullptr, GL_STREAM_READ);
+		slot.bufferSize = _size;
+	}
+
+	GLint _oldFBO = 0;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &_oldFBO);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glReadBuffer(fbo == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
+	GLint oldPack = 0;
+	glGetIntegerv(GL_PACK_ALIGNMENT, &oldPack);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);	// into the PBO
+	glPixelStorei(GL_PACK_ALIGNMENT, oldPack);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, _oldFBO);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.width = width;
+	slot.height = height;
+	slot.index = framesRequested++;
+	slot.bIsPending = true;
+	pboHead = (pboHead + 1) % FC_PBO_RING_SIZE;
+
+	GLenum glerr;
+	if ((glerr = glGetError()) != GL_NO_ERROR) {
+		std::cerr << "FrameCapture readback error: " << glerr << std::endl;
+	}
+
+	HarvestCompletedSlots(false);
+}
+
+// Harvest pending slots in order. If bWait is false, stop at the first one the GPU hasn't finished.
+void FrameCapture::HarvestCompletedSlots(bool bWait)
+{
+	for (uint32_t i = 0; i < FC_PBO_RING_SIZE; ++i)
+	{
+		PBOSlot& slot = pboRing[pboTail];
+		if (!slot.bIsPending)
+			break;
+		if (!bWait)
+		{
+			GLenum _res = glClientWaitSync(slot.fence, 0, 0);
+			if ((_res != GL_ALREADY_SIGNALED) && (_res != GL_CONDITION_SATISFIED))
+				break;
+		}
+		HarvestSlot(slot);
+		pboTail = (pboTail + 1) % FC_PBO_RING_SIZE;
+	}
+}
+
+void FrameCapture::HarvestSlot(PBOSlot& slot)
+{
+	// Returns immediately if the GPU is already done. The flush guarantees the fence will signal.
+	GLenum _res = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000'000);
+	if (_res == GL_WAIT_FAILED || _res == GL_TIMEOUT_EXPIRED)
+		std::cerr << "FrameCapture fence wait failed: " << _res << std::endl;
+	glDeleteSync(slot.fence);
+	slot.fence = nullptr;
+	slot.bIsPending = false;
+
+	CaptureFrame frame;
+	frame.width = slot.width;
+	frame.height = slot.height;
+	frame.index = slot.index;
+	frame.pixels.resize(slot.bufferSize);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	void* _mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.bufferSize, GL_MAP_READ_BIT);
+	if (_mapped != nullptr)
+	{
+		memcpy(frame.pixels.data(), _mapped, slot.bufferSize);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	else {
+		std::cerr << "FrameCapture could not map readback buffer for frame " << slot.index << std::endl;
+		++writeErrors;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (_mapped == nullptr)
+		return;
+
+	std::unique_lock<std::mutex> lock(queueMutex);
+	if (frameQueue.size() >= FC_MAX_QUEUED_FRAMES)
+	{
+		// The disk can't keep up. Wait rather than drop the frame.
+		++stallCount;
+		queueCV.wait(lock, [this] { return frameQueue.size() < FC_MAX_QUEUED_FRAMES; });
+	}
+	frameQueue.push_back(std::move(frame));
+	lock.unlock();
+	queueCV.notify_all();
+}
+
+void FrameCapture::WriterThread()
+{
+	while (true)
+	{
+		CaptureFrame frame;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueCV.wait(lock, [this] { return bWriterShouldStop || !frameQueue.empty(); });
+			if (frameQueue.empty())
+				return;		// bWriterShouldStop and nothing left to write
+			frame = std::move(frameQueue.front());
+			frameQueue.pop_front();
+		}
+		queueCV.notify_all();	// there's room in the queue now
+		if (WriteFrame(frame))
+			++framesWritten;
+		else
+			++writeErrors;
+	}
+}
+
+bool FrameCapture::OpenStreamSegment(int width, int height)
+{
+	if (streamFile.is_open())
+		streamFile.close();
+
+	// Streams can't change size midway. Each size change starts a new segment file.
+	std::stringstream ss;
+	ss << capturePath;
+	if (streamSegment > 0)
+		ss << "_part" << streamSegment;
+	if (eFormat == FrameCaptureFormat_e::RAW_RGBA)
+		ss << "_" << width << "x" << height << ".rgba";
+	else
+		ss << ".y4m";
+	++streamSegment;
+
+	streamFile.open(ss.str(), std::ios::binary | std::ios::trunc);
+	if (!streamFile.is_open())
+	{
+		std::cerr << "FrameCapture could not open " << ss.str() << std::endl;
+		return false;
+	}
+	streamWidth = width;
+	streamHeight = height;
+
+	if (eFormat == FrameCaptureFormat_e::Y4M)
+	{
+		std::stringstream header;
+		header << "YUV4MPEG2 W" << width << " H" << height
+			<< " F" << y4mFpsNum << ":" << y4mFpsDen
+			<< " Ip A1:1 C444 XCOLORRANGE=FULL\n";
+		streamFile << header.str();
+	}
+	return true;
+}
+
+bool FrameCapture::WriteFrame(CaptureFrame& frame)
+{
+	const int w = frame.width;
+	const int h = frame.height;
+	const size_t _stride = static_cast<size_t>(w) * 4;
+
+	if (eFormat == FrameCaptureFormat_e::PNG_SEQUENCE)
+	{
+		std::stringstream ss;
+		ss << capturePath << "/frame_" << std::setw(6) << std::setfill('0') << frame.index << ".png";
+		// Negative stride starting from the last row flips the image to top-down
+		auto _lastRow = frame.pixels.data() + (h - 1) * _stride;
+		if (!stbi_write_png(ss.str().c_str(), w, h, 4, _lastRow, -static_cast<int>(_stride)))
+			return false;
+		bytesWritten += frame.pixels.size();
+		return true;
+	}
+
+	if ((!streamFile.is_open()) || (w != streamWidth) || (h != streamHeight))
+	{
+		if (!OpenStreamSegment(w, h))
+			return false;
+	}
+
+	if (eFormat == FrameCaptureFormat_e::RAW_RGBA)
+	{
+		for (int y = h - 1; y >= 0; --y)
+			streamFile.write(reinterpret_cast<const char*>(frame.pixels.data() + y * _stride), _stride);
+		bytesWritten += frame.pixels.size();
+	}
+	else {
+		// Y4M: planar Y, Cb, Cr at full resolution, BT.601 full range
+		const size_t _planeSize = static_cast<size_t>(w) * static_cast<size_t>(h);
+		conversionBuffer.resize(_planeSize * 3);
+		uint8_t* _y = conversionBuffer.data();
+		uint8_t* _cb = _y + _planeSize;
+		uint8_t* _cr = _cb + _planeSize;
+		size_t _o = 0;
+		for (int row = h - 1; row >= 0; --row)
+		{
+			const uint8_t* px = frame.pixels.data() + row * _stride;
+			for (int x = 0; x < w; ++x, ++_o, px += 4)
+			{
+				const int r = px[0], g = px[1], b = px[2];
+				_y[_o] = static_cast<uint8_t>((77 * r + 150 * g + 29 * b + 128) >> 8);
+				_cb[_o] = static_cast<uint8_t>(std::clamp(((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128, 0, 255));
+				_cr[_o] = static_cast<uint8_t>(std::clamp(((128 * r - 107 * g - 21 * b + 128) >> 8) + 128, 0, 255));
+			}
+		}
+		streamFile.write("FRAME\n", 6);
+		streamFile.write(reinterpret_cast<const char*>(conversionBuffer.data()), conversionBuffer.size());
+		bytesWritten += conversionBuffer.size() + 6;
+	}
+	return streamFile.good();
+}
+
+///
+///
+/// ImGUI Interface
+///
+///
+
+void FrameCapture::DisplayImGuiChunk()
+{
+	if (ImGui::BeginMenu("Frame Capture")) {
+		if (ImGui::MenuItem(bIsCapturing ? "Stop Capture" : "Start Capture", "F7"))
+		{
+			if (bIsCapturing)
+				StopCapture();
+			else
+				StartCapture();
+		}
+		ImGui::Separator();
+		if (bIsCapturing)
+			ImGui::BeginDisabled();
+		int _format = (int)eFormat;
+		for (int i = 0; i < (int)FrameCaptureFormat_e::TOTAL_COUNT; ++i)
+		{
+			if (ImGui::RadioButton(g_captureFormatNames[i], &_format, i))
+				SetFormat((FrameCaptureFormat_e)_format);
+		}
+		ImGui::Checkbox("Only capture new Apple 2 frames", &bOnlyNewA2Frames);
+		ImGui::SetItemTooltip("Unchecked: every presented frame. Checked: only frames where the Apple 2 screen was redrawn");
+		if (bIsCapturing)
+			ImGui::EndDisabled();
+		if (bIsCapturing)
+		{
+			ImGui::Separator();
+			ImGui::Text("Frames written: %llu", (unsigned long long)framesWritten.load());
+			ImGui::Text("MB written: %.1f", bytesWritten.load() / (1024.0 * 1024.0));
+			ImGui::Text("Stalls: %llu", (unsigned long long)stallCount);
+			if (writeErrors > 0)
+				ImGui::TextColored(ImVec4(1.f, 0.2f, 0.2f, 1.f), "Write errors: %llu", (unsigned long long)writeErrors.load());
+		}
+		ImGui::EndMenu();
+	}
+}
+
+nlohmann::json FrameCapture::SerializeState()
+{
+	nlohmann::json jsonState = {
+		{"format", (int)eFormat},
+		{"only_new_a2_frames", bOnlyNewA2Frames}
+	};
+	return jsonState;
+}
+
+void FrameCapture::DeserializeState(const nlohmann::json &jsonState)
+{
+	SetFormat((FrameCaptureFormat_e)jsonState.value("format", (int)eFormat));
+	bOnlyNewA2Frames = jsonState.value("only_new_a2_frames", bOnlyNewA2Frames);
+}
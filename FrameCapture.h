@@ -0,0 +1,139 @@
+#pragma once
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <condition_variable>
+#include "common.h"
+
+/*
+	FrameCapture writes every captured frame losslessly to disk, as either:
+		- a raw RGBA stream (top-down rows, 4 bytes per pixel, no header)
+		- a Y4M stream (YCbCr 4:4:4, full range) that ffmpeg and most editors read natively
+		- a numbered PNG sequence inside its own directory
+
+	The readback is asynchronous: CaptureFramebuffer() only queues a glReadPixels into
+	one of FC_PBO_RING_SIZE pixel pack buffers and fences it. Buffers are mapped a couple
+	of frames later when the GPU is done with them, and the pixels are handed over to a
+	writer thread that does the conversion and disk IO.
+
+	Captures are lossless: if the GPU or the disk can't keep up, the render thread waits
+	instead of dropping frames. Those waits are counted as stalls.
+
+	The class knows nothing about windows, so it works just as well on an offscreen FBO.
+	The caller passes in the framebuffer to read and its size.
+*/
+
+constexpr uint32_t FC_PBO_RING_SIZE = 3;			// frames in flight between GPU and CPU
+constexpr size_t FC_MAX_QUEUED_FRAMES = 32;			// frames waiting for the writer thread
+
+enum class FrameCaptureFormat_e
+{
+	RAW_RGBA = 0,
+	Y4M,
+	PNG_SEQUENCE,
+	TOTAL_COUNT
+};
+
+class FrameCapture
+{
+public:
+	bool StartCapture();
+	void StopCapture();
+	bool IsCapturing() { return bIsCapturing; };
+
+	// Call right after the frame is fully drawn into fbo (0 is the default framebuffer)
+	// Set isNewA2Frame to false if the Apple 2 frame hasn't changed since the last call
+	void CaptureFramebuffer(GLuint fbo, int width, int height, bool isNewA2Frame = true);
+
+	// The capture format can only be changed when not capturing
+	FrameCaptureFormat_e GetFormat() { return eFormat; };
+	void SetFormat(FrameCaptureFormat_e format);
+
+	// If true, only capture the frames where the Apple 2 frame was updated,
+	// otherwise capture every presented frame
+	bool bOnlyNewA2Frames = false;
+
+	// ImGUI and prefs
+	void DisplayImGuiChunk();
+	nlohmann::json SerializeState();
+	void DeserializeState(const nlohmann::json &jsonState);
+
+	// public singleton code
+	static FrameCapture* GetInstance()
+	{
+		if (NULL == s_instance)
+			s_instance = new FrameCapture();
+		return s_instance;
+	}
+	~FrameCapture();
+
+private:
+	static FrameCapture* s_instance;
+	FrameCapture() {};
+
+	struct CaptureFrame {
+		std::vector<uint8_t> pixels;	// bottom-up RGBA, as read by OpenGL
+		int width = 0;
+		int height = 0;
+		uint64_t index = 0;
+	};
+
+	struct PBOSlot {
+		GLuint pbo = UINT_MAX;
+		GLsync fence = nullptr;
+		size_t bufferSize = 0;
+		int width = 0;
+		int height = 0;
+		uint64_t index = 0;
+		bool bIsPending = false;
+	};
+
+	void HarvestSlot(PBOSlot& slot);
+	void HarvestCompletedSlots(bool bWait);
+	void DeletePBOs();
+
+	void WriterThread();
+	bool WriteFrame(CaptureFrame& frame);
+	bool OpenStreamSegment(int width, int height);
+
+	FrameCaptureFormat_e eFormat = FrameCaptureFormat_e::Y4M;
+	bool bIsCapturing = false;
+
+	// GPU side, only touched from the GL thread
+	PBOSlot pboRing[FC_PBO_RING_SIZE];
+	uint32_t pboHead = 0;		// next slot to read into
+	uint32_t pboTail = 0;		// oldest pending slot
+	uint64_t framesRequested = 0;
+
+	// Writer thread
+	std::thread writerThread;
+	std::mutex queueMutex;
+	std::condition_variable queueCV;
+	std::deque<CaptureFrame> frameQueue;
+	bool bWriterShouldStop = false;
+
+	std::string capturePath;	// file path for streams, directory path for PNG sequences
+	std::ofstream streamFile;
+	int streamWidth = 0;
+	int streamHeight = 0;
+	uint32_t streamSegment = 0;
+	uint32_t y4mFpsNum = 60000;
+	uint32_t y4mFpsDen = 1001;
+	std::vector<uint8_t> conversionBuffer;
+
+	// Stats
+	std::atomic<uint64_t> framesWritten = 0;
+	std::atomic<uint64_t> bytesWritten = 0;
+	std::atomic<uint64_t> writeErrors = 0;
+	uint64_t stallCount = 0;
+};
+
+#endif // FRAMECAPTURE_H
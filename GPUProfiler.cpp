@@ -0,0 +1,356 @@
+#include "GPUProfiler.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstring>
+#include <filesystem>
+#include "imgui.h"
+#include "A2VideoManager.h"
+#include "LogTextManager.h"
+
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+#define GPT_OVERLAY_FIRST_ROW 2		// FPS uses the top rows of the overlay
+#define GPT_OVERLAY_COLORS 0b11010010
+
+// below because "The declaration of a static data member in its class definition is not a definition"
+GPUProfiler* GPUProfiler::s_instance;
+
+static const char* g_passNames[] = { "Legacy", "NTSC", "SHR", "VidHD", "Debug", "PostProcess", "ImGui" };
+
+GPUProfiler::~GPUProfiler()
+{
+	CloseCSV();
+	DeleteQueries();
+}
+
+const char* GPUProfiler::GetPassName(GPUPass_e pass)
+{
+	if (pass >= GPUPass_e::TOTAL_COUNT)
+		return "";
+	return g_passNames[(int)pass];
+}
+
+void GPUProfiler::LoadExtensions(GLADloadproc loader)
+{
+	const char* _version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+	bIsGLES = (_version != nullptr) && (strstr(_version, "OpenGL ES") != nullptr);
+	if (!bIsGLES)
+	{
+		// Timer queries are core since GL 3.3
+		pfnGetQueryObjectui64v = glad_glGetQueryObjectui64v;
+	}
+	else {
+		GLint _numExts = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &_numExts);
+		for (GLint i = 0; i < _numExts; ++i)
+		{
+			const char* _ext = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+			if (_ext && strcmp(_ext, "GL_EXT_disjoint_timer_query") == 0)
+			{
+				pfnGetQueryObjectui64v = (PFNGLGETQUERYOBJECTUI64VPROC)loader("glGetQueryObjectui64vEXT");
+				break;
+			}
+		}
+	}
+	bIsAvailable = (pfnGetQueryObjectui64v != nullptr);
+	if (!bIsAvailable)
+		std::cerr << "GPU timer queries not supported, GPU profiling disabled" << std::endl;
+}
+
+void GPUProfiler::CreateQueries()
+{
+	if (bQueriesCreated)
+		return;
+	for (auto& slot : frames)
+	{
+		glGenQueries((GLsizei)GPUPass_e::TOTAL_COUNT, slot.queries);
+		memset(slot.bIssued, 0, sizeof(slot.bIssued));
+		slot.bHasPasses = false;
+	}
+	bQueriesCreated = true;
+}
+
+void GPUProfiler::DeleteQueries()
+{
+	if (!bQueriesCreated)
+		return;
+	for (auto& slot : frames)
+		glDeleteQueries((GLsizei)GPUPass_e::TOTAL_COUNT, slot.queries);
+	bQueriesCreated = false;
+}
+
+void GPUProfiler::SetEnabled(bool bEnable)
+{
+	if (bEnable && !bIsAvailable)
+		return;
+	bEnabled = bEnable;
+	if (!bEnabled)
+	{
+		CloseCSV();
+		if (bOverlayIsDrawn)
+			EraseOverlay();
+	}
+	else if (bLogToCSV)
+		OpenCSV();
+}
+
+void GPUProfiler::SetLogToCSV(bool bLog)
+{
+	bLogToCSV = bLog;
+	if (bLogToCSV && bEnabled)
+		OpenCSV();
+	else
+		CloseCSV();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Queries
+//////////////////////////////////////////////////////////////////////////
+
+void GPUProfiler::BeginFrame()
+{
+	if (!bEnabled)
+		return;
+	CreateQueries();
+	if (activePass != GPUPass_e::TOTAL_COUNT)
+		EndPass(activePass);
+	currentSlot = (currentSlot + 1) % GPT_FRAME_LATENCY;
+	// This slot was filled GPT_FRAME_LATENCY frames ago, read it before reusing it
+	HarvestSlot(frames[currentSlot]);
+	frames[currentSlot].frameIndex = ++frameIndex;
+}
+
+void GPUProfiler::BeginPass(GPUPass_e pass)
+{
+	if (!bEnabled || !bQueriesCreated || (activePass != GPUPass_e::TOTAL_COUNT))
+		return;
+	auto& slot = frames[currentSlot];
+	glBeginQuery(GL_TIME_ELAPSED, slot.queries[(int)pass]);
+	slot.bIssued[(int)pass] = true;
+	slot.bHasPasses = true;
+	activePass = pass;
+}
+
+void GPUProfiler::EndPass(GPUPass_e pass)
+{
+	// Not checking bEnabled, the query may have been started before disabling
+	if (activePass != pass)
+		return;
+	glEndQuery(GL_TIME_ELAPSED);
+	activePass = GPUPass_e::TOTAL_COUNT;
+}
+
+void GPUProfiler::HarvestSlot(FrameQueries& slot)
+{
+	if (!slot.bHasPasses)
+		return;
+	slot.bHasPasses = false;
+
+	// On GLES the results are garbage if anything disjoint happened, like a GPU frequency change
+	if (bIsGLES)
+	{
+		GLint _disjoint = 0;
+		glGetIntegerv(GL_GPU_DISJOINT_EXT, &_disjoint);
+		if (_disjoint)
+		{
+			++disjointFrames;
+			memset(slot.bIssued, 0, sizeof(slot.bIssued));
+			return;
+		}
+	}
+
+	float _ms[(int)GPUPass_e::TOTAL_COUNT];
+	float _totalMs = 0.f;
+	for (int i = 0; i < (int)GPUPass_e::TOTAL_COUNT; ++i)
+	{
+		_ms[i] = -1.f;
+		if (!slot.bIssued[i])
+			continue;
+		slot.bIssued[i] = false;
+		GLuint _isAvailable = GL_FALSE;
+		glGetQueryObjectuiv(slot.queries[i], GL_QUERY_RESULT_AVAILABLE, &_isAvailable);
+		if (!_isAvailable)
+		{
+			++missedResults;
+			continue;
+		}
+		GLuint64 _ns = 0;
+		pfnGetQueryObjectui64v(slot.queries[i], GL_QUERY_RESULT, &_ns);
+		_ms[i] = _ns / 1'000'000.f;
+		_totalMs += _ms[i];
+		if (averageMs[i] == 0.f)
+			averageMs[i] = _ms[i];
+		else
+			averageMs[i] += GPT_AVERAGE_WEIGHT * (_ms[i] - averageMs[i]);
+	}
+
+	if (bLogToCSV && csvFile.is_open())
+	{
+		if (csvRows >= GPT_CSV_MAX_ROWS)
+		{
+			CloseCSV();
+			std::error_code ec;
+			std::filesystem::path _old(csvPath);
+			_old.replace_extension(".old.csv");
+			std::filesystem::rename(csvPath, _old, ec);
+			OpenCSV();
+		}
+		csvFile << slot.frameIndex;
+		for (int i = 0; i < (int)GPUPass_e::TOTAL_COUNT; ++i)
+		{
+			csvFile << ',';
+			if (_ms[i] >= 0.f)
+				csvFile << _ms[i];
+		}
+		csvFile << ',' << _totalMs << '\n';
+		++csvRows;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// CSV log
+//////////////////////////////////////////////////////////////////////////
+
+bool GPUProfiler::OpenCSV()
+{
+	if (csvFile.is_open())
+		return true;
+	std::filesystem::path _dir = std::filesystem::current_path() / "profiling";
+	std::error_code ec;
+	std::filesystem::create_directories(_dir, ec);
+	csvPath = (_dir / "gpu_timings.csv").string();
+	csvFile.open(csvPath, std::ios::out | std::ios::trunc);
+	if (!csvFile.is_open())
+	{
+		LogStreamErr() << "Can't open " << csvPath;
+		bLogToCSV = false;
+		return false;
+	}
+	csvFile << std::fixed << std::setprecision(4);
+	csvFile << "frame";
+	for (int i = 0; i < (int)GPUPass_e::TOTAL_COUNT; ++i)
+		csvFile << ',' << g_passNames[i] << "_ms";
+	csvFile << ",total_ms\n";
+	csvRows = 0;
+	return true;
+}
+
+void GPUProfiler::CloseCSV()
+{
+	if (csvFile.is_open())
+		csvFile.close();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Display
+//////////////////////////////////////////////////////////////////////////
+
+std::string GPUProfiler::GetSummary()
+{
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(3);
+	for (int i = 0; i < (int)GPUPass_e::TOTAL_COUNT; ++i)
+	{
+		if (i > 0)
+			ss << ", ";
+		ss << g_passNames[i] << " " << averageMs[i] << "ms";
+	}
+	if (missedResults > 0 || disjointFrames > 0)
+		ss << " (" << missedResults << " missed, " << disjointFrames << " disjoint)";
+	return ss.str();
+}
+
+void GPUProfiler::UpdateOverlay()
+{
+	if (!bEnabled || !bShowOnOverlay)
+	{
+		if (bOverlayIsDrawn)
+			EraseOverlay();
+		return;
+	}
+	auto a2VideoManager = A2VideoManager::GetInstance();
+	char _buf[24];
+	for (int i = 0; i < (int)GPUPass_e::TOTAL_COUNT; ++i)
+	{
+		// The overlay font has no lowercase
+		std::string _name = g_passNames[i];
+		for (auto& c : _name)
+			c = (char)toupper(c);
+		snprintf(_buf, sizeof(_buf), "%-12s%6.3f MS", _name.c_str(), averageMs[i]);
+		a2VideoManager->DrawOverlayString(_buf, 21, GPT_OVERLAY_COLORS, 0, GPT_OVERLAY_FIRST_ROW + i);
+	}
+	bOverlayIsDrawn = true;
+}
+
+void GPUProfiler::EraseOverlay()
+{
+	auto a2VideoManager = A2VideoManager::GetInstance();
+	for (int i = 0; i < (int)GPUPass_e::TOTAL_COUNT; ++i)
+		a2VideoManager->EraseOverlayRange(21, 0, GPT_OVERLAY_FIRST_ROW + i);
+	a2VideoManager->ForceBeamFullScreenRender();
+	bOverlayIsDrawn = false;
+}
+
+void GPUProfiler::DisplayImGuiChunk()
+{
+	if (ImGui::BeginMenu("GPU Timings")) {
+		if (!bIsAvailable)
+			ImGui::BeginDisabled();
+		bool _enabled = bEnabled;
+		if (ImGui::Checkbox("Measure GPU time per pass", &_enabled))
+			SetEnabled(_enabled);
+		ImGui::Checkbox("Show on overlay", &bShowOnOverlay);
+		bool _log = bLogToCSV;
+		if (ImGui::Checkbox("Log to profiling/gpu_timings.csv", &_log))
+			SetLogToCSV(_log);
+		if (!bIsAvailable)
+		{
+			ImGui::EndDisabled();
+			ImGui::TextDisabled("Timer queries are not supported by this GPU");
+		}
+		if (bEnabled && ImGui::BeginTable("##gputimings", 2, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit))
+		{
+			float _totalMs = 0.f;
+			for (int i = 0; i < (int)GPUPass_e::TOTAL_COUNT; ++i)
+			{
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(g_passNames[i]);
+				ImGui::TableNextColumn();
+				ImGui::Text("%7.3f ms", averageMs[i]);
+				_totalMs += averageMs[i];
+			}
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted("Total");
+			ImGui::TableNextColumn();
+			ImGui::Text("%7.3f ms", _totalMs);
+			ImGui::EndTable();
+			if (missedResults > 0 || disjointFrames > 0)
+				ImGui::TextDisabled("Missed: %llu  Disjoint: %llu",
+					(unsigned long long)missedResults, (unsigned long long)disjointFrames);
+		}
+		ImGui::EndMenu();
+	}
+}
+
+nlohmann::json GPUProfiler::SerializeState()
+{
+	nlohmann::json jsonState = {
+		{"enabled", bEnabled},
+		{"show_on_overlay", bShowOnOverlay},
+		{"log_to_csv", bLogToCSV},
+	};
+	return jsonState;
+}
+
+void GPUProfiler::DeserializeState(const nlohmann::json &jsonState)
+{
+	bShowOnOverlay = jsonState.value("show_on_overlay", bShowOnOverlay);
+	bLogToCSV = jsonState.value("log_to_csv", bLogToCSV);
+	SetEnabled(jsonState.value("enabled", bEnabled));
+}
@@ -0,0 +1,121 @@
+#pragma once
+#ifndef GPUPROFILER_H
+#define GPUPROFILER_H
+
+#include <stdint.h>
+#include <string>
+#include <fstream>
+#include "common.h"
+
+/*
+	GPUProfiler measures the GPU time of each render pass with GL_TIME_ELAPSED queries
+	(EXT_disjoint_timer_query on GLES).
+
+	Each pass is wrapped in BeginPass()/EndPass(). Timer queries can't be nested, so the
+	passes must not overlap. Queries are kept in a ring of GPT_FRAME_LATENCY frames and
+	their results are only read when the slot comes around again, by which time the GPU
+	is long done with them. Reading them never stalls the pipeline. A result that still
+	isn't ready is dropped and counted as missed.
+
+	The averages can be drawn on the Apple 2 overlay under the FPS counter, and every
+	measured frame can be logged to profiling/gpu_timings.csv. The CSV is rolled over
+	to gpu_timings.old.csv every GPT_CSV_MAX_ROWS rows so it never grows unbounded.
+*/
+
+constexpr uint32_t GPT_FRAME_LATENCY = 4;		// frames between issuing a query and reading it
+constexpr uint32_t GPT_CSV_MAX_ROWS = 100'000;	// rows before the CSV rolls over
+constexpr float GPT_AVERAGE_WEIGHT = 0.05f;		// weight of a new sample in the running average
+
+enum class GPUPass_e
+{
+	LEGACY = 0,		// legacy windowsbeam
+	NTSC,			// NTSC pass from FBO_NTSC
+	SHR,			// SHR windowsbeam
+	VIDHD,			// VidHD layer
+	DEBUG,			// debug graphics modes windows and RAM RGB windows
+	POSTPROCESS,	// PostProcessor, including the bezel
+	IMGUI,			// ImGui menus and windows
+	TOTAL_COUNT
+};
+
+class GPUProfiler
+{
+public:
+	// Must be called once the GL context is current. The loader is only used to
+	// find the GLES extension functions.
+	void LoadExtensions(GLADloadproc loader);
+	bool IsAvailable() { return bIsAvailable; };
+
+	// Call before the first pass of every frame
+	void BeginFrame();
+	void BeginPass(GPUPass_e pass);
+	void EndPass(GPUPass_e pass);
+
+	float GetAverageMs(GPUPass_e pass) { return averageMs[(int)pass]; };
+	static const char* GetPassName(GPUPass_e pass);
+	std::string GetSummary();		// one line with all the averages
+
+	// Draws the averages on the Apple 2 overlay. Call at the same rate as the FPS display.
+	void UpdateOverlay();
+
+	bool IsEnabled() { return bEnabled; };
+	void SetEnabled(bool bEnable);
+	bool IsLoggingToCSV() { return bLogToCSV; };
+	void SetLogToCSV(bool bLog);
+	bool bShowOnOverlay = false;
+
+	// ImGUI and prefs
+	void DisplayImGuiChunk();
+	nlohmann::json SerializeState();
+	void DeserializeState(const nlohmann::json &jsonState);
+
+	// public singleton code
+	static GPUProfiler* GetInstance()
+	{
+		if (NULL == s_instance)
+			s_instance = new GPUProfiler();
+		return s_instance;
+	}
+	~GPUProfiler();
+
+private:
+	static GPUProfiler* s_instance;
+	GPUProfiler() {};
+
+	struct FrameQueries {
+		GLuint queries[(int)GPUPass_e::TOTAL_COUNT] = {};
+		bool bIssued[(int)GPUPass_e::TOTAL_COUNT] = {};
+		bool bHasPasses = false;
+		uint64_t frameIndex = 0;
+	};
+
+	void CreateQueries();
+	void DeleteQueries();
+	void HarvestSlot(FrameQueries& slot);
+	bool OpenCSV();
+	void CloseCSV();
+	void EraseOverlay();
+
+	bool bIsAvailable = false;
+	bool bIsGLES = false;
+	bool bEnabled = false;
+	bool bLogToCSV = false;
+	bool bOverlayIsDrawn = false;
+	PFNGLGETQUERYOBJECTUI64VPROC pfnGetQueryObjectui64v = nullptr;
+
+	FrameQueries frames[GPT_FRAME_LATENCY];
+	bool bQueriesCreated = false;
+	uint32_t currentSlot = 0;
+	uint64_t frameIndex = 0;
+	GPUPass_e activePass = GPUPass_e::TOTAL_COUNT;	// only one query can run at a time
+
+	float averageMs[(int)GPUPass_e::TOTAL_COUNT] = {};
+	uint64_t missedResults = 0;
+	uint64_t disjointFrames = 0;
+
+	std::ofstream csvFile;
+	std::string csvPath;
+	uint32_t csvRows = 0;
+};
+
+#endif // GPUPROFILER_H
@@ -0,0 +1,292 @@
+#include "HeadlessContext.h"
+#include "OpenGLHelper.h"
+#include <iostream>
+#include <cstring>
+
+#if defined(__NETWORKING_LINUX__)
+#define HEADLESS_USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+// Older headers may not know about these
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+#ifndef EGL_OPENGL_ES3_BIT_KHR
+#define EGL_OPENGL_ES3_BIT_KHR 0x00000040
+#endif
+#ifndef EGL_CONTEXT_MAJOR_VERSION_KHR
+#define EGL_CONTEXT_MAJOR_VERSION_KHR 0x3098
+#endif
+#ifndef EGL_CONTEXT_MINOR_VERSION_KHR
+#define EGL_CONTEXT_MINOR_VERSION_KHR 0x30FB
+#endif
+#ifndef EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR
+#define EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR 0x30FD
+#endif
+#ifndef EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR
+#define EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR 0x00000001
+#endif
+#endif
+
+HeadlessContext::~HeadlessContext()
+{
+	Destroy();
+}
+
+bool HeadlessContext::Create(int width, int height)
+{
+	fbWidth = width;
+	fbHeight = height;
+	if (!CreatePlatformContext())
+		return false;
+	if (!CreateFramebuffer())
+	{
+		DestroyPlatformContext();
+		return false;
+	}
+	return true;
+}
+
+void HeadlessContext::Destroy()
+{
+	if (platformContext == nullptr)
+		return;
+	if (fbo != 0)
+		glDeleteFramebuffers(1, &fbo);
+	if (colorTex != 0)
+		glDeleteTextures(1, &colorTex);
+	fbo = 0;
+	colorTex = 0;
+	DestroyPlatformContext();
+}
+
+bool HeadlessContext::CreateFramebuffer()
+{
+	glGenTextures(1, &colorTex);
+	glBindTexture(GL_TEXTURE_2D, colorTex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, fbWidth, fbHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTex, 0);
+	GLenum _status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (_status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cerr << "Headless framebuffer incomplete: " << _status << std::endl;
+		return false;
+	}
+	glViewport(0, 0, fbWidth, fbHeight);
+	return true;
+}
+
+#if defined(HEADLESS_USE_EGL)
+
+static bool EGLHasExtension(const char* extensions, const char* name)
+{
+	if (extensions == nullptr)
+		return false;
+	size_t _len = strlen(name);
+	const char* _p = extensions;
+	while ((_p = strstr(_p, name)) != nullptr)
+	{
+		if ((_p == extensions || _p[-1] == ' ') && (_p[_len] == ' ' || _p[_len] == '\0'))
+			return true;
+		_p += _len;
+	}
+	return false;
+}
+
+bool HeadlessContext::CreatePlatformContext()
+{
+	// Prefer the surfaceless platform: it needs no display server and no GPU
+	EGLDisplay _display = EGL_NO_DISPLAY;
+	const char* _clientExts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (EGLHasExtension(_clientExts, "EGL_MESA_platform_surfaceless"))
+	{
+		auto _getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (_getPlatformDisplay)
+			_display = _getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	}
+	if (_display == EGL_NO_DISPLAY)
+		_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (_display == EGL_NO_DISPLAY)
+	{
+		std::cerr << "Headless: no EGL display available" << std::endl;
+		return false;
+	}
+	EGLint _major = 0, _minor = 0;
+	// Only the GLSL version is needed, SDL isn't creating this context
+	OpenGLHelper::GetInstance()->set_gl_version(false);
+	if (!eglInitialize(_display, &_major, &_minor))
+	{
+		std::cerr << "Headless: eglInitialize failed: 0x" << std::hex << eglGetError() << std::dec << std::endl;
+		return false;
+	}
+
+#if defined(IMGUI_IMPL_OPENGL_ES2)
+	const EGLenum _api = EGL_OPENGL_ES_API;
+	const EGLint _renderableType = EGL_OPENGL_ES3_BIT_KHR;
+	const EGLint _contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+		EGL_CONTEXT_MINOR_VERSION_KHR, 0,
+		EGL_NONE
+	};
+#else
+	const EGLenum _api = EGL_OPENGL_API;
+	const EGLint _renderableType = EGL_OPENGL_BIT;
+	const EGLint _contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION_KHR, 4,
+		EGL_CONTEXT_MINOR_VERSION_KHR, 1,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+		EGL_NONE
+	};
+#endif
+	if (!eglBindAPI(_api))
+	{
+		std::cerr << "Headless: eglBindAPI failed" << std::endl;
+		eglTerminate(_display);
+		return false;
+	}
+
+	const EGLint _configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, _renderableType,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_NONE
+	};
+	EGLConfig _config;
+	EGLint _numConfigs = 0;
+	if (!eglChooseConfig(_display, _configAttribs, &_config, 1, &_numConfigs) || _numConfigs < 1)
+	{
+		std::cerr << "Headless: no suitable EGL config" << std::endl;
+		eglTerminate(_display);
+		return false;
+	}
+
+	EGLContext _context = eglCreateContext(_display, _config, EGL_NO_CONTEXT, _contextAttribs);
+	if (_context == EGL_NO_CONTEXT)
+	{
+		std::cerr << "Headless: eglCreateContext failed: 0x" << std::hex << eglGetError() << std::dec << std::endl;
+		eglTerminate(_display);
+		return false;
+	}
+
+	// Everything is drawn into our own FBO, so the surface is only there if the driver insists
+	EGLSurface _surface = EGL_NO_SURFACE;
+	const char* _displayExts = eglQueryString(_display, EGL_EXTENSIONS);
+	bool _isSurfaceless = EGLHasExtension(_displayExts, "EGL_KHR_surfaceless_context");
+	if (!_isSurfaceless)
+	{
+		const EGLint _pbufferAttribs[] = { EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE };
+		_surface = eglCreatePbufferSurface(_display, _config, _pbufferAttribs);
+		if (_surface == EGL_NO_SURFACE)
+		{
+			std::cerr << "Headless: eglCreatePbufferSurface failed: 0x" << std::hex << eglGetError() << std::dec << std::endl;
+			eglDestroyContext(_display, _context);
+			eglTerminate(_display);
+			return false;
+		}
+	}
+	if (!eglMakeCurrent(_display, _surface, _surface, _context))
+	{
+		std::cerr << "Headless: eglMakeCurrent failed: 0x" << std::hex << eglGetError() << std::dec << std::endl;
+		if (_surface != EGL_NO_SURFACE)
+			eglDestroySurface(_display, _surface);
+		eglDestroyContext(_display, _context);
+		eglTerminate(_display);
+		return false;
+	}
+	platformDisplay = _display;
+	platformContext = _context;
+	platformSurface = _surface;
+
+	if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+	{
+		std::cerr << "Headless: failed to initialize GLAD" << std::endl;
+		DestroyPlatformContext();
+		return false;
+	}
+
+	description = "EGL " + std::to_string(_major) + "." + std::to_string(_minor)
+		+ (_isSurfaceless ? " surfaceless" : " pbuffer")
+		+ " - " + reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+	return true;
+}
+
+GLADloadproc HeadlessContext::GetProcLoader()
+{
+	return (GLADloadproc)eglGetProcAddress;
+}
+
+void HeadlessContext::DestroyPlatformContext()
+{
+	EGLDisplay _display = static_cast<EGLDisplay>(platformDisplay);
+	eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (platformSurface != nullptr)
+		eglDestroySurface(_display, static_cast<EGLSurface>(platformSurface));
+	eglDestroyContext(_display, static_cast<EGLContext>(platformContext));
+	eglTerminate(_display);
+	platformDisplay = nullptr;
+	platformContext = nullptr;
+	platformSurface = nullptr;
+}
+
+#else	// HEADLESS_USE_EGL
+
+bool HeadlessContext::CreatePlatformContext()
+{
+	if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0)
+	{
+		std::cerr << "Headless: SDL video init failed: " << SDL_GetError() << std::endl;
+		return false;
+	}
+	OpenGLHelper::GetInstance()->set_gl_version();
+	SDL_Window* _window = SDL_CreateWindow("Super Duper Display (headless)",
+		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 16, 16,
+		(SDL_WindowFlags)(SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN));
+	if (_window == nullptr)
+	{
+		std::cerr << "Headless: SDL_CreateWindow failed: " << SDL_GetError() << std::endl;
+		return false;
+	}
+	SDL_GLContext _context = SDL_GL_CreateContext(_window);
+	if (_context == nullptr)
+	{
+		std::cerr << "Headless: SDL_GL_CreateContext failed: " << SDL_GetError() << std::endl;
+		SDL_DestroyWindow(_window);
+		return false;
+	}
+	SDL_GL_MakeCurrent(_window, _context);
+	platformSurface = _window;
+	platformContext = _context;
+
+	if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress))
+	{
+		std::cerr << "Headless: failed to initialize GLAD" << std::endl;
+		DestroyPlatformContext();
+		return false;
+	}
+	description = std::string("hidden SDL window - ") + reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+	return true;
+}
+
+GLADloadproc HeadlessContext::GetProcLoader()
+{
+	return (GLADloadproc)SDL_GL_GetProcAddress;
+}
+
+void HeadlessContext::DestroyPlatformContext()
+{
+	SDL_GL_DeleteContext(static_cast<SDL_GLContext>(platformContext));
+	SDL_DestroyWindow(static_cast<SDL_Window*>(platformSurface));
+	platformContext = nullptr;
+	platformSurface = nullptr;
+}
+
+#endif	// HEADLESS_USE_EGL
@@ -0,0 +1,57 @@
+#pragma once
+#ifndef HEADLESSCONTEXT_H
+#define HEADLESSCONTEXT_H
+
+/*
+	OpenGL context without a visible window, for running the renderer on machines
+	that have no display (soak tests, benchmarks, automated rendering checks).
+
+	On Linux the context comes from EGL, surfaceless when the driver supports it
+	(Mesa llvmpipe does) or with a tiny pbuffer otherwise. No X11 or Wayland is needed.
+	Other platforms fall back to a hidden SDL window, which still needs a desktop session.
+
+	Either way everything is drawn into an offscreen framebuffer of the requested size,
+	never into a default framebuffer.
+*/
+
+#include "common.h"
+#include <string>
+
+class HeadlessContext
+{
+public:
+	HeadlessContext() {};
+	~HeadlessContext();
+
+	// Creates the context, makes it current, loads the GL functions and
+	// creates the offscreen framebuffer
+	bool Create(int width, int height);
+	void Destroy();
+
+	GLuint GetFramebuffer() { return fbo; };
+	GLuint GetColorTexture() { return colorTex; };
+	int GetWidth() { return fbWidth; };
+	int GetHeight() { return fbHeight; };
+	// The GL function loader matching the context
+	GLADloadproc GetProcLoader();
+	// Describes how the context was created, for the logs
+	const std::string& GetDescription() { return description; };
+
+private:
+	bool CreatePlatformContext();
+	void DestroyPlatformContext();
+	bool CreateFramebuffer();
+
+	int fbWidth = 0;
+	int fbHeight = 0;
+	GLuint fbo = 0;
+	GLuint colorTex = 0;
+	std::string description;
+
+	// Opaque platform handles (EGLDisplay/EGLContext/EGLSurface, or SDL window/context)
+	void* platformDisplay = nullptr;
+	void* platformContext = nullptr;
+	void* platformSurface = nullptr;
+};
+
+#endif	// HEADLESSCONTEXT_H
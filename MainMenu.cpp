@@ -14,6 +14,9 @@
 #include "LogTextManager.h"
 #include "PostProcessor.h"
 #include "EventRecorder.h"
+#include "FrameCapture.h"
+#include "FlightRecorder.h"
+#include "GPUProfiler.h"
 #include "SDHRManager.h"
 #include "SDHRNetworking.h"
 #include "extras/MemoryLoader.h"
@@ -1014,6 +1017,7 @@ void MainMenu::ShowVideoMenu() {
 	if (ImGui::Checkbox("Use PNG for screenshots", &_bUsePNG))
 		Main_SetbUsePNGForScreenshots(_bUsePNG);
 	ImGui::SetItemTooltip("Screenshot format -- unchecked: BMP, checked: PNG");
+	FrameCapture::GetInstance()->DisplayImGuiChunk();
 }
 
 void MainMenu::ShowSoundMenu() {
@@ -1139,10 +1143,9 @@ void MainMenu::ShowSamplesMenu() {
 	if (ImGui::MenuItem(_smtext)) {
 		pGui->bSampleRunKarateka = !pGui->bSampleRunKarateka;
 		if (pGui->bSampleRunKarateka) {
-			std::ifstream karatekafile("./recordings/karateka.vcr", std::ios::binary);
 			Main_ResetA2SS();
 			memManager->SetSoftSwitch(A2SS_SHR, false);
-			eventRecorder->ReadRecordingFile(karatekafile);
+			eventRecorder->ReadRecordingFile("./recordings/karateka.vcr");
 			eventRecorder->StartReplay();
 			memManager->SetSoftSwitch(A2SS_TEXT, false);
 			memManager->SetSoftSwitch(A2SS_HIRES, true);
@@ -1167,8 +1170,11 @@ void MainMenu::ShowDeveloperMenu() {
 	}
 	ImGui::MenuItem("Load File Into Memory", "", &pGui->bShowLoadFileWindow);
 	ImGui::Separator();
+	GPUProfiler::GetInstance()->DisplayImGuiChunk();
+	ImGui::Separator();
 	ImGui::MenuItem("Soft Switches", "F9", &pGui->bShowSSWindow);
 	ImGui::MenuItem("Event Recorder", "", &pGui->bShowEventRecorderWindow);
+	FlightRecorder::GetInstance()->DisplayImGuiChunk();
 	if (ImGui::BeginMenu("Graphics Modes Windows")) {
 		ImGui::MenuItem("TEXT1", "", &a2VideoManager->bRenderTEXT1);
 		ImGui::MenuItem("TEXT2", "", &a2VideoManager->bRenderTEXT2);
@@ -3,6 +3,7 @@
 #include "A2VideoManager.h"
 #include <iostream>
 #include <sstream>
+#include <cstring>
 
 float Memory_HighlightWriteFunction(const uint8_t* data, size_t offset, uint8_t cutoffSeconds) {
 	(void)data;
@@ -491,12 +492,21 @@ void MemoryManager::WriteToMemory(uint16_t addr, uint8_t val, bool m2b0, bool is
 }
 
 std::string MemoryManager::SerializeSwitches() const {
-	std::ostringstream out;
-	out.write(reinterpret_cast<const char*>(&a2SoftSwitches), sizeof(a2SoftSwitches));
-	out.write(reinterpret_cast<const char*>(&switch_c022), sizeof(switch_c022));
-	out.write(reinterpret_cast<const char*>(&switch_c034), sizeof(switch_c034));
-	out.write(reinterpret_cast<const char*>(&is2gs), sizeof(is2gs));
-	return out.str();
+	uint8_t _data[sizeof(a2SoftSwitches) + sizeof(switch_c022) + sizeof(switch_c034) + sizeof(is2gs)];
+	return std::string(reinterpret_cast<const char*>(_data), SerializeSwitches(_data));
+}
+
+size_t MemoryManager::SerializeSwitches(uint8_t* data) const {
+	uint8_t* _p = data;
+	memcpy(_p, &a2SoftSwitches, sizeof(a2SoftSwitches));
+	_p += sizeof(a2SoftSwitches);
+	memcpy(_p, &switch_c022, sizeof(switch_c022));
+	_p += sizeof(switch_c022);
+	memcpy(_p, &switch_c034, sizeof(switch_c034));
+	_p += sizeof(switch_c034);
+	memcpy(_p, &is2gs, sizeof(is2gs));
+	_p += sizeof(is2gs);
+	return _p - data;
 }
 
 void MemoryManager::DeserializeSwitches(const std::string& data) {
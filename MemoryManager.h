@@ -93,8 +93,10 @@ public:
 	void SetSoftSwitch(A2SoftSwitch_e ss, bool state);
 	void ProcessSoftSwitch(uint16_t addr, uint8_t val, bool rw, bool is_iigs);
 
-	// De/serialization in case one wants to save and restore state
+	// De/serialization in case one wants to save and restore state.
+	// The pointer version writes the same bytes without allocating, and returns their size.
 	std::string SerializeSwitches() const;
+	size_t SerializeSwitches(uint8_t* data) const;
 	void DeserializeSwitches(const std::string& data);
 
 	// public singleton code
@@ -1,12 +1,60 @@
 #include "MockingboardManager.h"
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <cstring>
 #include "imgui.h"
 
 #define CHIPS_IMPL
 #include "m6522.h"
 m6522_t m6522[4];
 
+// True when an idle tick would only decrement the timers: the counting pipelines
+// are full, no timer reload or interrupt is in flight and no control line moved.
+static bool M6522IsSettled(const m6522_t* c)
+{
+	if ((c->t1.pip != 0x0003) || (c->t2.pip != 0x0003) || c->t1.t_out || c->t2.t_out)
+		return false;
+	if (c->pa.c1_triggered || c->pa.c2_triggered || c->pb.c1_triggered || c->pb.c2_triggered)
+		return false;
+	const bool _irqPending = (c->intr.ifr & c->intr.ier) != 0;
+	if (c->intr.pip != (_irqPending ? 1 : 0))
+		return false;
+	return !_irqPending || (c->intr.ifr & 0x80);
+}
+
+// Advances an unselected M6522 by the given number of cycles, with exactly the same
+// result as calling m6522_tick() on each of them with the same idle pins.
+// Once settled the timers are plain down-counters, so it jumps straight to the cycle
+// before the next underflow and only ticks the underflows and what follows them.
+static void M6522CatchUp(m6522_t* c, uint64_t pins, uint64_t cycles)
+{
+	while (cycles > 0)
+	{
+		if (M6522IsSettled(c))
+		{
+			uint64_t _skip = std::min<uint64_t>(cycles, c->t1.counter);
+			// In PB6 mode T2 counts the PB6 falling edges between the last output pins
+			// and the new input pins, which with idle pins is either every cycle or never
+			const bool _isT2Counting = !M6522_ACR_T2_COUNT_PB6(c) || (M6522_PB6 & ~pins & c->pins);
+			if (_isT2Counting)
+				_skip = std::min<uint64_t>(_skip, c->t2.counter);
+			if (_skip > 0)
+			{
+				c->t1.counter -= static_cast<uint16_t>(_skip);
+				if (_isT2Counting)
+					c->t2.counter -= static_cast<uint16_t>(_skip);
+				cycles -= _skip;
+				continue;
+			}
+		}
+		m6522_tick(c, pins);
+		--cycles;
+	}
+}
+
 // below because "The declaration of a static data member in its class definition is not a definition"
 MockingboardManager* MockingboardManager::s_instance;
 
@@ -16,6 +64,12 @@ MockingboardManager::MockingboardManager(uint32_t sampleRate)
 		Ayumi(false, _A2_CPU_FREQUENCY_NTSC, sampleRate),
 		Ayumi(false, _A2_CPU_FREQUENCY_NTSC, sampleRate),
 		Ayumi(false, _A2_CPU_FREQUENCY_NTSC, sampleRate) } {
+	cyclesPerSample = static_cast<double>(_A2_CPU_FREQUENCY_NTSC) / sampleRate;
+	renderCyclesPerSample = cyclesPerSample;
+	// Power on state. A reset doesn't touch the timer latches, and a zero latch
+	// would have T1 underflow every other cycle.
+	for (uint8_t viaidx = 0; viaidx < 4; viaidx++)
+		m6522_init(&m6522[viaidx]);
 	Initialize();
 }
 
@@ -25,11 +79,16 @@ void MockingboardManager::Initialize()
 	for (uint8_t viaidx = 0; viaidx < 4; viaidx++)
 	{
 		m6522_reset(&m6522[viaidx]);
+		viaCycle[viaidx] = busCycle.load(std::memory_order_relaxed);
 	}
 	
 	for(uint8_t ssiidx = 0; ssiidx < 4; ssiidx++)
 	{
-		ssi[ssiidx].ResetRegisters();
+		MBRegisterEvent _event;
+		_event.op = MBOp_e::SSI_RESET;
+		_event.chip = ssiidx;
+		PushControlEvent(_event);
+		latched_register[ssiidx] = 0;
 	}
 	
 	bIsPlaying = false;
@@ -41,7 +100,7 @@ MockingboardManager::~MockingboardManager() {
 void MockingboardManager::BeginPlay() {
 	if (!bIsEnabled)
 		return;
-	UpdateAllPans();
+	bPansAreStale = true;
 	bIsPlaying = true;
 	mb_event_count = 0;
 }
@@ -50,9 +109,10 @@ void MockingboardManager::StopPlay() {
 	// set amplitude to 0
 	for(uint8_t ayidx = 0; ayidx < 4; ayidx++)
 	{
-		ay[ayidx].SetVolume(0, 0);
-		ay[ayidx].SetVolume(1, 0);
-		ay[ayidx].SetVolume(2, 0);
+		MBRegisterEvent _event;
+		_event.op = MBOp_e::AY_SILENCE;
+		_event.chip = ayidx;
+		PushControlEvent(_event);
 	}
 	bIsPlaying = false;
 }
@@ -61,24 +121,220 @@ bool MockingboardManager::IsPlaying() {
 	return bIsPlaying;
 }
 
-void MockingboardManager::GetSamples(float& left, float& right) {
+void MockingboardManager::PushBusEvent(MBOp_e op, uint8_t chip, uint8_t reg, uint8_t value)
+{
+	MBRegisterEvent _event;
+	_event.cycle = busCycle.load(std::memory_order_relaxed);
+	_event.op = op;
+	_event.chip = chip;
+	_event.reg = reg;
+	_event.value = value;
+	busEvents.push(_event);
+}
+
+void MockingboardManager::PushControlEvent(const MBRegisterEvent& event)
+{
+	controlEvents.push(event);
+}
+
+void MockingboardManager::ApplyEvent(const MBRegisterEvent& event)
+{
+	switch (event.op) {
+	case MBOp_e::AY_WRITE:
+		SetRegister(&ay[event.chip], event.reg, event.value);
+		break;
+	case MBOp_e::AY_RESET:
+		ay[event.chip].ResetRegisters();
+		break;
+	case MBOp_e::AY_SILENCE:
+		ay[event.chip].SetVolume(0, 0);
+		ay[event.chip].SetVolume(1, 0);
+		ay[event.chip].SetVolume(2, 0);
+		break;
+	case MBOp_e::AY_PAN:
+		ay[event.chip].SetPan(event.reg, event.pan, event.isEqp);
+		break;
+	case MBOp_e::SSI_WRITE:
+	{
+		// Replays the pin sequence of a write: CS0 was low, the data and register
+		// are set up with R/W low, then CS0 rises
+		SSI263* ssip = &ssi[event.chip];
+		if (!ssip->IsEnabled())
+			break;
+		ssip->SetCS0(0);
+		ssip->SetData(event.value);
+		ssip->SetRegisterSelect(event.reg);
+		ssip->SetReadMode(false);
+		ssip->SetCS0(1);
+		ssip->Update();
+		break;
+	}
+	case MBOp_e::SSI_RESET:
+		ssi[event.chip].ResetRegisters();
+		break;
+	default:
+		break;
+	}
+}
+
+void MockingboardManager::ApplyControlEvents()
+{
+	MBRegisterEvent* _event;
+	while ((_event = controlEvents.front()) != nullptr)
+	{
+		ApplyEvent(*_event);
+		controlEvents.pop();
+	}
+	if (bPansAreStale.exchange(false))
+		UpdateAllPans();
+	if (bRatesAreStale)
+		UpdateRates();
+}
+
+void MockingboardManager::ApplyPendingEvents()
+{
+	ApplyControlEvents();
+	MBRegisterEvent* _event;
+	while ((_event = busEvents.front()) != nullptr)
+	{
+		ApplyEvent(*_event);
+		busEvents.pop();
+	}
+}
+
+// Index of the sample in the current block before which the event must be applied.
+// Late events are negative and are applied right away.
+int64_t MockingboardManager::GetEventSampleIndex(const MBRegisterEvent& event)
+{
+	return static_cast<int64_t>(std::floor((static_cast<double>(event.cycle) - renderCycle) / renderCyclesPerSample));
+}
+
+void MockingboardManager::SetAudioFormat(uint32_t _sampleRate, uint32_t latencySamples)
+{
+	renderLatencySamples = latencySamples;
+	renderDrift.SetTarget(latencySamples);
+	if (_sampleRate == sampleRate)
+		return;
+	sampleRate = _sampleRate;
+	UpdateRates();
+	for (uint8_t i = 0; i < 4; i++)
+		ssi[i].SetOutputRate(sampleRate);
+}
+
+void MockingboardManager::SetPAL(bool isPal)
+{
+	if (isPal == bIsPAL)
+		return;
+	bIsPAL = isPal;
+	bRatesAreStale = true;	// picked up by the audio thread
+}
+
+// Audio thread, or when the audio callback isn't running
+void MockingboardManager::UpdateRates()
+{
+	bRatesAreStale = false;
+	const double _cpuFrequency = bIsPAL ? static_cast<double>(_A2_CPU_FREQUENCY_PAL) : static_cast<double>(_A2_CPU_FREQUENCY_NTSC);
+	cyclesPerSample = _cpuFrequency / sampleRate;
+	renderCyclesPerSample = cyclesPerSample;
+	for (uint8_t i = 0; i < 4; i++)
+		ay[i].SetRates(_cpuFrequency, sampleRate);
+}
+
+void MockingboardManager::GetSamplesBlock(float* left, float* right, int count)
+{
+	ApplyControlEvents();
+
+	// Keep rendering renderLatencySamples behind the bus. The bus and the audio device
+	// have their own clocks, so the render position is sped up or slowed down a little to
+	// hold the latency. If they're too far apart anyway, like after the bus was stopped, jump.
+	// Only do it while the bus is moving, a silent Apple 2 would otherwise resync every block.
+	const uint64_t _busCycle = busCycle.load(std::memory_order_relaxed);
+	if (_busCycle != renderLastBusCycle)
+	{
+		const double _latency = (static_cast<double>(_busCycle) - renderCycle) / cyclesPerSample;
+		const double _threshold = std::max<double>(MM_RESYNC_THRESHOLD_SAMPLES, 4.0 * renderLatencySamples);
+		if (std::abs(_latency - renderLatencySamples) > _threshold)
+		{
+			renderCycle = static_cast<double>(_busCycle) - renderLatencySamples * cyclesPerSample;
+			renderDrift.Reset();
+			resyncCount.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+			renderDrift.Update(_latency, count);
+		renderLatencyLevel.store(static_cast<float>(renderDrift.GetSmoothedLevel()), std::memory_order_relaxed);
+		renderCyclesPerSample = cyclesPerSample * renderDrift.GetRate();
+		renderDriftPPM.store(static_cast<float>(renderDrift.GetDriftPPM()), std::memory_order_relaxed);
+		renderLastBusCycle = _busCycle;
+	}
+
+	// Split the block at each register write and render the chips in between
+	int _pos = 0;
+	while (_pos < count)
+	{
+		MBRegisterEvent* _event;
+		while (((_event = busEvents.front()) != nullptr) && (GetEventSampleIndex(*_event) <= _pos))
+		{
+			ApplyEvent(*_event);
+			busEvents.pop();
+		}
+		int _end = count;
+		if (_event != nullptr)
+			_end = static_cast<int>(std::clamp<int64_t>(GetEventSampleIndex(*_event), _pos + 1, count));
+		RenderSegment(left + _pos, right + _pos, _end - _pos);
+		_pos = _end;
+	}
+	renderCycle += count * renderCyclesPerSample;
+}
+
+void MockingboardManager::RenderSegment(float* left, float* right, int count)
+{
 	uint8_t ay_ct = (bIsDual ? 4 : 2);
 	uint8_t ssi_ct = 0;
+	std::fill(left, left + count, 0.f);
+	std::fill(right, right + count, 0.f);
 	for (uint8_t ayidx = 0; ayidx < ay_ct; ayidx++)
 	{
-		ay[ayidx].Process();
-		left += ay[ayidx].left;
-		right += ay[ayidx].right;
+		ay[ayidx].ProcessBlock(left, right, count);
+		// Power only changes on register writes, so it holds for the whole segment
 		if (ssi[ayidx].IsPowered()) {
 			// speech is mono
 			++ssi_ct;
-			auto _s = ssi[ayidx].GetSample();
-			left += _s;
-			right += _s;
+			SSI263& _ssi = ssi[ayidx];
+			for (int i = 0; i < count; ++i)
+			{
+				auto _s = _ssi.GetSample();
+				left[i] += _s;
+				right[i] += _s;
+			}
 		}
 	}
-	left /= static_cast<float>(ay_ct + ssi_ct);
-	right /= static_cast<float>(ay_ct + ssi_ct);
+	// The previous mix value is carried into the next one, exactly like the
+	// per-sample mixer always did. It acts as a gentle low-pass.
+	const float _divisor = static_cast<float>(ay_ct + ssi_ct);
+	for (int i = 0; i < count; ++i)
+	{
+		mixLeft = (mixLeft + left[i]) / _divisor;
+		mixRight = (mixRight + right[i]) / _divisor;
+		left[i] = mixLeft;
+		right[i] = mixRight;
+	}
+}
+
+void MockingboardManager::CatchUpVIA(int viaidx, uint64_t cycle)
+{
+	if (cycle <= viaCycle[viaidx])
+		return;
+	// When not selected the M6522 sees CS2 high and nothing on its ports
+	M6522CatchUp(&m6522[viaidx], M6522_CS2, cycle - viaCycle[viaidx]);
+	a_pins_out[viaidx] = m6522[viaidx].pins;
+	viaCycle[viaidx] = cycle;
+}
+
+void MockingboardManager::AdvanceCycles(uint64_t cycles)
+{
+	if (!bIsEnabled)
+		return;
+	busCycle.store(busCycle.load(std::memory_order_relaxed) + cycles, std::memory_order_relaxed);
 }
 
 void MockingboardManager::EventReceived(uint16_t addr, uint8_t val, bool rw)
@@ -86,6 +342,12 @@ void MockingboardManager::EventReceived(uint16_t addr, uint8_t val, bool rw)
 	if (!bIsEnabled)
 		return;
 
+	// Every bus event is one cycle and moves time forward, even the ones that aren't for us.
+	// Counting them here instead of asking the CycleCounter keeps the timing identical
+	// when events are replayed without any video, like when rendering audio offline.
+	const uint64_t _cycle = busCycle.load(std::memory_order_relaxed) + 1;
+	busCycle.store(_cycle, std::memory_order_relaxed);
+
 	uint8_t _addrhi = addr >> 8;
 	switch (_addrhi) {
 	case 0xC4:			// first MB
@@ -98,98 +360,55 @@ void MockingboardManager::EventReceived(uint16_t addr, uint8_t val, bool rw)
 		return;
 	}
 
-
-	// Reset CS0 for all SSI chips
-	for (uint8_t ssiidx = 0; ssiidx < 4; ssiidx++)
-	{
-		ssi[ssiidx].SetCS0(0);
-	}
-
-	// M6522 STATE MACHINE - Runs every tick
+	// M6522 STATE MACHINE
+	//		Only the selected M6522 is ticked. The others aren't touched until they're
+	//		selected, at which point they're caught up on the cycles they missed.
 	//		Figure out the IN pins based on the event info
-	//		Call tick() and retrieve the OUT pins of all M6522s
-
-	uint64_t pins_in = 0;
-	pins_in = addr & 0xF;	// Pins RS0-RS3
-	if (rw == 0)
-		pins_in |= ((uint64_t)val << M6522_PIN_D0);	// Pins D0-D7
-	pins_in |= ((uint64_t)rw << M6522_PIN_RW);
-
-	for (int viaidx = 0; viaidx < 4; ++viaidx)
-	{
-		a_pins_in[viaidx] = pins_in;	// standard for all 4 chips
-		a_pins_out_prev[viaidx] = a_pins_out[viaidx];
-	}
+	//		Call tick() and retrieve the OUT pins of the M6522
 
-	// The other input pins are dependent on which M6522 is chosen
+	// The input pins that select the M6522:
 	// CS1 is A7 or !A7 (ie 0x00 or 0x80 of the address) depending on the MC6522 position in a card
 	// !IOSELECT (CS2) depends on the address (0xC4-- or 0xC5--), i.e. which card it is
 	// CA1 is an input-only pin on the M6522 which comes from the SSI263's A/!R as it finishes a phoneme
-
-	// Defaults disabled (high)
-	a_pins_in[0] |= (1ULL << M6522_PIN_CS2);
-	a_pins_in[1] |= (1ULL << M6522_PIN_CS2);
-	a_pins_in[2] |= (1ULL << M6522_PIN_CS2);
-	a_pins_in[3] |= (1ULL << M6522_PIN_CS2);
-
+	int _activeChipsIdx = -1;
 	if (_addrhi == 0xC5)
 	{
 		// FIRST MOCKINGBOARD, SLOT 5
-		a_pins_in[0] &= (~M6522_CS2);
-		a_pins_in[1] &= (~M6522_CS2);
+		_activeChipsIdx = (addr & 0x80) ? 0 : 1;
 	}
 	else if (_addrhi == 0xC4)
 	{
 		// SECOND MOCKINGBOARD, SLOT 4
 		if (this->bIsDual)
-		{
-			a_pins_in[2] &= (~M6522_CS2);
-			a_pins_in[3] &= (~M6522_CS2);
-		}
+			_activeChipsIdx = (addr & 0x80) ? 2 : 3;
 	}
 
-	if (addr & 0x80)
-	{
-		// FIRST M6522 IN EACH CARD
-		a_pins_in[0] |= (1ULL << M6522_PIN_CS1);
-		a_pins_in[2] |= (1ULL << M6522_PIN_CS1);
-	}
-	else {
-		// SECOND M6522 IN EACH CARD
-		a_pins_in[1] |= (1ULL << M6522_PIN_CS1);
-		a_pins_in[3] |= (1ULL << M6522_PIN_CS1);
-	}
-
-	int _activeChipsIdx = -1;
-	Ayumi* ayp = nullptr;
-	SSI263* ssip = nullptr;
+	// Only parse 0xC4xx or 0xC5xx events (slots 4 and 5)
+	if (_activeChipsIdx == -1)
+		return;
 
-	// Tick all the M6522s
-	// Check if we need to reset any AY chip
-	// And figure out which AY and SSI chips are active
-	for (int viaidx = 0; viaidx < 4; ++viaidx)
+	uint64_t pins_in = 0;
+	pins_in = addr & 0xF;	// Pins RS0-RS3
+	if (rw == 0)
+		pins_in |= ((uint64_t)val << M6522_PIN_D0);	// Pins D0-D7
+	pins_in |= ((uint64_t)rw << M6522_PIN_RW);
+	pins_in |= (1ULL << M6522_PIN_CS1);	// CS1 high and CS2 low is selected
+
+	// Tick the M6522 and check if we need to reset its AY chip
+	CatchUpVIA(_activeChipsIdx, _cycle - 1);
+	a_pins_out_prev[_activeChipsIdx] = a_pins_out[_activeChipsIdx];
+	a_pins_out[_activeChipsIdx] = m6522_tick(&m6522[_activeChipsIdx], pins_in);
+	viaCycle[_activeChipsIdx] = _cycle;
+	if ((a_pins_out_prev[_activeChipsIdx] & M6522_PB2) != 0)
 	{
-		a_pins_out[viaidx] = m6522_tick(&m6522[viaidx], a_pins_in[viaidx]);
-		if ((a_pins_out_prev[viaidx] & M6522_PB2) != 0)
-		{
-			// PB2 went LOW, which goes to !RESET
-			if ((a_pins_out[viaidx] & M6522_PB2) == 0)
-				ay[viaidx].ResetRegisters();
-		}
-		// CS1 && !CS2 means the chip is active
-		if (((a_pins_in[viaidx] & M6522_CS1) != 0) &&
-			((a_pins_in[viaidx] & M6522_CS2) == 0))
+		// PB2 went LOW, which goes to !RESET
+		if ((a_pins_out[_activeChipsIdx] & M6522_PB2) == 0)
 		{
-			_activeChipsIdx = viaidx;
-			ayp = &ay[viaidx];
-			ssip = &ssi[viaidx];
+			PushBusEvent(MBOp_e::AY_RESET, _activeChipsIdx, 0, 0);
+			memset(ay_registers[_activeChipsIdx], 0, sizeof(ay_registers[_activeChipsIdx]));
 		}
 	}
 
-	// Only parse 0xC4xx or 0xC5xx events (slots 4 and 5)
-	if (_activeChipsIdx == -1)
-		return;
-
 	// 
 	// All below code doesn't tick but instead responds only on specific events
 	// 
@@ -227,7 +446,9 @@ void MockingboardManager::EventReceived(uint16_t addr, uint8_t val, bool rw)
 		// Apple 2 it would be horribly late
 		break;
 	case A2MBC_WRITE:
-		SetLatchedRegister(ayp, ay_value);
+		PushBusEvent(MBOp_e::AY_WRITE, _activeChipsIdx, latched_register[_activeChipsIdx], ay_value);
+		if (latched_register[_activeChipsIdx] < 16)
+			ay_registers[_activeChipsIdx][latched_register[_activeChipsIdx]] = ay_value;
 		// std::cerr << "Setting Register value: " << (int)ay_value << std::endl;
 		break;
 	case A2MBC_LATCH:
@@ -237,7 +458,7 @@ void MockingboardManager::EventReceived(uint16_t addr, uint8_t val, bool rw)
 		// within a few tens of thousands of cycles before they decay to zero.
 		if (ay_value <= 0xFF)
 		{
-			ayp->latched_register = ay_value;
+			latched_register[_activeChipsIdx] = ay_value;
 			// std::cerr << "Latching register: " << (int)ay_value << std::endl;
 		}
 		break;
@@ -245,22 +466,22 @@ void MockingboardManager::EventReceived(uint16_t addr, uint8_t val, bool rw)
 		break;
 	}
 
-	// Update the valid SSI chip
-	if (ssip->IsEnabled())
-	{
-		ssip->SetData(val);
-		ssip->SetRegisterSelect(addr);
-		ssip->SetReadMode(rw);
-		ssip->SetCS0(1);
-		ssip->Update();
-	}
+	// Update the valid SSI chip. Reads never load a register.
+	if (!rw)
+		PushBusEvent(MBOp_e::SSI_WRITE, _activeChipsIdx, addr & 0b111, val);
 }
 
 void MockingboardManager::SetPan(uint8_t ay_idx, uint8_t channel_idx, double pan, bool isEqp)
 {
 	if (ay_idx > 3)
 		return;
-	ay[ay_idx].SetPan(channel_idx, pan, isEqp);
+	MBRegisterEvent _event;
+	_event.op = MBOp_e::AY_PAN;
+	_event.chip = ay_idx;
+	_event.reg = channel_idx;
+	_event.pan = (float)pan;
+	_event.isEqp = isEqp;
+	PushControlEvent(_event);
 	allpans[ay_idx][channel_idx] = (float)pan;
 }
 
@@ -274,9 +495,9 @@ void MockingboardManager::UpdateAllPans()
 	}
 }
 
-void MockingboardManager::SetLatchedRegister(Ayumi* ayp, uint8_t value)
+void MockingboardManager::SetRegister(Ayumi* ayp, uint8_t reg, uint8_t value)
 {
-	switch (ayp->latched_register) {
+	switch (reg) {
 		case A2MBAYR_ATONEFINE:
 			ayp->SetTone(0, (ayp->channels[0].tone_period & 0xFF00) + value);
 			break;
@@ -340,35 +561,28 @@ void MockingboardManager::SetLatchedRegister(Ayumi* ayp, uint8_t value)
 
 // UTILITY METHODS
 // These methods are unnecessary for regular operation on SDD where only events are received
-// Every time we send an event, make sure the !RESET bit (bit 2) is high
+// They run on the main thread, so they skip the M6522s and queue the chip writes directly
 
 void MockingboardManager::Util_Reset(uint8_t ay_idx)
 {
 	if (ay_idx > 3)
 		return;
-	uint16_t slot = (ay_idx < 2 ? 0xC400 : 0xC500);
-	uint16_t offset = slot + (ay_idx * 0x80);
-	
-	EventReceived(offset+A2MBE_ORB, 0, 0);	// Reset (bit 2 is 0)
-	EventReceived(offset+A2MBE_ORB, 0b100 | A2MBC_INACTIVE, 0);
+	MBRegisterEvent _event;
+	_event.op = MBOp_e::AY_RESET;
+	_event.chip = ay_idx;
+	PushControlEvent(_event);
 }
 
 void MockingboardManager::Util_WriteToRegister(uint8_t ay_idx, uint8_t reg_idx, uint8_t val)
 {
 	if (ay_idx > 3)
 		return;
-	uint16_t slot = (ay_idx < 2 ? 0xC400 : 0xC500);
-	uint16_t offset = slot + ((ay_idx % 2) * 0x80);
-	
-	// Latch the register
-	EventReceived(offset+A2MBE_ORA, reg_idx, 0);
-	EventReceived(offset+A2MBE_ORB, 0b100 | A2MBC_LATCH, 0);
-	EventReceived(offset+A2MBE_ORB, 0b100 | A2MBC_INACTIVE, 0);
-	
-	// Write
-	EventReceived(offset+A2MBE_ORA, val, 0);
-	EventReceived(offset+A2MBE_ORB, 0b100 | A2MBC_WRITE, 0);
-	EventReceived(offset+A2MBE_ORB, 0b100 | A2MBC_INACTIVE, 0);
+	MBRegisterEvent _event;
+	_event.op = MBOp_e::AY_WRITE;
+	_event.chip = ay_idx;
+	_event.reg = reg_idx;
+	_event.value = val;
+	PushControlEvent(_event);
 }
 
 void MockingboardManager::Util_WriteAllRegisters(uint8_t ay_idx, uint8_t* val_array)
@@ -444,17 +658,35 @@ void MockingboardManager::Util_SpeakDemoPhrase()
 //		0xE8, 0x7B, 0xA8, 0x47, 0xFF,	// LB
 	};
 	// The active SSI263 chip is at index 1
-	ssi[1].ResetRegisters();
+	auto _ssiWrite = [this](uint8_t reg, uint8_t value) {
+		MBRegisterEvent _event;
+		_event.op = MBOp_e::SSI_WRITE;
+		_event.chip = 1;
+		_event.reg = reg;
+		_event.value = value;
+		PushControlEvent(_event);
+	};
+	// The writes are applied by the audio callback, wait until it has done so.
+	// Give up after a second in case the audio device isn't running.
+	auto _waitForAudioThread = [this]() {
+		for (int _ms = 0; (_ms < 1000) && !controlEvents.empty(); ++_ms)
+			SDL_Delay(1);
+	};
+	MBRegisterEvent _resetEvent;
+	_resetEvent.op = MBOp_e::SSI_RESET;
+	_resetEvent.chip = 1;
+	PushControlEvent(_resetEvent);
 	// Raise CTL, set TRANSITIONED_INFLECTION, and lower CTL
-	EventReceived(0xC443, 0x80, 0);	// Reg 3, raise CTL
-	EventReceived(0xC440, 0xC0, 0);	// Set TRANSITIONED_INFLECTION
-	EventReceived(0xC443, 0x70, 0);	// Reg 3, lower CTL
+	_ssiWrite(3, 0x80);	// Reg 3, raise CTL
+	_ssiWrite(0, 0xC0);	// Set TRANSITIONED_INFLECTION
+	_ssiWrite(3, 0x70);	// Reg 3, lower CTL
 
 	for (auto i=0; i < sizeof(phrase); i+=5) {
 		for (auto j=0; j < 5; ++j)
 		{
-			EventReceived(0xC440 + (4-j), phrase[i+j], 0);
+			_ssiWrite(4-j, phrase[i+j]);
 		}
+		_waitForAudioThread();
 
 		if (i < sizeof(phrase))
 		{
@@ -468,7 +700,7 @@ void MockingboardManager::Util_SpeakDemoPhrase()
 			}
 		}
 	}
-	EventReceived(0xC443, 0x80, 0);
+	_ssiWrite(3, 0x80);
 }
 ///
 ///
@@ -487,6 +719,12 @@ void MockingboardManager::DisplayImGuiChunk()
 			this->Initialize();
 		 */
 		ImGui::Text("Mockingboard Events: %d", mb_event_count);
+		ImGui::Text("Queued Register Writes: %zu", busEvents.size());
+		ImGui::Text("Dropped Register Writes: %llu", (unsigned long long)(busEvents.dropped() + controlEvents.dropped()));
+		ImGui::Text("Bus Resyncs: %u", resyncCount.load());
+		ImGui::Text("Bus Clock Drift: %.1f ppm", renderDriftPPM.load(std::memory_order_relaxed));
+		ImGui::Text("Render Latency: %.1f ms (target %.1f ms)", 1000.f * GetMeasuredLatency() / sampleRate,
+			1000.f * renderLatencySamples / sampleRate);
 	}
 	
 	ImGui::SeparatorText("[ CHANNEL PANNING ]");
@@ -531,7 +769,59 @@ void MockingboardManager::DisplayImGuiChunk()
 		allpans[3][0] = 0.8f;
 		allpans[3][1] = 0.8f;
 		allpans[3][2] = 0.8f;
-		UpdateAllPans();
+		bPansAreStale = true;
+	}
+}
+
+std::string MockingboardManager::SerializeRegisters() const {
+	uint8_t _data[4 * (sizeof(m6522_t) + 2 * sizeof(uint64_t)) + sizeof(latched_register) + sizeof(ay_registers)];
+	return std::string(reinterpret_cast<const char*>(_data), SerializeRegisters(_data));
+}
+
+size_t MockingboardManager::SerializeRegisters(uint8_t* data) const {
+	uint8_t* _p = data;
+	const uint64_t _busCycle = busCycle.load(std::memory_order_relaxed);
+	for (uint8_t viaidx = 0; viaidx < 4; viaidx++)
+	{
+		// The bus cycle keeps counting up, only how far behind it each M6522 is matters
+		const uint64_t _behind = _busCycle - viaCycle[viaidx];
+		memcpy(_p, &m6522[viaidx], sizeof(m6522[viaidx]));
+		_p += sizeof(m6522[viaidx]);
+		memcpy(_p, &a_pins_out[viaidx], sizeof(a_pins_out[viaidx]));
+		_p += sizeof(a_pins_out[viaidx]);
+		memcpy(_p, &_behind, sizeof(_behind));
+		_p += sizeof(_behind);
+	}
+	memcpy(_p, latched_register, sizeof(latched_register));
+	_p += sizeof(latched_register);
+	memcpy(_p, ay_registers, sizeof(ay_registers));
+	_p += sizeof(ay_registers);
+	return _p - data;
+}
+
+void MockingboardManager::DeserializeRegisters(const std::string& data) {
+	constexpr size_t _size = 4 * (sizeof(m6522_t) + 2 * sizeof(uint64_t)) + sizeof(latched_register) + sizeof(ay_registers);
+	if (data.size() != _size)
+		return;
+	std::istringstream in(data);
+	const uint64_t _busCycle = busCycle.load(std::memory_order_relaxed);
+	for (uint8_t viaidx = 0; viaidx < 4; viaidx++)
+	{
+		uint64_t _behind = 0;
+		in.read(reinterpret_cast<char*>(&m6522[viaidx]), sizeof(m6522[viaidx]));
+		in.read(reinterpret_cast<char*>(&a_pins_out[viaidx]), sizeof(a_pins_out[viaidx]));
+		in.read(reinterpret_cast<char*>(&_behind), sizeof(_behind));
+		a_pins_out_prev[viaidx] = a_pins_out[viaidx];
+		viaCycle[viaidx] = _busCycle - std::min(_behind, _busCycle);
+	}
+	in.read(reinterpret_cast<char*>(latched_register), sizeof(latched_register));
+	in.read(reinterpret_cast<char*>(ay_registers), sizeof(ay_registers));
+	// Bring the AYs to the same state, through the queue like any other bus write
+	for (uint8_t ayidx = 0; ayidx < 4; ayidx++)
+	{
+		PushBusEvent(MBOp_e::AY_RESET, ayidx, 0, 0);
+		for (uint8_t reg = 0; reg <= A2MBAYR_ESHAPE; reg++)
+			PushBusEvent(MBOp_e::AY_WRITE, ayidx, reg, ay_registers[ayidx][reg]);
 	}
 }
 
@@ -573,5 +863,5 @@ void MockingboardManager::DeserializeState(const nlohmann::json &jsonState)
 	allpans[3][0] = jsonState.value("pan_ay_3_0", allpans[3][0]);
 	allpans[3][1] = jsonState.value("pan_ay_3_1", allpans[3][1]);
 	allpans[3][2] = jsonState.value("pan_ay_3_2", allpans[3][2]);
-	UpdateAllPans();
+	bPansAreStale = true;
 }
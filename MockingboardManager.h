@@ -17,12 +17,27 @@
 	* In both cases of MB-A and RM-2.1, AY1 is _significantly_ more powerful than AY2
 	* and outputs close to 4x the dB of AY2. If the AY2 pot in MB-A is at max, then to
 	* balance out AY1 its pot needs to be at 1/4.
+	*
+	* Threading:
+	* EventReceived() runs on the bus thread (USB or replay). It only decodes the M6522s
+	* and never touches the sound chips. Each resulting chip register write is pushed
+	* onto a lock-free queue, stamped with the bus cycle it happened on. The audio
+	* callback renders whole blocks with GetSamplesBlock() and applies each write at
+	* the sample matching its cycle, so the chips are only ever touched by the audio
+	* thread. Writes coming from the main thread (test utilities, panning, resets) go
+	* through a second queue and are applied at the start of the next block.
+	* The rendered audio runs a fixed latency behind the bus, set by the SoundManager. The bus and the
+	* audio device have their own clocks, so the render position advances slightly faster
+	* or slower than real time to hold that latency.
  */
 
 #include <stdio.h>
 #include <SDL.h>
+#include <atomic>
 #include "Ayumi.h"
 #include "SSI263.h"
+#include "SPSCQueue.h"
+#include "DriftController.h"
 #include "nlohmann/json.hpp"
 #include "common.h"
 
@@ -67,6 +82,33 @@ enum A2MBAYRegisters_e
 	A2MBAYR_ESHAPE
 };
 
+constexpr uint32_t MM_EVENT_QUEUE_SIZE = 8192;			// bus register writes in flight, power of 2
+constexpr uint32_t MM_CONTROL_QUEUE_SIZE = 1024;		// main thread register writes in flight, power of 2
+constexpr int64_t MM_RENDER_LATENCY_SAMPLES = 512;		// default for how far behind the bus the audio is rendered
+constexpr int64_t MM_RESYNC_THRESHOLD_SAMPLES = 2048;	// minimum drift from the latency target before resyncing
+
+// Sound chip operations queued for the audio thread
+enum class MBOp_e : uint8_t
+{
+	AY_WRITE = 0,	// reg/value
+	AY_RESET,
+	AY_SILENCE,		// set all channel volumes to 0
+	AY_PAN,			// reg is the channel, pan/isEqp
+	SSI_WRITE,		// reg is RS2-RS0, value is D7-D0
+	SSI_RESET,
+};
+
+struct MBRegisterEvent
+{
+	uint64_t cycle = 0;		// bus cycle of the write, ignored for main thread events
+	MBOp_e op = MBOp_e::AY_WRITE;
+	uint8_t chip = 0;
+	uint8_t reg = 0;
+	uint8_t value = 0;
+	float pan = 0.f;
+	bool isEqp = false;
+};
+
 class MockingboardManager {
 public:
 	~MockingboardManager();
@@ -81,9 +123,23 @@ public:
 	
 	// Received a mockingboard event, we don't care if it's C4XX or C5XX
 	void EventReceived(uint16_t addr, uint8_t val, bool rw);
+	// Idle cycles without any event, the M6522s are caught up when next selected
+	void AdvanceCycles(uint64_t cycles);
 	
-	// Audio callback
-	void GetSamples(float& left, float& right);
+	// Audio callback. Renders count stereo samples into the left and right buffers,
+	// applying the queued register writes as their cycles come up.
+	void GetSamplesBlock(float* left, float* right, int count);
+	// Audio callback when not rendering. Applies everything queued right away so
+	// the chips stay in sync and the queues don't overflow.
+	void ApplyPendingEvents();
+	// Output sample rate and how far behind the bus to render, in samples.
+	// Only call it when the audio callback isn't running.
+	void SetAudioFormat(uint32_t sampleRate, uint32_t latencySamples);
+	// Sets PAL (true) or NTSC (false). The AYs are clocked by the Apple 2, and the bus
+	// cycles of the register writes are turned into sample positions at its frequency.
+	void SetPAL(bool isPal);
+	// How far behind the bus the audio is actually being rendered, in samples
+	float GetMeasuredLatency() { return renderLatencyLevel.load(std::memory_order_relaxed); };
 	
 	// Set the panning of a channel in an AY
 	// Pan is 0.0-1.0, left to right
@@ -112,6 +168,13 @@ public:
 	nlohmann::json SerializeState();
 	void DeserializeState(const nlohmann::json &jsonState);
 	
+	// De/serialization of the M6522s and AY registers, for replay keyframes.
+	// Bus thread only. The AYs get their registers written back, the SSI263s aren't restored.
+	// The pointer version writes the same bytes without allocating, and returns their size.
+	std::string SerializeRegisters() const;
+	size_t SerializeRegisters(uint8_t* data) const;
+	void DeserializeRegisters(const std::string& data);
+	
 	// public singleton code
 	static MockingboardManager* GetInstance()
 	{
@@ -124,7 +187,15 @@ private:
 	MockingboardManager(uint32_t sampleRate);
 	
 	void UpdateAllPans();
-	void SetLatchedRegister(Ayumi* ayp, uint8_t value);
+	void SetRegister(Ayumi* ayp, uint8_t reg, uint8_t value);
+	void PushBusEvent(MBOp_e op, uint8_t chip, uint8_t reg, uint8_t value);
+	void PushControlEvent(const MBRegisterEvent& event);
+	void ApplyEvent(const MBRegisterEvent& event);
+	void ApplyControlEvents();
+	void UpdateRates();
+	int64_t GetEventSampleIndex(const MBRegisterEvent& event);
+	void RenderSegment(float* left, float* right, int count);
+	void CatchUpVIA(int viaidx, uint64_t cycle);	// ticks an M6522 up to the given bus cycle
 	
 	uint32_t sampleRate;
 	uint32_t bufferSize;
@@ -133,14 +204,37 @@ private:
 	bool bIsPlaying;
 	int mb_event_count = 0;
 	
-	// Chips
+	// Chips, only touched by the audio thread once playing
 	Ayumi ay[4];
 	SSI263 ssi[4];
 	
-	// M6522 pin state
-	uint64_t a_pins_in[4] = { 0 };
+	// Register write queues
+	SPSCQueue<MBRegisterEvent, MM_EVENT_QUEUE_SIZE> busEvents;			// bus thread -> audio thread
+	SPSCQueue<MBRegisterEvent, MM_CONTROL_QUEUE_SIZE> controlEvents;	// main thread -> audio thread
+	std::atomic<uint64_t> busCycle{ 0 };		// bus events received, one per cycle
+	std::atomic<bool> bPansAreStale{ true };	// audio thread must reapply allpans
+	std::atomic<bool> bIsPAL{ false };
+	std::atomic<bool> bRatesAreStale{ false };	// audio thread must reapply the clock rates
+	uint8_t latched_register[4] = { 0 };		// AY latched registers, bus thread side
+	uint8_t ay_registers[4][16] = { { 0 } };	// last values written to the AYs, bus thread side
+	
+	// Audio thread block timing
+	double cyclesPerSample;
+	double renderCycle = 0.0;				// bus cycle of the next sample to render
+	double renderCyclesPerSample;			// cyclesPerSample adjusted for the clock drift
+	uint32_t renderLatencySamples = MM_RENDER_LATENCY_SAMPLES;
+	DriftController renderDrift{ MM_RENDER_LATENCY_SAMPLES };
+	std::atomic<float> renderDriftPPM{ 0.f };	// for ImGui
+	std::atomic<float> renderLatencyLevel{ 0.f };	// for ImGui
+	uint64_t renderLastBusCycle = 0;		// busCycle seen at the previous block
+	float mixLeft = 0.f;
+	float mixRight = 0.f;
+	std::atomic<uint32_t> resyncCount{ 0 };
+	
+	// M6522 state, bus thread side
 	uint64_t a_pins_out[4] = { 0 };
 	uint64_t a_pins_out_prev[4] = { 0 };
+	uint64_t viaCycle[4] = { 0 };			// bus cycle each M6522 has been ticked up to
 	
 	float allpans[4][3] = {
 		{0.3f, 0.3f, 0.3f},	// AY0 pans left
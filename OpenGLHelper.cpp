@@ -113,13 +113,15 @@ void OpenGLHelper::ImageAsset::AssignByFilename(const char* filename) {
 //////////////////////////////////////////////////////////////////////////
 
 // Sets the correct gl version and returns the glsl version string
-void OpenGLHelper::set_gl_version()
+void OpenGLHelper::set_gl_version(bool bConfigureSDL)
 {
 	// Decide GL+GLSL versions
 #if defined(IMGUI_IMPL_OPENGL_ES2)
 	// GL ES 3.0 + GLSL 300 es
 	// ImGui only supports 3.0, not 3.1
 	glsl_version = "#version 300 es";
+	if (!bConfigureSDL)
+		return;
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, 0);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_ES);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
@@ -127,6 +129,8 @@ void OpenGLHelper::set_gl_version()
 #elif defined(__APPLE__)
 	// GL 4.1 Core + GLSL 410
 	glsl_version = "#version 410";
+	if (!bConfigureSDL)
+		return;
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG); // Always required on Mac
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
@@ -134,6 +138,8 @@ void OpenGLHelper::set_gl_version()
 #else
 	// GL 4.1 Core + GLSL 410
 	glsl_version = "#version 410";
+	if (!bConfigureSDL)
+		return;
 	if (SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, 0) != 0)
 		std::cerr << "SDL Error: " << SDL_GetError() << std::endl;
 	if (SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE) != 0)
@@ -227,6 +233,10 @@ bool OpenGLHelper::are_matrices_approx_equal(const glm::mat4& m1, const glm::mat
 bool OpenGLHelper::SaveFramebufferToFile(const std::string& filename, bool bUsePNG) {
 	int _w = 0, _h = 0;
 	SDL_GL_GetDrawableSize(Main_GetSDLWindow(), &_w, &_h);
+	return SaveFramebufferToFile(0, _w, _h, filename, bUsePNG, false);
+}
+
+bool OpenGLHelper::SaveFramebufferToFile(GLuint fbo, int _w, int _h, const std::string& filename, bool bUsePNG, bool bWait) {
 	if (_w <= 0 || _h <= 0) return false;
 
 	// Read RGBA pixels from the back framebuffer
@@ -234,7 +244,10 @@ bool OpenGLHelper::SaveFramebufferToFile(const std::string& filename, bool bUseP
 	// If we were to use the front framebuffer it'd have the menu in it
 	std::vector<GLubyte> pixels(static_cast<size_t>(_w) * static_cast<size_t>(_h) * 4);
 
-	glReadBuffer(GL_BACK);
+	GLint _oldReadFBO = 0;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &_oldReadFBO);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glReadBuffer(fbo == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
 
 	// Ensure tight packing (no 4-byte alignment padding beyond stride = _w*4)
 	GLint oldPack = 0;
@@ -242,6 +255,7 @@ bool OpenGLHelper::SaveFramebufferToFile(const std::string& filename, bool bUseP
 	glPixelStorei(GL_PACK_ALIGNMENT, 1);
 	glReadPixels(0, 0, _w, _h, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
 	glPixelStorei(GL_PACK_ALIGNMENT, oldPack);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, _oldReadFBO);
 
 	GLenum glerr;
 	if ((glerr = glGetError()) != GL_NO_ERROR) {
@@ -252,7 +266,7 @@ bool OpenGLHelper::SaveFramebufferToFile(const std::string& filename, bool bUseP
 	// Wrap the rest of the code in a thread because the PNG compression can be quite expensive
 	// and a Raspberry Pi will take hundreds of milliseconds to process a 1080p image
 
-	std::thread([filename, bUsePNG, w = _w, h = _h, px = std::move(pixels)]() mutable {
+	std::thread _writer([filename, bUsePNG, w = _w, h = _h, px = std::move(pixels)]() mutable {
 		// Flip rows because OpenGL’s origin is bottom-left and PNG/top-left tools expect top-left
 		for (int y = 0; y < h / 2; ++y) {
 			int idx1 = y * w * 4;
@@ -297,7 +311,12 @@ bool OpenGLHelper::SaveFramebufferToFile(const std::string& filename, bool bUseP
 				SDL_FreeSurface(surface);
 			}
 		}
-	}).detach();
+	});
+	// bWait is for when the app may exit right after, which would kill a detached writer
+	if (bWait)
+		_writer.join();
+	else
+		_writer.detach();
 
 	return true;
 }
@@ -28,13 +28,15 @@ public:
 		GLuint tex_id = UINT_MAX;	// Texture ID on the GPU that holds the image data
 	};
 
-	void set_gl_version();	// must be called after SDL_Init()
+	void set_gl_version(bool bConfigureSDL = true);	// must be called after SDL_Init(), unless bConfigureSDL is false
 	const std::string* get_glsl_version();	// returns the glsl version string
 	void load_texture(unsigned char* data, int width, int height, int nrComponents, GLuint textureID);
 	GLuint get_texture_id_at_slot(int slot);	// returns the opengl-generated texture id for this tex slot
 	glm::vec2 get_dpi_scaling_factors(SDL_Window* window);		// returns the scaling of width and height for high dpi screens
 	bool are_matrices_approx_equal(const glm::mat4& m1, const glm::mat4& m2, float epsilon = 1e-5f);
 	bool SaveFramebufferToFile(const std::string& filename, bool bUsePNG = false);
+	// Same as above for any framebuffer of size w x h. If bWait, only returns once the file is written
+	bool SaveFramebufferToFile(GLuint fbo, int w, int h, const std::string& filename, bool bUsePNG, bool bWait);
 	bool SaveTextureInSlotToFile(GLuint slot, const std::string& filename, bool bUsePNG = false);
 	bool SaveTextureToFile(GLuint tex, const std::string& filename, bool bUsePNG = false);
 	std::string GetScreenshotSaveFilePath();
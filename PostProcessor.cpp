@@ -12,6 +12,9 @@
 // below because "The declaration of a static data member in its class definition is not a definition"
 PostProcessor* PostProcessor::s_instance;
 
+// In main.cpp, to know if the direct copy would look the same as the blended quad
+extern void Main_GetBGColor(float outColor[4]);
+
 // The PostProcessor will take any texture that's in slot _PP_INPUT_TEXTURE_UNIT and apply the
 // postprocessing shader on it.
 // It always dynamically calculates the texture's size and properly scales it up in integer steps
@@ -25,6 +28,8 @@ PostProcessor* PostProcessor::s_instance;
 // To make it more optimal for low end devices that may not approve of the full shader,
 // the passthrough mode uses a basic passthrough shader instead of the full one,
 // although the full shader can handle passthrough as well.
+// And when the passthrough has nothing to do (no zoom, no offset, no frame merging),
+// it skips the shader entirely and blits the input texture straight to the screen.
 
 //////////////////////////////////////////////////////////////////////////
 // Basic singleton methods
@@ -106,6 +111,10 @@ PostProcessor::~PostProcessor()
 		glDeleteTextures(1, &prevFrame_texture_id);
 	}
 	FBO_prevFrame = UINT_MAX;
+
+	if (FBO_blitSource != UINT_MAX)
+		glDeleteFramebuffers(1, &FBO_blitSource);
+	FBO_blitSource = UINT_MAX;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -424,7 +433,7 @@ void PostProcessor::RegeneratePreviousTexture()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tA2Quad.w, tA2Quad.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, prevFrame_texture_id, 0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0); // Unbind FBO
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFBO); // Unbind FBO
 	// Always bind the previous frame texture to its dedicated texture unit
 	glActiveTexture(_TEXUNIT_PP_PREVIOUS);
 	glBindTexture(GL_TEXTURE_2D, prevFrame_texture_id);
@@ -435,6 +444,103 @@ void PostProcessor::RegeneratePreviousTexture()
 	}
 }
 
+bool PostProcessor::IsPreviousFrameNeeded()
+{
+	return ((p_f_ghostingPercent > 0.0000001f && p_i_postprocessingLevel > 1) || bHalveFramerate);
+}
+
+// The CRT shader is a copy when all its effects are neutral. It moves the sampling point
+// towards the texel center (Quillez), but with integer scaling and the NEAREST mag filter
+// it stays in the same texel. The thresholds are the shader's.
+bool PostProcessor::IsCRTPassNeutral()
+{
+	if (bCRTFillWindow)
+		return false;	// stretched, not integer-scaled
+	if ((p_f_ghostingPercent > 0.0001f) || (p_f_phosphorBlur > 0.001f))
+		return false;
+	if ((p_v_warp != glm::vec2(0.0f, 0.0f)) || (p_f_barrelDistortion != 0.0f) || (p_f_corner / 10000 > 0.000001f))
+		return false;
+	if ((p_f_cStr > 0.0001f) && ((std::abs(p_f_convR) + std::abs(p_f_convG) + std::abs(p_f_convB)) > 0.001f))
+		return false;
+	switch (p_i_scanlineType)
+	{
+	case 0:
+		break;
+	case 2:
+		if ((p_f_scanlineWeight > 0.00001f) || (p_f_vignetteWeight > 0.00001f)
+			|| (p_f_interlace != 0.0f) || (p_f_filmGrain != 0.0f))
+			return false;
+		break;
+	default:
+		return false;
+	}
+	// Without the slot mask the masks darken by 0.3. With it, they're neutral when
+	// MASKL and MASKH are 1, whatever the mask type.
+	if (p_b_slot ? ((p_f_maskLow != 1.0f) || (p_f_maskHigh != 1.0f)) : (p_i_maskType != 0))
+		return false;
+	if ((p_f_black != 0.0f) || (p_f_contrast != 1.0f) || (p_f_saturation != 1.0f) || (p_f_brightness != 1.0f))
+		return false;
+	if ((p_f_hue != 0.0f) || (p_f_hueRG != 0.0f) || (p_f_hueRB != 0.0f) || (p_f_hueGB != 0.0f))
+		return false;
+	return (p_i_cSpace == 0);
+}
+
+bool PostProcessor::IsIdentityPass()
+{
+	if (bHalveFramerate)
+		return false;
+	if ((p_i_postprocessingLevel == 1) || ((p_i_postprocessingLevel > 1) && !IsCRTPassNeutral()))
+		return false;
+	if ((p_v_zoom != glm::vec2(1.0f, 1.0f)) || (p_v_center != glm::vec2(0.0f, 0.0f)))
+		return false;
+	// The blit ignores alpha blending. Any transparent part of the A2 texture
+	// would show as black instead of the window background color.
+	float _bgColor[4];
+	Main_GetBGColor(_bgColor);
+	return ((_bgColor[0] == 0.f) && (_bgColor[1] == 0.f) && (_bgColor[2] == 0.f));
+}
+
+// Copies the input texture to the center of the output framebuffer with integer scaling.
+// Same result as the passthrough shader, without running any shader.
+void PostProcessor::BlitInputToScreen()
+{
+	glActiveTexture(texUnitCurrent);
+	GLint _texId = 0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &_texId);
+	glActiveTexture(GL_TEXTURE0);
+
+	if (FBO_blitSource == UINT_MAX)
+		glGenFramebuffers(1, &FBO_blitSource);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO_blitSource);
+	if (blitSourceTexId != _texId)
+	{
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _texId, 0);
+		blitSourceTexId = _texId;
+	}
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, outputFBO);
+
+	// The quad samples the A2 texture upside down, so flip Y on the destination
+	GLint _x0 = (viewportWidth - quadWidth) / 2;
+	GLint _y0 = (viewportHeight - quadHeight) / 2;
+	glBlitFramebuffer(0, 0, texWidth, texHeight,
+		_x0, _y0 + quadHeight, _x0 + quadWidth, _y0,
+		GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
+
+	GLenum glerr;
+	if ((glerr = glGetError()) != GL_NO_ERROR) {
+		std::cerr << "OpenGL error PP BlitInputToScreen: " << glerr << std::endl;
+	}
+}
+
+void PostProcessor::SetOutputFramebuffer(GLuint fbo, GLint width, GLint height)
+{
+	outputFBO = fbo;
+	outputWidth = width;
+	outputHeight = height;
+}
+
 void PostProcessor::Render(SDL_Window* window, GLuint inputTextureSlot, GLuint scanlineCount)
 {
 	if (bezelImageAsset.tex_id == UINT_MAX)
@@ -445,7 +551,14 @@ void PostProcessor::Render(SDL_Window* window, GLuint inputTextureSlot, GLuint s
 			LoadSelectedBezel();
 	}
 
-	SDL_GL_GetDrawableSize(window, &viewportWidth, &viewportHeight);
+	if (outputFBO != 0)
+	{
+		viewportWidth = outputWidth;
+		viewportHeight = outputHeight;
+	}
+	else {
+		SDL_GL_GetDrawableSize(window, &viewportWidth, &viewportHeight);
+	}
 
 	GLint last_viewport[4]; glGetIntegerv(GL_VIEWPORT, last_viewport);
 	// Don't let the viewport have odd values. It creates artifacts when scaling
@@ -514,59 +627,74 @@ void PostProcessor::Render(SDL_Window* window, GLuint inputTextureSlot, GLuint s
 	float scaleY = (quadHeight / static_cast<float>(viewportHeight));
 	_transform = glm::scale(_transform, glm::vec3(scaleX*p_v_zoom.x, scaleY*p_v_zoom.y, 1.0f));
 	_transform = glm::translate(_transform, glm::vec3(p_v_center.x/100.f, p_v_center.y/100.f, 0.0f));
-	if ((_transform != mTransform)
-		|| (FBO_prevFrame == UINT_MAX))
+	if (_transform != mTransform)
 	{
 		// std::cerr << "regenerating transform" << std::endl;
 		mTransform = _transform;
+		bPrevFrameIsStale = true;
+	}
+	// The previous frame texture is only regenerated when ghosting or frame merging will use it
+	if (bPrevFrameIsStale && IsPreviousFrameNeeded())
+	{
 		RegeneratePreviousTexture();
+		bPrevFrameIsStale = false;
 	}
 
-	if (bImguiWindowIsOpen || (!shaderProgram.isReady)
-		|| (prev_texWidth != texWidth) || (prev_texHeight != texHeight))
+	bIdentityPassActive = IsIdentityPass();
+	if (bIdentityPassActive)
 	{
-		// only update the shader parameters in certain cases
-		// as it may be very costly for rPi and slow CPUs
-		this->SelectShader();
-		prev_texWidth = texWidth;
-		prev_texHeight = texHeight;
-		if ((glerr = glGetError()) != GL_NO_ERROR) {
-			std::cerr << "OpenGL error PP shaderProgram select: " << glerr << std::endl;
-		}
+		BlitInputToScreen();
+		bShaderNeedsSelect = true;	// uniforms weren't kept up to date while blitting
 	}
 	else
 	{
-		shaderProgram.Use();
-		if ((glerr = glGetError()) != GL_NO_ERROR) {
-			std::cerr << "OpenGL error PP shaderProgram use: " << glerr << std::endl;
+		if (bImguiWindowIsOpen || (!shaderProgram.isReady) || bShaderNeedsSelect
+			|| (prev_texWidth != texWidth) || (prev_texHeight != texHeight))
+		{
+			// only update the shader parameters in certain cases
+			// as it may be very costly for rPi and slow CPUs
+			this->SelectShader();
+			bShaderNeedsSelect = false;
+			prev_texWidth = texWidth;
+			prev_texHeight = texHeight;
+			if ((glerr = glGetError()) != GL_NO_ERROR) {
+				std::cerr << "OpenGL error PP shaderProgram select: " << glerr << std::endl;
+			}
+		}
+		else
+		{
+			shaderProgram.Use();
+			if ((glerr = glGetError()) != GL_NO_ERROR) {
+				std::cerr << "OpenGL error PP shaderProgram use: " << glerr << std::endl;
+			}
 		}
-	}
 
-	// Used for all PP shaders
-	shaderProgram.SetUniform("uTransform", mTransform);		// in the vertex shader
-	shaderProgram.SetUniform("A2TextureCurrent", texUnitCurrent - GL_TEXTURE0);
-	shaderProgram.SetUniform("PreviousFrame", _TEXUNIT_PP_PREVIOUS - GL_TEXTURE0);
-	shaderProgram.SetUniform("iFrameCount", frame_count);
-	shaderProgram.SetUniform("bHalveFrameRate", bHalveFramerate);
-	// Only used for the full PP shader
-	if (p_i_postprocessingLevel > 1) {
-		shaderProgram.SetUniform("OutputSize", glm::vec2(quadWidth, quadHeight));
-		shaderProgram.SetUniform("ScanlineCount", scanlineCount);
-	}
+		// Used for all PP shaders
+		shaderProgram.SetUniform("uTransform", mTransform);		// in the vertex shader
+		shaderProgram.SetUniform("A2TextureCurrent", texUnitCurrent - GL_TEXTURE0);
+		shaderProgram.SetUniform("PreviousFrame", _TEXUNIT_PP_PREVIOUS - GL_TEXTURE0);
+		shaderProgram.SetUniform("iFrameCount", frame_count);
+		shaderProgram.SetUniform("bHalveFrameRate", bHalveFramerate);
+		// Only used for the full PP shader
+		if (p_i_postprocessingLevel > 1) {
+			shaderProgram.SetUniform("OutputSize", glm::vec2(quadWidth, quadHeight));
+			shaderProgram.SetUniform("ScanlineCount", scanlineCount);
+		}
 
-	// Bind the quad VAO and draw the quad (static VBO already set up)
-	glBindVertexArray(quadVAO);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
+		// Bind the quad VAO and draw the quad (static VBO already set up)
+		glBindVertexArray(quadVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
 
-	if ((glerr = glGetError()) != GL_NO_ERROR) {
-		std::cerr << "OpenGL error PP 2: " << glerr << std::endl;
-	}
+		if ((glerr = glGetError()) != GL_NO_ERROR) {
+			std::cerr << "OpenGL error PP 2: " << glerr << std::endl;
+		}
+	}	// !bIdentityPassActive
 
 	/////////////////////////// BEGIN PREVIOUS FRAME TEXTURE ///////////////////////////
 
 	// DO NOT COPY INTO THE PREVIOUS FRAME TEXTURE UNLESS IT IS REQUIRED
 	// THIS _DRAMATICALLY_ REDUCES THE FPS ON A RASPBERRY PI
-	if ((p_f_ghostingPercent > 0.0000001f && p_i_postprocessingLevel > 1) || bHalveFramerate)
+	if (IsPreviousFrameNeeded())
 	{
 		if ((glerr = glGetError()) != GL_NO_ERROR) {
 			std::cerr << "OpenGL error PP 4: " << glerr << std::endl;
@@ -574,12 +702,12 @@ void PostProcessor::Render(SDL_Window* window, GLuint inputTextureSlot, GLuint s
 
 		// Now copy the screen texture to prevFrame_texture_id, to use it for the next frame
 		// NOTE: prevFrame is flipped on the Y axis, so we flip Y on the destination to realign it
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, outputFBO);
 		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FBO_prevFrame);
 		glBlitFramebuffer(tA2Quad.x, tA2Quad.y, tA2Quad.w + tA2Quad.x, tA2Quad.h + tA2Quad.y,	// source rectangle (quad region)
 			0, tA2Quad.h, tA2Quad.w, 0,									// destination rectangle (Y flipped)
 			GL_COLOR_BUFFER_BIT, GL_NEAREST);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
 
 		if ((glerr = glGetError()) != GL_NO_ERROR) {
 			std::cerr << "OpenGL error PP glBlitFramebuffer: " << glerr << std::endl;
@@ -632,7 +760,7 @@ void PostProcessor::Render(SDL_Window* window, GLuint inputTextureSlot, GLuint s
 		std::cerr << "OpenGL error PP 3: " << glerr << std::endl;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
 
 	glViewport(last_viewport[0], last_viewport[1], (GLsizei)last_viewport[2], (GLsizei)last_viewport[3]);
 	// revert the texture assignment
@@ -773,6 +901,8 @@ void PostProcessor::DisplayImGuiWindow(bool* p_open)
 		ImGui::SetItemTooltip("Simple alternating scanlines, optional bezel. Fast.");
 		ImGui::RadioButton("Full CRT##PPLEVEL", &p_i_postprocessingLevel, 2);
 		ImGui::SetItemTooltip("The one and only Super Duper CRT shader. Customize away!");
+		if (bIdentityPassActive)
+			ImGui::TextDisabled("Direct copy: no zoom, offset or frame merging, shader skipped");
 		ImGui::Separator();
 		if (p_i_postprocessingLevel == 2) {
 			ImGui::AlignTextToFramePadding();
@@ -25,6 +25,9 @@ public:
 	~PostProcessor();
 
 	void Render(SDL_Window* window, GLuint inputTextureSlot, GLuint scanlineCount);
+	// Renders into fbo instead of the window's default framebuffer. Used for offscreen
+	// rendering, where there may not be any window at all. Pass 0 to go back to the window.
+	void SetOutputFramebuffer(GLuint fbo, GLint width, GLint height);
 	void DisplayImGuiWindow(bool* p_open);
 
 	nlohmann::json SerializeState();
@@ -45,6 +48,10 @@ private:
 	int PopulateBezelFiles(std::vector<std::string>& bezelFiles, const std::string& selectedBezelFile);
 	void SelectShader();
 	void RegeneratePreviousTexture();
+	bool IsPreviousFrameNeeded();	// ghosting or frame merging needs the previous frame
+	bool IsCRTPassNeutral();		// the CRT shader's settings change nothing
+	bool IsIdentityPass();			// PP would be a straight integer-scaled copy
+	void BlitInputToScreen();
 	void ResetToDefaults();
 
 	void LoadSelectedBezel();
@@ -61,6 +68,14 @@ private:
 	GLuint quadVBO = UINT_MAX;
 	GLuint FBO_prevFrame = UINT_MAX;		// Framebuffer that holds the texture of the previous frame
 	GLuint prevFrame_texture_id = UINT_MAX;	// The previous frame as a texture
+	bool bPrevFrameIsStale = true;			// Previous frame texture must be regenerated before use
+	GLuint FBO_blitSource = UINT_MAX;		// Read framebuffer for the identity pass blit
+	GLint blitSourceTexId = -1;				// Texture currently attached to FBO_blitSource
+	bool bIdentityPassActive = false;		// Last frame was blitted instead of shaded
+	bool bShaderNeedsSelect = true;			// Force SelectShader() on the next shaded frame
+
+	GLuint outputFBO = 0;					// Framebuffer to render into, 0 is the window
+	GLint outputWidth = 0, outputHeight = 0;	// Size of outputFBO when it isn't the window
 
 	GLint maxTexSize = 0;	// maximum texture size, depends on GL implementation
 
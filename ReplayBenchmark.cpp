@@ -0,0 +1,87 @@
+#include "ReplayBenchmark.h"
+#include "common.h"
+#include "SoundManager.h"
+#include "MockingboardManager.h"
+#include "A2VideoManager.h"
+#include "CycleCounter.h"
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+
+void ReplayBenchmark::Run(uint64_t count, const std::function<SDHREvent(size_t)>& getEvent,
+	const std::function<void()>& resetState, const std::function<void()>& onNewFrame)
+{
+	using clock = std::chrono::steady_clock;
+	auto _seconds = [](clock::time_point start) { return std::chrono::duration<double>(clock::now() - start).count(); };
+	eventCount = count;
+	cycleCount = 0;
+	frameCount = 0;
+	frameSeconds = 0.0;
+
+	// 1. Only read the events
+	resetState();
+	auto _t = clock::now();
+	for (uint64_t i = 0; i < eventCount; ++i)
+		cycleCount += event_cycles(getEvent(i));
+	decodeSeconds = _seconds(_t);
+
+	// 2. The sound path
+	auto soundManager = SoundManager::GetInstance();
+	auto mockingboardManager = MockingboardManager::GetInstance();
+	resetState();
+	_t = clock::now();
+	for (uint64_t i = 0; i < eventCount; ++i)
+	{
+		const SDHREvent _event = getEvent(i);
+		if (_event.is_delay)
+		{
+			soundManager->AdvanceCycles(_event.DelayCycles());
+			continue;
+		}
+		soundManager->EventReceived((_event.addr & 0xFFF0) == 0xC030);
+		mockingboardManager->EventReceived(_event.addr, _event.data, _event.rw);
+	}
+	soundSeconds = std::max(0.0, _seconds(_t) - decodeSeconds);
+
+	// 3. The whole bus path, and the frames
+	auto a2VideoManager = A2VideoManager::GetInstance();
+	resetState();
+	uint64_t _lastFrame = a2VideoManager->current_frame_idx;
+	_t = clock::now();
+	for (uint64_t i = 0; i < eventCount; ++i)
+	{
+		SDHREvent _event = getEvent(i);
+		process_single_event(_event);
+		if (a2VideoManager->current_frame_idx != _lastFrame)
+		{
+			_lastFrame = a2VideoManager->current_frame_idx;
+			++frameCount;
+			if (onNewFrame)
+			{
+				auto _tFrame = clock::now();
+				onNewFrame();
+				frameSeconds += _seconds(_tFrame);
+			}
+		}
+	}
+	busSeconds = std::max(0.0, _seconds(_t) - frameSeconds - decodeSeconds - soundSeconds);
+}
+
+std::string ReplayBenchmark::GetSummary()
+{
+	// What a replay costs is the last pass, which does all of it once
+	const double _totalSeconds = decodeSeconds + soundSeconds + busSeconds + frameSeconds;
+	// The clock is the one of the recording's region
+	const double _cpuFrequency = (CycleCounter::GetInstance()->GetVideoRegion() == VideoRegion_e::PAL)
+		? static_cast<double>(_A2_CPU_FREQUENCY_PAL) : static_cast<double>(_A2_CPU_FREQUENCY_NTSC);
+	const double _a2Seconds = static_cast<double>(cycleCount) / _cpuFrequency;
+	std::ostringstream _ss;
+	_ss << "Replay benchmark: " << eventCount << " events, " << cycleCount << " cycles ("
+		<< _a2Seconds << "s of Apple 2 time) in " << _totalSeconds << "s" << std::endl
+		<< "  " << (_totalSeconds > 0 ? eventCount / _totalSeconds / 1'000'000.0 : 0) << " Mevents/s, "
+		<< frameCount << " frames at " << (_totalSeconds > 0 ? frameCount / _totalSeconds : 0) << " fps, "
+		<< (_totalSeconds > 0 ? _a2Seconds / _totalSeconds : 0) << "x realtime" << std::endl
+		<< "  decode " << decodeSeconds * 1000.0 << "ms, sound " << soundSeconds * 1000.0
+		<< "ms, memory+beam " << busSeconds * 1000.0 << "ms, frames " << frameSeconds * 1000.0 << "ms";
+	return _ss.str();
+}
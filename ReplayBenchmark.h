@@ -0,0 +1,53 @@
+#pragma once
+#ifndef REPLAYBENCHMARK_H
+#define REPLAYBENCHMARK_H
+
+/*
+	Replays a recording through process_single_event() as fast as the CPU allows, and measures
+	where the time goes. It turns the recordings into a repeatable benchmark of the bus path:
+	MemoryManager, the CycleCounter and the A2VideoManager beam and VRAM, and the sound.
+
+	Timing every event would cost as much as the work measured, so the recording is run 3 times:
+		1. only reading the events, which is the decoding cost of the recording itself
+		2. feeding them to SoundManager and MockingboardManager, like AudioRenderer does
+		3. through process_single_event(), with onNewFrame() called at each new Apple 2 frame
+	Each subsystem's time is what a pass adds over the previous ones. resetState() is called
+	before each pass, out of the timings, so that every pass starts from the same machine and
+	sound state. Whatever onNewFrame() does (GPU rendering, or nothing) is timed on its own.
+*/
+
+#include "SDHRNetworking.h"	// for SDHREvent
+#include <stdint.h>
+#include <string>
+#include <functional>
+
+class ReplayBenchmark
+{
+public:
+	ReplayBenchmark() {};
+
+	// getEvent is called in order, 3 times over. onNewFrame may be empty.
+	void Run(uint64_t count, const std::function<SDHREvent(size_t)>& getEvent,
+		const std::function<void()>& resetState, const std::function<void()>& onNewFrame);
+
+	// Stats of the last Run()
+	uint64_t GetEventCount() { return eventCount; };
+	uint64_t GetCycleCount() { return cycleCount; };
+	uint64_t GetFrameCount() { return frameCount; };
+	double GetDecodeSeconds() { return decodeSeconds; };	// reading the events
+	double GetSoundSeconds() { return soundSeconds; };		// beeper, Mockingboard and the null/file sink mix
+	double GetBusSeconds() { return busSeconds; };			// memory, soft switches, cycle counter, beam and VRAM
+	double GetFrameSeconds() { return frameSeconds; };		// onNewFrame()
+	std::string GetSummary();
+
+private:
+	uint64_t eventCount = 0;
+	uint64_t cycleCount = 0;
+	uint64_t frameCount = 0;
+	double decodeSeconds = 0.0;
+	double soundSeconds = 0.0;
+	double busSeconds = 0.0;
+	double frameSeconds = 0.0;
+};
+
+#endif // REPLAYBENCHMARK_H
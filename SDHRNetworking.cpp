@@ -7,6 +7,7 @@
 #include "SDHRManager.h"
 #include "CycleCounter.h"
 #include "EventRecorder.h"
+#include "FlightRecorder.h"
 #include "MainMenu.h"
 #include <time.h>
 #include <fcntl.h>
@@ -247,6 +248,15 @@ void process_single_event(SDHREvent &e)
 	eventRecorder = EventRecorder::GetInstance();
 	if (eventRecorder->IsRecording())
 		eventRecorder->RecordEvent(&e);
+	if (!eventRecorder->IsInReplayMode())
+		FlightRecorder::GetInstance()->RecordEvent(e);
+	// Replayed animations wait between frames with delay events
+	if (e.is_delay)
+	{
+		CycleCounter::GetInstance()->AdvanceCycles(e.DelayCycles());
+		SoundManager::GetInstance()->AdvanceCycles(e.DelayCycles());
+		return;
+	}
 	// Update the cycle counting and VBL hit
 	VBLState_e vblState = VBLState_e::Unknown;
 	if ((e.addr == 0xC019) && e.rw)
@@ -374,6 +384,8 @@ void process_single_event(SDHREvent &e)
 				// #ifdef DEBUG
 				std::cerr << "ERROR: Processing SDHR failed!" << std::endl;
 				// #endif
+				if (FlightRecorder::GetInstance()->bDumpOnError)
+					FlightRecorder::GetInstance()->Dump("SDHR processing failed");
 			}
 			sdhrMgr->ClearBuffer();
 			break;
@@ -435,6 +447,8 @@ int process_usb_events_thread(std::atomic<bool> *shouldTerminateProcessing)
 					{
 						// we're in overflow mode, re-enable bus events
 						std::cerr << "Lost synchronization, resynching now." << std::endl;
+						if (FlightRecorder::GetInstance()->bDumpOnError)
+							FlightRecorder::GetInstance()->Dump("bus overflow");
 						bRequestEnableBusEvents.store(true, std::memory_order_release);
 					}
 				}
@@ -40,9 +40,23 @@ struct SDHREvent {
 	bool rw;        // read == 1, write == 0
 	uint16_t addr;
 	uint8_t data;
+	bool is_delay = false;	// not a bus event, time moves forward by DelayCycles()
 	SDHREvent(bool is_iigs_, bool m2b0_, bool m2sel_, bool rw_, uint16_t addr_, uint8_t data_) :
 		is_iigs(is_iigs_), m2b0(m2b0_), m2sel(m2sel_), rw(rw_), addr(addr_), data(data_) {}
+
+	// A single event for a run of idle cycles, 1 to SDHR_EVENT_MAX_DELAY of them.
+	// The count is kept in the address (low 16 bits) and the data (high 8 bits).
+	static SDHREvent MakeDelay(uint32_t cycles) {
+		SDHREvent _e(false, false, false, true, static_cast<uint16_t>(cycles & 0xFFFF), static_cast<uint8_t>(cycles >> 16));
+		_e.is_delay = true;
+		return _e;
+	}
+	uint32_t DelayCycles() const { return (static_cast<uint32_t>(data) << 16) | addr; }
 };
+#define SDHR_EVENT_MAX_DELAY 0xFFFFFF
+
+// The number of bus cycles an event stands for
+inline uint32_t event_cycles(const SDHREvent& e) { return e.is_delay ? e.DelayCycles() : 1; }
 
 enum class ENET_RES
 {
@@ -0,0 +1,69 @@
+#pragma once
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/**************************************************************/
+/* Fixed size lock-free queue for exactly one producer thread */
+/* and one consumer thread. Nothing ever blocks: push() fails */
+/* and counts a drop when the queue is full, front() returns  */
+/* nullptr when it is empty.                                  */
+/* Capacity must be a power of 2.                             */
+/**************************************************************/
+template <typename T, size_t Capacity>
+class SPSCQueue
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SPSCQueue capacity must be a power of 2");
+private:
+	static constexpr size_t d_mask = Capacity - 1;
+	// head and tail are on separate cache lines so the 2 threads don't fight over them
+	alignas(64) std::atomic<size_t> d_head{ 0 };	// written by the producer
+	alignas(64) std::atomic<size_t> d_tail{ 0 };	// written by the consumer
+	std::atomic<uint64_t> d_dropped{ 0 };
+	T d_buffer[Capacity];
+public:
+	// Producer side
+	bool push(const T& value) {
+		const size_t _head = this->d_head.load(std::memory_order_relaxed);
+		if (_head - this->d_tail.load(std::memory_order_acquire) >= Capacity)
+		{
+			this->d_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		this->d_buffer[_head & d_mask] = value;
+		this->d_head.store(_head + 1, std::memory_order_release);
+		return true;
+	}
+	// Consumer side. The returned element stays valid until pop()
+	T* front() {
+		const size_t _tail = this->d_tail.load(std::memory_order_relaxed);
+		if (_tail == this->d_head.load(std::memory_order_acquire))
+			return nullptr;
+		return &this->d_buffer[_tail & d_mask];
+	}
+	void pop() {
+		this->d_tail.store(this->d_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+	// Consumer side, drops everything queued so far
+	void clear() {
+		this->d_tail.store(this->d_head.load(std::memory_order_acquire), std::memory_order_release);
+	}
+	// Either side, approximate when called from the other thread
+	size_t size() {
+		return this->d_head.load(std::memory_order_acquire) - this->d_tail.load(std::memory_order_acquire);
+	}
+	bool empty() {
+		return this->size() == 0;
+	}
+	constexpr size_t capacity() const {
+		return Capacity;
+	}
+	uint64_t dropped() {
+		return this->d_dropped.load(std::memory_order_relaxed);
+	}
+};
+
+#endif // SPSCQUEUE_H
@@ -14,11 +14,53 @@
 #define _DEBUG_SSI263 0
 
 constexpr int SSI263_FILTER_FREQ_SILENCE = 0xFF;
+constexpr int SSI263_PHONEME_COUNT = sizeof(g_nPhonemeInfo) / sizeof(g_nPhonemeInfo[0]);
+
+// All the phonemes converted to float and resampled 2x to SSI263_TABLE_SAMPLE_RATE once,
+// then shared read-only by all the chips
+struct SSI263PhonemeTable
+{
+	std::vector<float> samples;
+	int offset[SSI263_PHONEME_COUNT];
+	int length[SSI263_PHONEME_COUNT];
+};
+
+static SSI263PhonemeTable BuildPhonemeTable()
+{
+	SSI263PhonemeTable _table;
+	size_t _total = 0;
+	for (int p = 0; p < SSI263_PHONEME_COUNT; ++p)
+		_total += (g_nPhonemeInfo[p].nLength > 0 ? 2 * g_nPhonemeInfo[p].nLength - 1 : 0);
+	_table.samples.reserve(_total);
+	for (int p = 0; p < SSI263_PHONEME_COUNT; ++p)
+	{
+		_table.offset[p] = static_cast<int>(_table.samples.size());
+		const int _base = g_nPhonemeInfo[p].nOffset;
+		const int _length = g_nPhonemeInfo[p].nLength;
+		// Resize to (2 * N - 1) samples, linearly interpolating in between
+		for (int i = 0; i < _length; ++i)
+		{
+			float _sample = static_cast<float>(static_cast<int16_t>(g_nPhonemeData[_base + i])) / 32768.0f;
+			if (i > 0)
+				_table.samples.push_back((_table.samples.back() + _sample) * 0.5f);
+			_table.samples.push_back(_sample);
+		}
+		_table.length[p] = static_cast<int>(_table.samples.size()) - _table.offset[p];
+	}
+	return _table;
+}
+
+static const SSI263PhonemeTable& GetPhonemeTable()
+{
+	// Built on first use, thread-safe
+	static const SSI263PhonemeTable s_table = BuildPhonemeTable();
+	return s_table;
+}
 
 SSI263::SSI263()
 {
 	bIsEnabled = false;
-	v_samples.reserve(2*SSI263_SAMPLE_RATE);	// To accommodate for slower speech rate
+	GetPhonemeTable();	// build the table at startup, not when the first phoneme plays
 	ResetRegisters();
 }
 
@@ -27,6 +69,12 @@ SSI263::~SSI263()
 	
 }
 
+void SSI263::SetOutputRate(int sampleRate)
+{
+	// Other rates step through the table at a fractional speed
+	m_sampleStep = static_cast<uint32_t>((static_cast<uint64_t>(SSI263_TABLE_SAMPLE_RATE) << 16) / sampleRate);
+}
+
 void SSI263::Update()
 {
 	if (!bIsEnabled)
@@ -62,7 +110,9 @@ void SSI263::ResetRegisters()
 	irqShouldProcess = false;
 	regCTL = true; // Power down
 	
-	v_samples.clear();
+	m_phonemeSamples = nullptr;
+	m_phonemeLength = 0;
+	m_currentSampleIdx = 0;
 
 	for (int i = 0; i < SSI263_DCADJ_BUFLEN; ++i) {
 		dcadj_buf[i] = 0.0;
@@ -99,7 +149,7 @@ void SSI263::LoadRegister()
 				irqIsSet = false;
 				if constexpr (_DEBUG_SSI263 > 0)
 					std::cerr << "Generating P:" << phoneme << " Dur:" << phonemeDuration << std::endl;
-				GeneratePhonemeSamples();
+				StartPhoneme();
 			}
 			break;
 		case 0b001:
@@ -219,9 +269,9 @@ float SSI263::DCAdjust(float sample)
 	return (sample - (dcadj_sum / SSI263_DCADJ_BUFLEN));
 }
 
-void SSI263::GeneratePhonemeSamples()
+void SSI263::StartPhoneme()
 {
-	// Generate the actual phoneme samples based on:
+	// Start the phoneme samples based on:
 	//	- amplitude tuning
 	//	- phoneme length
 	//	- speech rate
@@ -232,7 +282,6 @@ void SSI263::GeneratePhonemeSamples()
 		return;
 	
 	int _basePhonemeLength = g_nPhonemeInfo[phoneme].nLength;
-	auto _offset = g_nPhonemeInfo[phoneme].nOffset;
 	
 	// Apply pitch factor, no transition. Instant pitch change
 	float _speedFactor = 1.0f;
@@ -260,44 +309,23 @@ void SSI263::GeneratePhonemeSamples()
 	// Phoneme duration is 0->3, which maps to 100%,75%,50%,25% of default duration
 	_phonemeLength /= (1 + phonemeDuration);
 
-	std::unique_lock<std::mutex> lock(this->d_mutex_accessing_phoneme);
-	v_samples.clear();
-	m_currentSampleIdx = 0;
-
 	// NOTE: The below disregards the register values except for amplitude
 	// Any application of register values other than amplitude would necessitate
 	// complex resampling that is not effective when the original samples are of
 	// such low quality.
-	std::vector<float> _rawBuffer;
-	for (int i=_offset; i<_offset+_basePhonemeLength; ++i) {
-		int16_t _sample = static_cast<int16_t>(g_nPhonemeData[i]);
-		// Clamp the value to the valid range for int16_t.
-		if (_sample < -32768) _sample = -32768;
-		if (_sample > 32767) _sample = 32767;
-		// Convert to a float sample in the range [-1.0, 1.0].
-		float _sampleF = static_cast<float>(_sample) / 32768.0f;
-		if (filterFrequency == SSI263_FILTER_FREQ_SILENCE)	// plays silence
-			_sampleF = 0.f;
-		if (regCTL)											// it's off
-			_sampleF = 0.f;
-		// Apply the amplitude (0 to 15, typically 10)
-		_sampleF = (_sampleF * amplitude) / 16.f;
-		_rawBuffer.push_back(DCAdjust(_sampleF));
-	}
-	// resample to float 44.1kHz
-	if (!_rawBuffer.empty())
-	{
-		// Resize the resampled buffer to (2 * N - 1) samples.
-		for (size_t i = 0; i < _rawBuffer.size() - 1; ++i)
-		{
-			v_samples.push_back(_rawBuffer[i]);
-			v_samples.push_back((_rawBuffer[i] + _rawBuffer[i + 1]) * 0.5f);
-		}
-		v_samples.push_back(_rawBuffer.back());
-	}
+	// The amplitude (0 to 15, typically 10) is taken when the phoneme starts
+	const SSI263PhonemeTable& _table = GetPhonemeTable();
+	m_phonemeSamples = &_table.samples[_table.offset[phoneme]];
+	m_phonemeLength = _table.length[phoneme];
+	m_currentSampleIdx = 0;
+	m_samplePhase = 0;
+	if ((filterFrequency == SSI263_FILTER_FREQ_SILENCE) || regCTL)	// plays silence
+		m_phonemeGain = 0.f;
+	else
+		m_phonemeGain = amplitude / 16.f;
 
 	if (_DEBUG_SSI263 > 0)
-		std::cerr << "Added phoneme " << phoneme << ", sample count: " << v_samples.size() << std::endl;
+		std::cerr << "Started phoneme " << phoneme << ", sample count: " << m_phonemeLength << std::endl;
 }
 
 // Call GetSample on every audio callback from the main audio stream
@@ -306,16 +334,18 @@ void SSI263::GeneratePhonemeSamples()
 float SSI263::GetSample() {
 	if ((!bIsEnabled) || regCTL)
 		return 0.f;
-	std::unique_lock<std::mutex> lock(this->d_mutex_accessing_phoneme);
-	if (v_samples.size() == 0) {
+	if (m_phonemeLength == 0) {
 		return 0.f;
 	}
 
-	float sample_to_return = v_samples[m_currentSampleIdx];
+	float sample_to_return = DCAdjust(m_phonemeSamples[m_currentSampleIdx] * m_phonemeGain);
 	if constexpr (_DEBUG_SSI263 > 3)
-		std::cerr << "Getting sample: " << m_currentSampleIdx << " of " << v_samples.size() << " val: " << sample_to_return << std::endl;
-	++m_currentSampleIdx;
-	if (m_currentSampleIdx == (v_samples.size() - 100))
+		std::cerr << "Getting sample: " << m_currentSampleIdx << " of " << m_phonemeLength << " val: " << sample_to_return << std::endl;
+	const int _prevSampleIdx = m_currentSampleIdx;
+	m_samplePhase += m_sampleStep;
+	m_currentSampleIdx += static_cast<int>(m_samplePhase >> 16);
+	m_samplePhase &= 0xFFFF;
+	if ((_prevSampleIdx < (m_phonemeLength - 100)) && (m_currentSampleIdx >= (m_phonemeLength - 100)))
 	{
 		// The phoneme is almost finished, so trigger the IRQ if needed
 		if constexpr (_DEBUG_SSI263 > 0)
@@ -336,9 +366,9 @@ float SSI263::GetSample() {
 		}
 	}
 
-	if (m_currentSampleIdx == v_samples.size()) {
+	if (m_currentSampleIdx >= m_phonemeLength) {
 		// Here we really finished playing the phoneme, time to replay it
-		m_currentSampleIdx = 0;	// reset to replay the phoneme
+		m_currentSampleIdx %= m_phonemeLength;	// reset to replay the phoneme
 	}
 
 	return sample_to_return;
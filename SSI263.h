@@ -47,10 +47,12 @@
 #include <stdio.h>
 #include <vector>
 #include <SDL.h>
-#include <mutex>
 
 constexpr int SSI263_SAMPLE_RATE = 22050;
-constexpr int SSI263_DCADJ_BUFLEN = 4096;
+constexpr int SSI263_TABLE_SAMPLE_RATE = SSI263_SAMPLE_RATE * 2;	// rate of the resampled phoneme table
+// The DC filter runs at the 44.1kHz output rate, this covers the same ~190ms the
+// 4096 sample filter did when it ran on the 22.05kHz phoneme data
+constexpr int SSI263_DCADJ_BUFLEN = 8192;
 // Number of samples remaining for the IRQ to trigger. If we wait until the phoneme finishes playing,
 // then there's just no way it'll get the next phoneme before it starts again.
 constexpr int SSI263_REMAINING_SAMPLES_WHEN_IRQ_TRIGGERS = 256;
@@ -74,6 +76,7 @@ public:
 	void Update();
 	float GetSample();
 	void ResetRegisters();
+	void SetOutputRate(int sampleRate);	// Rate GetSample() is called at, defaults to 44.1kHz
 	void SetRegisterSelect(int addr);	// Set RS2->RS0 (A2->A0)
 	void SetData(int data);				// Set D7->D0 data pins
 	void SetReadMode(bool pinState);	// R/W mode, true for R
@@ -123,10 +126,16 @@ private:
 
 	void LoadRegister();
 
-	std::vector<float> v_samples;
+	// The phoneme being played is a cursor into the shared phoneme table, which is
+	// built once and never changes, so playback needs no lock.
+	// Register writes and GetSample() must come from the same thread.
+	const float* m_phonemeSamples = nullptr;
+	int m_phonemeLength = 0;
+	float m_phonemeGain = 0.f;		// amplitude when the phoneme started, 0 for silence
 	int m_currentSampleIdx = 0;
-	std::mutex	d_mutex_accessing_phoneme;
-	void GeneratePhonemeSamples();
+	uint32_t m_samplePhase = 0;		// 16.16 fraction of the next table sample
+	uint32_t m_sampleStep = 1 << 16;	// 16.16 table samples per output sample
+	void StartPhoneme();
 
 	// DC Filter
 	float dcadj_sum = 0.0;
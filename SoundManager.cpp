@@ -1,17 +1,29 @@
 #include "SoundManager.h"
 #include "imgui.h"
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
 #include "MockingboardManager.h"
-#define CHIPS_IMPL
-#include "beeper.h"
+#include "AudioRenderer.h"
 
 // below because "The declaration of a static data member in its class definition is not a definition"
 SoundManager* SoundManager::s_instance;
+AudioSink_e SoundManager::s_sink = AudioSink_e::SDL;
+std::string SoundManager::s_sinkPath;
 
-beeper_t beeper;
+static_assert(SM_MIX_BLOCK <= AYUMI_MAX_BLOCK, "The Mockingboard renders at most AYUMI_MAX_BLOCK samples at once");
+static_assert(SM_MIX_BLOCK <= BLEP_MAX_BLOCK, "The beeper renders at most BLEP_MAX_BLOCK samples at once");
 
 SoundManager::SoundManager(uint32_t sampleRate, uint32_t bufferSize)
 : sampleRate(sampleRate), bufferSize(bufferSize), bIsPlaying(false) {
+	audioDevice = 0;
+	obtainedSampleRate = sampleRate;
+	obtainedBufferSize = bufferSize;
+	if (!HasDevice()) {
+		Initialize();
+		return;
+	}
 	if (SDL_Init(SDL_INIT_AUDIO) < 0) {
 		std::cerr << "Failed to initialize SDL: " << SDL_GetError() << std::endl;
 		throw std::runtime_error("SDL_Init failed");
@@ -22,29 +34,31 @@ SoundManager::SoundManager(uint32_t sampleRate, uint32_t bufferSize)
 
 void SoundManager::Initialize()
 {
+	if (!HasDevice())
+	{
+		obtainedSampleRate = sampleRate;
+		obtainedBufferSize = bufferSize;
+		ApplyAudioFormat();
+		bIsPlaying = false;
+		SetPAL(bIsPAL);
+		if ((s_sink == AudioSink_e::Null) || (s_sink == AudioSink_e::File))
+			StartVirtualClock();
+		return;
+	}
 	if (audioDevice == 0)
 	{
-		SDL_zero(audioSpec);
-		audioSpec.freq = sampleRate;
-		audioSpec.format = AUDIO_F32SYS;
-		audioSpec.channels = 2;
-		audioSpec.samples = bufferSize;
-		audioSpec.callback = SoundManager::AudioCallback;
-		audioSpec.userdata = this;
-
-		audioDevice = SDL_OpenAudioDevice(NULL, 0, &audioSpec, NULL, 0);
+		if (!OpenDevice())
+		{
+			std::cerr << "Failed to open audio device: " << SDL_GetError() << std::endl;
+			SDL_Quit();
+			throw std::runtime_error("SDL_OpenAudioDevice failed");
+		}
 	}
 	else {
 		// std::cerr << "Stopping and clearing Speaker Audio" << std::endl;
 		SDL_PauseAudioDevice(audioDevice, 1);
 		SDL_ClearQueuedAudio(audioDevice);
 	}
-	
-	if (audioDevice == 0) {
-		std::cerr << "Failed to open audio device: " << SDL_GetError() << std::endl;
-		SDL_Quit();
-		throw std::runtime_error("SDL_OpenAudioDevice failed");
-	}
 
 	bIsPlaying = false;
 	SetPAL(bIsPAL);
@@ -52,21 +66,176 @@ void SoundManager::Initialize()
 }
 
 SoundManager::~SoundManager() {
+	if (!HasDevice())
+	{
+		CloseSink();
+		return;
+	}
+	CloseDevice();
+	SDL_Quit();
+}
+
+bool SoundManager::OpenDevice()
+{
+	SDL_AudioSpec _desired;
+	SDL_zero(_desired);
+	_desired.freq = sampleRate;
+	_desired.format = AUDIO_F32SYS;
+	_desired.channels = 2;
+	_desired.samples = bufferSize;
+	_desired.callback = SoundManager::AudioCallback;
+	_desired.userdata = this;
+
+	// The mixer handles any rate and buffer size, so let the device pick what suits it best
+	SDL_zero(audioSpec);
+	audioDevice = SDL_OpenAudioDevice(NULL, 0, &_desired, &audioSpec,
+		SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+	if (audioDevice == 0)
+		return false;
+	obtainedSampleRate = audioSpec.freq;
+	obtainedBufferSize = audioSpec.samples;
+	if ((obtainedSampleRate != sampleRate) || (obtainedBufferSize != bufferSize))
+		std::cerr << "Audio device opened at " << obtainedSampleRate << " Hz with " << obtainedBufferSize
+			<< " samples instead of " << sampleRate << " Hz with " << bufferSize << std::endl;
+	ApplyAudioFormat();
+	return true;
+}
+
+void SoundManager::CloseDevice()
+{
+	if (audioDevice == 0)
+		return;
 	SDL_PauseAudioDevice(audioDevice, 1);
 	SDL_CloseAudioDevice(audioDevice);
-	SDL_Quit();
+	audioDevice = 0;
+}
+
+// Sets the beeper and Mockingboard latencies from the device format.
+// The audio callback must not be running.
+void SoundManager::ApplyAudioFormat()
+{
+	uint32_t _fill = obtainedBufferSize * 2;
+	if (targetLatencyMs > 0)
+	{
+		// The device buffer is part of the latency. Below one and a half buffers queued,
+		// the ring runs dry whenever a callback comes in a little late.
+		const uint32_t _targetSamples = targetLatencyMs * obtainedSampleRate / 1000;
+		_fill = std::max(_targetSamples > obtainedBufferSize ? _targetSamples - obtainedBufferSize : 0,
+			obtainedBufferSize + obtainedBufferSize / 2);
+	}
+	beeperLatencySamples = _fill;
+	beeperDrift.SetTarget(beeperLatencySamples);
+	bBeeperNeedsReset = true;
+	MockingboardManager::GetInstance()->SetAudioFormat(obtainedSampleRate, beeperLatencySamples);
+}
+
+void SoundManager::SetDeviceParams(uint32_t _sampleRate, uint32_t _bufferSize, uint32_t _targetLatencyMs)
+{
+	const bool _needsReopen = (_sampleRate != sampleRate) || (_bufferSize != bufferSize);
+	sampleRate = _sampleRate;
+	bufferSize = _bufferSize;
+	targetLatencyMs = std::min(_targetLatencyMs, SM_MAX_TARGET_LATENCY_MS);
+	if (!HasDevice())
+	{
+		Initialize();
+		return;
+	}
+	if (audioDevice == 0)	// not opened yet
+		return;
+	if (!_needsReopen)
+	{
+		SDL_LockAudioDevice(audioDevice);
+		ApplyAudioFormat();
+		SDL_UnlockAudioDevice(audioDevice);
+		return;
+	}
+	CloseDevice();
+	if (!OpenDevice())
+	{
+		std::cerr << "Failed to open audio device at " << sampleRate << " Hz with " << bufferSize
+			<< " samples: " << SDL_GetError() << ". Reverting to the defaults." << std::endl;
+		sampleRate = _AUDIO_SAMPLE_RATE;
+		bufferSize = SM_AUDIO_BUFLEN;
+		Initialize();
+		return;
+	}
+	SetPAL(bIsPAL);		// the beeper runs at the new rate, and restarts if it was playing
+	SDL_PauseAudioDevice(audioDevice, 0);
+}
+
+void SoundManager::StartVirtualClock()
+{
+	if ((s_sink == AudioSink_e::File) && !sinkFile.is_open())
+	{
+		bSinkIsWav = (std::filesystem::path(s_sinkPath).extension() != ".raw");
+		sinkFile.open(s_sinkPath, std::ios::binary);
+		if (!sinkFile.is_open())
+			std::cerr << "Audio sink: can't create " << s_sinkPath << ", the audio is discarded" << std::endl;
+		else if (bSinkIsWav)
+			AudioRenderer::WriteWavHeader(sinkFile, obtainedSampleRate, 0);	// rewritten by CloseSink()
+	}
+	sinkBuffer.assign(obtainedBufferSize * 2, 0.f);
+	// Same pacing as AudioRenderer, so both produce the same samples from the same events
+	const double _cpuFrequency = bIsPAL ? static_cast<double>(_A2_CPU_FREQUENCY_PAL) : static_cast<double>(_A2_CPU_FREQUENCY_NTSC);
+	virtualCyclesPerBlock = obtainedBufferSize * _cpuFrequency / obtainedSampleRate;
+	virtualBaseCycle = virtualCycle;
+	virtualBlockIndex = 0;
+	virtualNextPullCycle = virtualBaseCycle + static_cast<uint64_t>(SM_VIRTUAL_CLOCK_LEAD_BLOCKS * virtualCyclesPerBlock);
+	bHasVirtualClock = true;
+	// Apply the beeper reset now, so it doesn't throw away the first toggles
+	BeginPlay();
+	MixBlock(sinkBuffer.data(), 0);
+}
+
+void SoundManager::PullVirtualBlock()
+{
+	MixBlock(sinkBuffer.data(), obtainedBufferSize);
+	if (sinkFile.is_open())
+		sinkFile.write(reinterpret_cast<const char*>(sinkBuffer.data()), sinkBuffer.size() * sizeof(float));
+	sinkSampleCount += obtainedBufferSize;
+	++virtualBlockIndex;
+	virtualNextPullCycle = virtualBaseCycle
+		+ static_cast<uint64_t>((virtualBlockIndex + SM_VIRTUAL_CLOCK_LEAD_BLOCKS) * virtualCyclesPerBlock);
+}
+
+void SoundManager::CloseSink()
+{
+	if (!bHasVirtualClock)
+		return;
+	// The bus stopped, finish the blocks that cover the last cycles received
+	const uint64_t _blockCount = static_cast<uint64_t>(std::ceil((virtualCycle - virtualBaseCycle) / virtualCyclesPerBlock));
+	while (virtualBlockIndex < _blockCount)
+		PullVirtualBlock();
+	bHasVirtualClock = false;
+	if (!sinkFile.is_open())
+		return;
+	if (bSinkIsWav)
+	{
+		// The WAV sizes are 32 bits, past ~6 hours at 44.1kHz use a .raw file
+		const uint64_t _dataBytes = std::min<uint64_t>(sinkSampleCount * 2 * sizeof(float), UINT32_MAX - 64);
+		sinkFile.seekp(0);
+		AudioRenderer::WriteWavHeader(sinkFile, obtainedSampleRate, static_cast<uint32_t>(_dataBytes));
+	}
+	if (!sinkFile.good())
+		std::cerr << "Audio sink: error writing " << s_sinkPath << std::endl;
+	sinkFile.close();
+}
+
+float SoundManager::GetMeasuredLatency()
+{
+	return beeperLatencyLevel.load(std::memory_order_relaxed) + BLEP_HALF_WIDTH + obtainedBufferSize;
 }
 
 void SoundManager::SetPAL(bool isPal) {
 	bIsPAL = isPal;
+	MockingboardManager::GetInstance()->SetPAL(isPal);
+	cyclesPerSample = (bIsPAL ? static_cast<double>(_A2_CPU_FREQUENCY_PAL) : static_cast<double>(_A2_CPU_FREQUENCY_NTSC))
+		/ obtainedSampleRate;
 	if (!bIsEnabled)
 		return;
 	bool _isPlaying = bIsPlaying;
-	if (_isPlaying)
+	if (_isPlaying && (audioDevice != 0))
 		SDL_PauseAudioDevice(audioDevice, 1);
-	beeper_desc_t bdesc = { bIsPAL ? (float)_A2_CPU_FREQUENCY_PAL : (float)_A2_CPU_FREQUENCY_NTSC, _AUDIO_SAMPLE_RATE, 
-		SM_BASE_VOLUME_ADJUSTMENT };
-	beeper_init(&beeper, &bdesc);
 	if (_isPlaying)
 		BeginPlay();
 }
@@ -74,15 +243,8 @@ void SoundManager::SetPAL(bool isPal) {
 void SoundManager::BeginPlay() {
 	if (!bIsEnabled)
 		return;
-	beeper_reset(&beeper);
-	curr_tick = 0;
-	curr_freq = 0.f;
-	beeper_samples_idx_read = SM_BEEPER_BUFFER_SIZE - SM_AUDIO_BUFLEN;
-	beeper_samples_idx_write = 0;
-	dcadj_pos = 0;
-	dcadj_sum = 0;
-	memset(beeper_samples, 0, sizeof(beeper_samples));
-	memset(dcadj_buf, 0, sizeof(dcadj_buf));
+	speakerState = 0;
+	bBeeperNeedsReset = true;
 	bIsPlaying = true;
 	MockingboardManager::GetInstance()->BeginPlay();
 }
@@ -92,7 +254,8 @@ void SoundManager::StopPlay() {
 	bool _enabledState = bIsEnabled;
 	bIsEnabled = false;	 // disable event handling until everything is flushed
 	MockingboardManager::GetInstance()->StopPlay();
-	SDL_Delay(100);
+	if (HasDevice())
+		SDL_Delay(100);
 	bIsPlaying = false;
 	bIsEnabled = _enabledState;
 }
@@ -101,80 +264,157 @@ bool SoundManager::IsPlaying() {
 	return bIsPlaying;
 }
 
-float SoundManager::DCAdjustment(float freq)
-{
-	dcadj_sum -= dcadj_buf[dcadj_pos];
-	dcadj_sum += freq;
-	dcadj_buf[dcadj_pos] = freq;
-	dcadj_pos = (dcadj_pos + 1) & (SM_BEEPER_DCADJ_BUFLEN - 1);
-	return (dcadj_sum / SM_BEEPER_DCADJ_BUFLEN);
-}
-
 void SoundManager::EventReceived(bool isC03x) {
+	// Null and File sinks: the bus is the audio clock
+	if (bHasVirtualClock)
+	{
+		if (virtualCycle >= virtualNextPullCycle)
+			PullVirtualBlock();
+		++virtualCycle;
+	}
 	if (!bIsEnabled)
 		return;
 	if (!bIsPlaying)
 		BeginPlay();
+	// Every bus event is one cycle
+	const uint64_t _cycle = busCycle.load(std::memory_order_relaxed) + 1;
+	busCycle.store(_cycle, std::memory_order_relaxed);
 	if (isC03x)
-		beeper_toggle(&beeper);
-	if (beeper_tick(&beeper))
 	{
-		if (((beeper_samples_idx_write + 1) % SM_BEEPER_BUFFER_SIZE) == beeper_samples_idx_read)
-		{
-			// drop the sample, reading is lagging
-		}
-		else {
-			beeper_samples_idx_write = (beeper_samples_idx_write + 1) % SM_BEEPER_BUFFER_SIZE;
-			beeper_samples[beeper_samples_idx_write] = beeper.sample;
-		}
+		speakerState = 1 - speakerState;
+		// If the queue is full the toggle is dropped and counted as an overrun. The level is
+		// queued rather than the toggle itself, so the next toggle still has the right one.
+		toggleQueue.push((_cycle << 1) | speakerState);
 	}
 }
 
+void SoundManager::AdvanceCycles(uint64_t cycles)
+{
+	auto mockingboardManager = MockingboardManager::GetInstance();
+	auto _advance = [&](uint64_t _cycles) {
+		mockingboardManager->AdvanceCycles(_cycles);
+		if (bIsEnabled)
+			busCycle.store(busCycle.load(std::memory_order_relaxed) + _cycles, std::memory_order_relaxed);
+	};
+	if (bIsEnabled && !bIsPlaying)
+		BeginPlay();
+	if (!bHasVirtualClock)
+	{
+		_advance(cycles);
+		return;
+	}
+	// Null and File sinks: pull the blocks that come due on the way, at the cycle
+	// EventReceived() would have pulled them
+	const uint64_t _end = virtualCycle + cycles;
+	while (virtualNextPullCycle < _end)
+	{
+		const uint64_t _step = (virtualNextPullCycle > virtualCycle) ? (virtualNextPullCycle - virtualCycle) : 0;
+		_advance(_step);
+		virtualCycle += _step;
+		PullVirtualBlock();
+	}
+	_advance(_end - virtualCycle);
+	virtualCycle = _end;
+}
+
 void SoundManager::AudioCallback(void* userdata, uint8_t* stream, int len)
 {
 	SoundManager* self = static_cast<SoundManager*>(userdata);
+	int samples = len / (int)(sizeof(float) * 2); 	// Number of samples to fill
+	self->MixBlock(reinterpret_cast<float*>(stream), samples);
+}
 
-	if (self->master_volume < 0.01f)	// if master volume is zero, turn off the sound
+void SoundManager::MixBlock(float* stream, int samples)
+{
+	auto mmMgr = MockingboardManager::GetInstance();
+
+	if (bBeeperNeedsReset.exchange(false))
 	{
-		SDL_memset(stream, 0, len);		// shouldn't be necessary, but better be safe
-		return;
+		toggleQueue.clear();
+		beeperSynth.Reset();
+		bBeeperNeedsResync = true;
 	}
 
-	int samples = len / (sizeof(float) * 2); 	// Number of samples to fill
+	if (master_volume < 0.01f)	// if master volume is zero, turn off the sound
+	{
+		mmMgr->ApplyPendingEvents();	// but keep the Mockingboard registers up to date
+		// and the speaker level
+		uint64_t* _toggle;
+		while ((_toggle = toggleQueue.front()) != nullptr)
+		{
+			beeperSynth.Reset((*_toggle & 1) ? SM_BASE_VOLUME_ADJUSTMENT : 0.f);
+			toggleQueue.pop();
+		}
+		bBeeperNeedsResync = true;
+		SDL_memset(stream, 0, samples * sizeof(float) * 2);
+		return;
+	}
 
 	// Need to mix the speaker and the mockingboard Audio
-	auto mmMgr = MockingboardManager::GetInstance();
+	bool _isMMPlaying = mmMgr->IsPlaying();
+	if (!_isMMPlaying)
+		mmMgr->ApplyPendingEvents();
 	float mm_left = 0.f, mm_right = 0.f;	// The left and right values from the Mockingboard mix
 
-	float beeper_sample = 0.f;	// that's the beeper mono sample
+	// Keep rendering the beeper beeperLatencySamples behind the bus, exactly like the Mockingboard.
+	// Only while the bus is moving, a silent Apple 2 would otherwise resync every block.
+	const uint64_t _busCycle = busCycle.load(std::memory_order_relaxed);
+	if (IsPlaying() && (_busCycle != beeperLastBusCycle))
+	{
+		const double _latency = (static_cast<double>(_busCycle) - beeperRenderCycle) / cyclesPerSample;
+		const double _threshold = std::max<double>(SM_BEEPER_RESYNC_THRESHOLD_SAMPLES, 4.0 * beeperLatencySamples);
+		if (bBeeperNeedsResync || (std::abs(_latency - beeperLatencySamples) > _threshold))
+		{
+			beeperRenderCycle = static_cast<double>(_busCycle) - beeperLatencySamples * cyclesPerSample;
+			beeperDrift.Reset();
+			if (!bBeeperNeedsResync)
+				beeperResyncs.fetch_add(1, std::memory_order_relaxed);
+			bBeeperNeedsResync = false;
+		}
+		else
+			beeperDrift.Update(_latency, samples);
+		beeperRenderCyclesPerSample = cyclesPerSample * beeperDrift.GetRate();
+		beeperDriftPPM.store(static_cast<float>(beeperDrift.GetDriftPPM()), std::memory_order_relaxed);
+		beeperLatencyLevel.store(static_cast<float>(beeperDrift.GetSmoothedLevel()), std::memory_order_relaxed);
+		beeperLastBusCycle = _busCycle;
+	}
 
-	for (int i = 0; i < samples; ++i) {
-		if (self->IsPlaying())
+	// The device buffer can be any size, it's rendered SM_MIX_BLOCK samples at a time
+	for (int _chunkStart = 0; _chunkStart < samples; _chunkStart += SM_MIX_BLOCK) {
+		const int _chunkLength = std::min(samples - _chunkStart, (int)SM_MIX_BLOCK);
+		if (_isMMPlaying)
+			mmMgr->GetSamplesBlock(mmLeftBuffer, mmRightBuffer, _chunkLength);
+
+		// Draw the speaker toggles that fall in this chunk. Late ones go at its start.
+		uint64_t* _toggle;
+		while ((_toggle = toggleQueue.front()) != nullptr)
 		{
-			if (((self->beeper_samples_idx_read + 1) % SM_BEEPER_BUFFER_SIZE) == self->beeper_samples_idx_write)
+			const double _position = (static_cast<double>(*_toggle >> 1) - beeperRenderCycle) / beeperRenderCyclesPerSample;
+			if (_position >= _chunkLength)
+				break;
+			if (_position < 0.0)
+				beeperLateToggles.fetch_add(1, std::memory_order_relaxed);
+			beeperSynth.AddStep(std::max(_position, 0.0), (*_toggle & 1) ? SM_BASE_VOLUME_ADJUSTMENT : 0.f);
+			toggleQueue.pop();
+		}
+		beeperSynth.Render(beeperBuffer, _chunkLength);
+		beeperRenderCycle += _chunkLength * beeperRenderCyclesPerSample;
+
+		for (int i = 0; i < _chunkLength; ++i) {
+			if (_isMMPlaying)
 			{
-				// write is lagging, use the current sample
-				beeper_sample = self->beeper_samples[self->beeper_samples_idx_read];
-			}
-			else {
-				self->beeper_samples_idx_read = (self->beeper_samples_idx_read + 1) % SM_BEEPER_BUFFER_SIZE;
-				beeper_sample = self->beeper_samples[self->beeper_samples_idx_read];
+				mm_left = mmLeftBuffer[i];
+				mm_right = mmRightBuffer[i];
 			}
-		}
-		if (mmMgr->IsPlaying())
-			mmMgr->GetSamples(mm_left, mm_right);
 
-		// Mix in the mono beeper and stereo Mockingboard streams
-		auto _relBeeperVol = self->beeper_volume / (self->beeper_volume + self->mockingboard_volume);
-		auto _leftmix = self->master_volume * (_relBeeperVol * beeper_sample + (1.f - _relBeeperVol) * mm_left);
-		auto _rightmix = self->master_volume * (_relBeeperVol * beeper_sample + (1.f - _relBeeperVol) * mm_right);
-		self->audioCallbackBuffer[2 * i] = _leftmix;
-		self->audioCallbackBuffer[2 * i + 1] = _rightmix;
+			// Mix in the mono beeper and stereo Mockingboard streams
+			auto _relBeeperVol = beeper_volume / (beeper_volume + mockingboard_volume);
+			auto _leftmix = master_volume * (_relBeeperVol * beeperBuffer[i] + (1.f - _relBeeperVol) * mm_left);
+			auto _rightmix = master_volume * (_relBeeperVol * beeperBuffer[i] + (1.f - _relBeeperVol) * mm_right);
+			stream[2 * (_chunkStart + i)] = _leftmix;
+			stream[2 * (_chunkStart + i) + 1] = _rightmix;
+		}
 	}
-
-	// Copy the buffer to the stream
-	SDL_memcpy(stream, self->audioCallbackBuffer, len);
-	SDL_memset(self->audioCallbackBuffer, 0, len);
 }
 
 ///
@@ -214,11 +454,67 @@ void SoundManager::DisplayImGuiChunk()
 			ImGui::EndTooltip();
 		}
 		ImGui::Separator();
-		static int sm_imgui_samples_delay = (SM_BEEPER_BUFFER_SIZE + beeper_samples_idx_write - beeper_samples_idx_read) % SM_BEEPER_BUFFER_SIZE;
+		static float sm_imgui_samples_delay = beeperLatencyLevel.load(std::memory_order_relaxed);
+		if ((SDL_GetTicks64() & 0xC0) == 0)
+			sm_imgui_samples_delay = beeperLatencyLevel.load(std::memory_order_relaxed);
+		ImGui::Text("Beeper Latency: %.0f samples (target %d)", sm_imgui_samples_delay, (int)beeperLatencySamples);
+		ImGui::Text("Toggles Queued: %d / %d", (int)toggleQueue.size(), (int)toggleQueue.capacity());
+		ImGui::Text("Resyncs: %llu", (unsigned long long)beeperResyncs.load());
+		ImGui::Text("Late Toggles: %llu", (unsigned long long)beeperLateToggles.load());
+		ImGui::Text("Overruns: %llu toggles dropped", (unsigned long long)toggleQueue.dropped());
+		ImGui::Text("Bus Clock Drift: %.1f ppm", beeperDriftPPM.load(std::memory_order_relaxed));
+		if (HasDevice())
+			ImGui::Text("Current Audio Driver: %s\n", SDL_GetCurrentAudioDriver());
+		else
+			ImGui::Text("Audio Sink: %s\n", (s_sink == AudioSink_e::File) ? s_sinkPath.c_str() : "None");
+		ImGui::EndMenu();
+	}
+	if (ImGui::BeginMenu("Audio Device")) {
+		static const int _rates[] = { 22050, 44100, 48000, 96000 };
+		static const int _buffers[] = { 64, 128, 256, 512, 1024, 2048 };
+		int _rateIdx = 1;
+		for (int i = 0; i < IM_ARRAYSIZE(_rates); i++)
+			if (_rates[i] == (int)sampleRate)
+				_rateIdx = i;
+		int _bufferIdx = 2;
+		for (int i = 0; i < IM_ARRAYSIZE(_buffers); i++)
+			if (_buffers[i] == (int)bufferSize)
+				_bufferIdx = i;
+		static int sm_imgui_latency_ms = (int)targetLatencyMs;
+		// The Null and File sinks are clocked by the bus thread, only change them at startup
+		ImGui::BeginDisabled(!HasDevice());
+		if (ImGui::Combo("Sample Rate", &_rateIdx, "22050 Hz\0" "44100 Hz\0" "48000 Hz\0" "96000 Hz\0"))
+			SetDeviceParams(_rates[_rateIdx], bufferSize, targetLatencyMs);
+		if (ImGui::Combo("Buffer Size", &_bufferIdx, "64\0" "128\0" "256\0" "512\0" "1024\0" "2048\0"))
+			SetDeviceParams(sampleRate, _buffers[_bufferIdx], targetLatencyMs);
+		ImGui::SliderInt("Target Latency", &sm_imgui_latency_ms, 0, SM_MAX_TARGET_LATENCY_MS,
+			sm_imgui_latency_ms == 0 ? "Auto" : "%d ms");
+		if (ImGui::IsItemDeactivatedAfterEdit())	// the ring restarts on every change, so wait for the release
+			SetDeviceParams(sampleRate, bufferSize, sm_imgui_latency_ms);
+		else if (!ImGui::IsItemActive())
+			sm_imgui_latency_ms = (int)targetLatencyMs;
+		ImGui::EndDisabled();
+		ImGui::SameLine();
+		ImGui::TextDisabled("(?)");
+		if (ImGui::BeginItemTooltip())
+		{
+			ImGui::PushTextWrapPos(ImGui::GetFontSize() * 35.0f);
+			ImGui::TextUnformatted(
+								   "Time between the Apple 2 making a sound and hearing it.\n"
+								   "Auto keeps 2 device buffers queued on top of the one playing.\n"
+								   "Lower the buffer size to reduce the latency, raise it if the sound crackles.\n");
+			ImGui::PopTextWrapPos();
+			ImGui::EndTooltip();
+		}
+		ImGui::Separator();
+		ImGui::Text("Device: %u Hz, %u samples", obtainedSampleRate, obtainedBufferSize);
+		static float sm_imgui_latency = GetMeasuredLatency();
 		if ((SDL_GetTicks64() & 0xC0) == 0)
-			sm_imgui_samples_delay = (SM_BEEPER_BUFFER_SIZE + beeper_samples_idx_write - beeper_samples_idx_read) % SM_BEEPER_BUFFER_SIZE;
-		ImGui::Text("Write-Read Samples Delay: %d", sm_imgui_samples_delay);
-		ImGui::Text("Current Audio Driver: %s\n", SDL_GetCurrentAudioDriver());
+			sm_imgui_latency = GetMeasuredLatency();
+		ImGui::Text("Measured Latency: %.1f ms (%d queued + %u device)", 1000.f * sm_imgui_latency / obtainedSampleRate,
+			(int)(sm_imgui_latency - obtainedBufferSize), obtainedBufferSize);
+		ImGui::Text("Mockingboard Latency: %.1f ms",
+			1000.f * MockingboardManager::GetInstance()->GetMeasuredLatency() / obtainedSampleRate);
 		ImGui::EndMenu();
 	}
 }
@@ -229,7 +525,10 @@ nlohmann::json SoundManager::SerializeState()
 		{"sound_enabled", bIsEnabled},
 		{"sound_volume", beeper_volume},
 		{"mockingboard_volume", mockingboard_volume},
-		{"master_volume", master_volume}
+		{"master_volume", master_volume},
+		{"audio_sample_rate", sampleRate},
+		{"audio_buffer_size", bufferSize},
+		{"audio_target_latency_ms", targetLatencyMs}
 	};
 	return jsonState;
 }
@@ -240,4 +539,7 @@ void SoundManager::DeserializeState(const nlohmann::json &jsonState)
 	beeper_volume = jsonState.value("sound_volume", beeper_volume);
 	mockingboard_volume = jsonState.value("mockingboard_volume", mockingboard_volume);
 	master_volume = jsonState.value("master_volume", master_volume);
+	SetDeviceParams(jsonState.value("audio_sample_rate", sampleRate),
+		jsonState.value("audio_buffer_size", bufferSize),
+		jsonState.value("audio_target_latency_ms", targetLatencyMs));
 }
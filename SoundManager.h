@@ -4,11 +4,18 @@
 #include <SDL.h>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <string>
+#include <fstream>
 #include "nlohmann/json.hpp"
 #include "common.h"
+#include "SPSCQueue.h"
+#include "DriftController.h"
+#include "BeeperSynth.h"
 
 // This singleton class manages the Apple 2 speaker sound
-// All it needs is to be sent EventReceived(bool isC03x=false) on each cycle.
+// All it needs is to be sent EventReceived(bool isC03x=false) on each cycle,
+// or AdvanceCycles() for a run of cycles without any event.
 // Any time the passed in param is true, the speaker is switched low<->high
 // and kept in that position until the next param change.
 
@@ -16,12 +23,23 @@
 // so we have to do the mixing in SoundManager for anything audio
 
 
-const uint32_t SM_AUDIO_BUFLEN = 256;					// number of SDL_Audio samples in callback
-const uint32_t SM_BUFFER_DRIFT_LIMIT = 4096;			// Size to start trying to reduce the drift. At least 4096
-const uint32_t SM_BEEPER_BUFFER_SIZE = SM_AUDIO_BUFLEN * 10;	// circular buffer
-const uint32_t SM_BEEPER_DCADJ_BUFLEN = 256;
+const uint32_t SM_AUDIO_BUFLEN = 256;					// default number of SDL_Audio samples in callback
+const uint32_t SM_MIX_BLOCK = 256;						// samples mixed in one pass, at most AYUMI_MAX_BLOCK
+const uint32_t SM_BEEPER_TOGGLE_QUEUE_SIZE = 65536;	// speaker toggles in flight, power of 2 (250ms of the fastest toggling)
+const int64_t SM_BEEPER_RESYNC_THRESHOLD_SAMPLES = 2048;	// minimum drift from the latency target before resyncing
+const uint32_t SM_MAX_TARGET_LATENCY_MS = 250;			// highest selectable output latency
+const uint32_t SM_VIRTUAL_CLOCK_LEAD_BLOCKS = 2;		// blocks of bus cycles received before a virtual sink pulls a block
 const float SM_BASE_VOLUME_ADJUSTMENT = 0.6f;			// beeper base volume adjustment
 
+// Where the mixed audio goes
+enum class AudioSink_e
+{
+	SDL = 0,		// the audio device, pulled in real time by its callback
+	Null,			// discarded. Pulled by the bus, a block every time a block's worth of cycles went by
+	File,			// written to a WAV file (or raw float samples if it ends in .raw), pulled like Null
+	Offline,		// discarded, the owner calls MixBlock() itself, like AudioRenderer
+};
+
 class SoundManager {
 public:
 	~SoundManager();
@@ -32,10 +50,31 @@ public:
 	void StopPlay();
 	bool IsPlaying();
 	void EventReceived(bool isC03x = false);	// Received any event -- if isC03x then the event is a 0xC03x
+	void AdvanceCycles(uint64_t cycles);		// Idle cycles, for both the beeper and the Mockingboard
 	void SetPAL(bool isPal);				// Sets PAL (true) or NTSC (false)
 
-	// DC Adjustment
-	float DCAdjustment(float freq);
+	// Mixes the beeper and Mockingboard into interleaved stereo samples. This is what the
+	// audio callback plays, and what the offline renderer writes out. Any number of samples.
+	void MixBlock(float* stream, int samples);
+
+	// Requested audio device format. The device may not support it exactly, in which case
+	// it picks the closest rate and buffer size it can do, and those are used instead.
+	// A target latency of 0 is automatic: 2 device buffers queued on top of the one playing.
+	// Reopens the device if needed.
+	void SetDeviceParams(uint32_t sampleRate, uint32_t bufferSize, uint32_t targetLatencyMs);
+	// Format of the opened device (or of the offline render)
+	uint32_t GetSampleRate() { return obtainedSampleRate; };
+	uint32_t GetBufferSize() { return obtainedBufferSize; };
+	// Samples between a bus event and the speaker: the queued beeper samples plus the device buffer
+	float GetMeasuredLatency();
+
+	// Call before the first GetInstance(). All sinks but SDL run without any audio device,
+	// and the Null and File sinks pull the exact same blocks on every run of the same events.
+	static void SetSink(AudioSink_e sink, const std::string& filePath = "") { s_sink = sink; s_sinkPath = filePath; };
+	static AudioSink_e GetSink() { return s_sink; };
+	// Null and File sinks: pulls the blocks still owed for the cycles received and finishes the file
+	void CloseSink();
+	uint64_t GetSinkSampleCount() { return sinkSampleCount; };	// samples pulled by the Null and File sinks
 
 	// ImGUI and prefs
 	void DisplayImGuiChunk();
@@ -51,35 +90,68 @@ public:
 	}
 private:
 	static SoundManager* s_instance;
+	static AudioSink_e s_sink;
+	static std::string s_sinkPath;
 	SoundManager(uint32_t sampleRate, uint32_t bufferSize);
 	static void AudioCallback(void* userdata, uint8_t* stream, int len);
+	static bool HasDevice() { return s_sink == AudioSink_e::SDL; };
+	bool OpenDevice();
+	void CloseDevice();
+	void ApplyAudioFormat();
+	void StartVirtualClock();
+	void PullVirtualBlock();
 
 	SDL_AudioSpec audioSpec;
 	SDL_AudioDeviceID audioDevice;
-	uint32_t cyclesPerSample;					// Around 23.14. Changes between NTSC and PAL
-	uint32_t sampleRate;						// SDL_Audio sample rate
-	int bufferSize;								// SDL_Audio buffer size
+	double cyclesPerSample;						// Around 23.14. Changes between NTSC and PAL
+	uint32_t sampleRate;						// SDL_Audio sample rate, as requested
+	uint32_t bufferSize;						// SDL_Audio buffer size, as requested
+	uint32_t targetLatencyMs = 0;				// 0 is automatic
+	uint32_t obtainedSampleRate;				// what the device actually does
+	uint32_t obtainedBufferSize;
+	uint32_t beeperLatencySamples = SM_AUDIO_BUFLEN * 2;	// how far behind the bus the beeper is rendered
 	bool bIsEnabled = true;						// Did user enable speaker through HDMI?
 	bool bIsPlaying;							// Is the audio playing?
 	bool bIsPAL = false;						// Is the machine PAL?
 	
-	uint32_t beeper_samples_idx_read = 0;
-	uint32_t beeper_samples_idx_write = 0;
-	uint32_t beeper_samples_same_ct = 0;		// count of successive same samples (no freq change)
-	float beeper_samples[SM_BEEPER_BUFFER_SIZE];
-	float audioCallbackBuffer[SM_AUDIO_BUFLEN * 2] = { 0.f };	// Stereo
-	uint64_t ticks_per_sample;	// Depends on NTSC/PAL
-	uint64_t curr_tick = 0;	// tick value since the beginning of the sample
-	float curr_freq = -1.f;	// current frequency for the sample
+	// The bus thread only counts cycles and queues the speaker toggles with their cycle.
+	// The audio callback draws them as band-limited steps, beeperLatencySamples behind the bus.
+	// The bus and the audio device have their own clocks, so the render position advances
+	// slightly faster or slower than real time to hold that latency.
+	std::atomic<uint64_t> busCycle{ 0 };				// written by the bus thread
+	uint8_t speakerState = 0;							// bus thread only
+	SPSCQueue<uint64_t, SM_BEEPER_TOGGLE_QUEUE_SIZE> toggleQueue;	// (cycle << 1) | speaker state after the toggle
+	std::atomic<bool> bBeeperNeedsReset{ true };		// set by any thread, handled by the callback
+	bool bBeeperNeedsResync = true;						// audio thread only
+	double beeperRenderCycle = 0.0;						// bus cycle of the next sample to render
+	double beeperRenderCyclesPerSample = 1.0;			// cyclesPerSample adjusted for the clock drift
+	uint64_t beeperLastBusCycle = 0;					// busCycle seen at the previous block
+	DriftController beeperDrift{ SM_AUDIO_BUFLEN * 2 };	// audio thread only
+	BeeperSynth beeperSynth;							// audio thread only
+	float beeperBuffer[SM_MIX_BLOCK] = { 0.f };			// beeper block
+	std::atomic<float> beeperDriftPPM{ 0.f };			// for ImGui
+	std::atomic<float> beeperLatencyLevel{ 0.f };		// smoothed latency in samples, for ImGui
+	std::atomic<uint64_t> beeperResyncs{ 0 };			// times the render position jumped back to the bus
+	std::atomic<uint64_t> beeperLateToggles{ 0 };		// toggles that came after their sample was played
+	// Null and File sinks. The bus thread counts cycles and mixes a block whenever
+	// SM_VIRTUAL_CLOCK_LEAD_BLOCKS + n blocks worth of cycles have been received.
+	bool bHasVirtualClock = false;
+	uint64_t virtualCycle = 0;							// cycles received, bus thread only
+	uint64_t virtualBaseCycle = 0;						// virtualCycle when the clock started
+	uint64_t virtualBlockIndex = 0;						// blocks pulled since the clock started
+	uint64_t virtualNextPullCycle = UINT64_MAX;
+	double virtualCyclesPerBlock = 1.0;
+	std::vector<float> sinkBuffer;
+	std::ofstream sinkFile;
+	bool bSinkIsWav = true;
+	uint64_t sinkSampleCount = 0;
+
+	float mmLeftBuffer[SM_MIX_BLOCK] = { 0.f };			// Mockingboard block, left
+	float mmRightBuffer[SM_MIX_BLOCK] = { 0.f };		// Mockingboard block, right
 	float beeper_volume = 1.f;	// beeper sound volume
 	float mockingboard_volume = 1.f;	// mockingboard sound volume
 	float master_volume = 1.f;	// global sound volume
 	int sm_imgui_queued_audio_size = 0;	// for ImGui
-
-	// DC adjustment filter
-	float dcadj_sum;
-	uint32_t dcadj_pos;
-	float dcadj_buf[SM_BEEPER_DCADJ_BUFLEN];
 };
 
 #endif // SOUNDMANAGER_H
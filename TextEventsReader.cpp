@@ -0,0 +1,248 @@
+#include "TextEventsReader.h"
+#include <charconv>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+
+static inline bool IsBlank(char c)
+{
+	return (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+// Parses the field at p, up to the next comma or end, and moves p past that comma.
+// Returns false if it isn't a number.
+static bool ParseField(const char*& p, const char* end, uint64_t& value, int base)
+{
+	const char* _fieldEnd = static_cast<const char*>(memchr(p, ',', end - p));
+	if (_fieldEnd == nullptr)
+		_fieldEnd = end;
+	const char* _p = p;
+	while ((_p < _fieldEnd) && IsBlank(*_p))
+		++_p;
+	if ((base == 16) && (_fieldEnd - _p > 2) && (_p[0] == '0') && ((_p[1] == 'x') || (_p[1] == 'X')))
+		_p += 2;
+	auto [_ptr, _ec] = std::from_chars(_p, _fieldEnd, value, base);
+	if ((_ec != std::errc()) || (_ptr == _p))
+		return false;
+	while ((_ptr < _fieldEnd) && IsBlank(*_ptr))
+		++_ptr;
+	if (_ptr != _fieldEnd)
+		return false;
+	p = (_fieldEnd < end ? _fieldEnd + 1 : end);
+	return true;
+}
+
+void TextEventsReader::ParseBlock(Block& block, std::atomic<uint64_t>& parsedEvents)
+{
+	static const char* _fieldNames[] = { "count", "is_iigs", "m2b0", "m2sel", "rw", "addr", "data" };
+	const char* _line = block.begin;
+	while (_line < block.end)
+	{
+		const char* _lineEnd = static_cast<const char*>(memchr(_line, '\n', block.end - _line));
+		if (_lineEnd == nullptr)
+			_lineEnd = block.end;
+		++block.lineCount;
+		const char* _p = _line;
+		_line = _lineEnd + 1;
+		while ((_p < _lineEnd) && IsBlank(*_p))
+			++_p;
+		if ((_p == _lineEnd) || (*_p == '#'))
+			continue;	// Skip empty lines or lines starting with '#'
+
+		// Any fields after the 7th are ignored
+		uint64_t _values[7];
+		for (int i = 0; i < 7; ++i)
+		{
+			const int _base = (i >= 5 ? 16 : 10);
+			if ((_p >= _lineEnd) || !ParseField(_p, _lineEnd, _values[i], _base))
+			{
+				block.errorLine = block.lineCount;
+				block.error = std::string("bad or missing ") + _fieldNames[i] + " field";
+				return;
+			}
+		}
+		if (_values[0] > TER_MAX_COUNT)
+		{
+			block.errorLine = block.lineCount;
+			block.error = "count is over " + std::to_string(TER_MAX_COUNT);
+			return;
+		}
+		if ((_values[5] > 0xFFFF) || (_values[6] > 0xFF))
+		{
+			block.errorLine = block.lineCount;
+			block.error = (_values[5] > 0xFFFF ? "addr is over 0xFFFF" : "data is over 0xFF");
+			return;
+		}
+		// All the blocks count towards the limit, whatever the order they're parsed in
+		if (parsedEvents.fetch_add(_values[0]) + _values[0] > TER_MAX_EVENTS)
+		{
+			block.errorLine = block.lineCount;
+			block.bOverLimit = true;
+			return;
+		}
+		SDHREvent event(_values[1] != 0, _values[2] != 0, _values[3] != 0, _values[4] != 0,
+			static_cast<uint16_t>(_values[5]), static_cast<uint8_t>(_values[6]));
+		block.events.insert(block.events.end(), _values[0], event);
+	}
+}
+
+size_t TextEventsReader::FindLineOverLimit(const std::vector<Block>& blocks)
+{
+	size_t _lines = 0;
+	uint64_t _total = 0;
+	for (auto& _block : blocks)
+	{
+		size_t _blockLine = 0;
+		for (const char* _line = _block.begin; _line < _block.end; )
+		{
+			const char* _lineEnd = static_cast<const char*>(memchr(_line, '\n', _block.end - _line));
+			if (_lineEnd == nullptr)
+				_lineEnd = _block.end;
+			++_blockLine;
+			const char* _p = _line;
+			_line = _lineEnd + 1;
+			uint64_t _count = 0;
+			// The other lines were checked by ParseBlock(), or are after an error anyway
+			if (ParseField(_p, _lineEnd, _count, 10))
+			{
+				_total += _count;
+				if (_total > TER_MAX_EVENTS)
+					return _lines + _blockLine;
+			}
+		}
+		_lines += _blockLine;
+	}
+	return _lines;
+}
+
+bool TextEventsReader::Read(std::ifstream& file, std::vector<SDHREvent>& events)
+{
+	m_lastError.clear();
+	bytesDone = 0;
+	bytesTotal = 0;
+	// Read() runs on its own thread, an exception there would end the app
+	try
+	{
+		return ReadBlocks(file, events);
+	}
+	catch (const std::exception& e)
+	{
+		m_lastError = std::string("Not enough memory: ") + e.what();
+		return false;
+	}
+}
+
+bool TextEventsReader::ReadBlocks(std::ifstream& file, std::vector<SDHREvent>& events)
+{
+
+	// Read it whole
+	file.seekg(0, std::ios::end);
+	const std::streamoff _fileSize = file.tellg();
+	file.seekg(0, std::ios::beg);
+	if (!file.good() || (_fileSize < 0))
+	{
+		m_lastError = "Error reading file";
+		return false;
+	}
+	bytesTotal = 2 * static_cast<uint64_t>(_fileSize);
+	std::string _text(static_cast<size_t>(_fileSize), '\0');
+	size_t _size = 0;
+	while (_size < _text.size())
+	{
+		file.read(&_text[_size], std::min(TER_READ_SIZE, _text.size() - _size));
+		const size_t _read = static_cast<size_t>(file.gcount());
+		if (_read == 0)
+			break;		// text mode may read fewer bytes than the file size
+		_size += _read;
+		bytesDone += _read;
+	}
+	if (file.bad())
+	{
+		m_lastError = "Error reading file";
+		return false;
+	}
+	_text.resize(_size);
+	bytesTotal = bytesDone + _size;
+
+	// Split it in blocks of whole lines
+	std::vector<Block> _blocks;
+	const char* _begin = _text.data();
+	const char* _end = _begin + _text.size();
+	for (const char* _p = _begin; _p < _end; )
+	{
+		Block _block;
+		_block.begin = _p;
+		_block.end = _p + std::min<size_t>(TER_BLOCK_SIZE, _end - _p);
+		if (_block.end < _end)
+		{
+			const char* _nl = static_cast<const char*>(memchr(_block.end, '\n', _end - _block.end));
+			_block.end = (_nl == nullptr ? _end : _nl + 1);
+		}
+		_p = _block.end;
+		_blocks.push_back(std::move(_block));
+	}
+
+	// Parse them on all cores
+	std::atomic<size_t> _nextBlock { 0 };
+	std::atomic<uint64_t> _parsedEvents { 0 };
+	auto _worker = [&]() {
+		for (size_t i = _nextBlock++; i < _blocks.size(); i = _nextBlock++)
+		{
+			try
+			{
+				ParseBlock(_blocks[i], _parsedEvents);
+			}
+			catch (const std::exception& e)
+			{
+				_blocks[i].errorLine = std::max<size_t>(_blocks[i].lineCount, 1);
+				_blocks[i].error = std::string("not enough memory: ") + e.what();
+				std::vector<SDHREvent>().swap(_blocks[i].events);
+			}
+			bytesDone += _blocks[i].end - _blocks[i].begin;
+		}
+	};
+	const size_t _threadCount = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), _blocks.size());
+	std::vector<std::thread> _threads;
+	for (size_t t = 1; t < _threadCount; ++t)
+		_threads.emplace_back(_worker);
+	_worker();
+	for (auto& _thread : _threads)
+		_thread.join();
+
+	// And put them together in order, stopping at the first error
+	const std::string _overLimit = "over " + std::to_string(TER_MAX_EVENTS) + " events in the file";
+	size_t _lines = 0;
+	uint64_t _eventCount = 0;
+	for (auto& _block : _blocks)
+	{
+		// The block that hit the limit first may not be the first one over it in the file
+		if (_block.bOverLimit || (_eventCount + _block.events.size() > TER_MAX_EVENTS))
+		{
+			m_lastError = "Line " + std::to_string(FindLineOverLimit(_blocks)) + ": " + _overLimit;
+			return false;
+		}
+		if (_block.errorLine > 0)
+		{
+			m_lastError = "Line " + std::to_string(_lines + _block.errorLine) + ": " + _block.error;
+			return false;
+		}
+		_lines += _block.lineCount;
+		_eventCount += _block.events.size();
+	}
+	events.reserve(events.size() + _eventCount);
+	for (auto& _block : _blocks)
+	{
+		events.insert(events.end(), _block.events.begin(), _block.events.end());
+		std::vector<SDHREvent>().swap(_block.events);
+	}
+	bytesDone = bytesTotal.load();
+	return true;
+}
+
+float TextEventsReader::GetProgress()
+{
+	const uint64_t _total = bytesTotal;
+	if (_total == 0)
+		return 0.f;
+	return std::min(1.f, static_cast<float>(static_cast<double>(bytesDone) / _total));
+}
@@ -0,0 +1,62 @@
+#pragma once
+#ifndef TEXTEVENTSREADER_H
+#define TEXTEVENTSREADER_H
+
+/*
+	Reads CSV event files, as logged by bus analyzers. One event per line:
+		count,is_iigs,m2b0,m2sel,rw,addr,data
+	count is how many times in a row the event happens, addr and data are in hex.
+	Empty lines and lines starting with '#' are skipped.
+	A file can't have more than TER_MAX_EVENTS events, counting the repeats.
+
+	The file is read whole, then split into blocks of about TER_BLOCK_SIZE bytes that end
+	at line ends. The blocks are parsed on all cores and their events put back in order.
+	The progress can be read from another thread while Read() runs.
+*/
+
+#include "SDHRNetworking.h"	// for SDHREvent
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <atomic>
+
+constexpr size_t TER_BLOCK_SIZE = 4 * 1024 * 1024;
+constexpr size_t TER_READ_SIZE = 16 * 1024 * 1024;		// bytes read from the file between progress updates
+constexpr uint64_t TER_MAX_COUNT = 16'000'000;			// events per line, about 15 seconds of bus
+constexpr uint64_t TER_MAX_EVENTS = 256'000'000;		// events per file, about 4 minutes of bus and 2GB
+
+class TextEventsReader
+{
+public:
+	// Appends the events of the file. On error it returns false, and GetLastError()
+	// has the line number and the reason.
+	bool Read(std::ifstream& file, std::vector<SDHREvent>& events);
+
+	// From 0 to 1, reading then parsing
+	float GetProgress();
+	const std::string& GetLastError() { return m_lastError; };
+
+private:
+	struct Block
+	{
+		const char* begin = nullptr;
+		const char* end = nullptr;
+		std::vector<SDHREvent> events;
+		size_t lineCount = 0;
+		size_t errorLine = 0;		// in the block, from 1. 0 is no error.
+		std::string error;
+		bool bOverLimit = false;	// stopped because the file has over TER_MAX_EVENTS events
+	};
+	// parsedEvents is the running total of all the blocks, to stop at TER_MAX_EVENTS
+	static void ParseBlock(Block& block, std::atomic<uint64_t>& parsedEvents);
+	// The line where the file goes over TER_MAX_EVENTS, in the order of the file
+	static size_t FindLineOverLimit(const std::vector<Block>& blocks);
+	bool ReadBlocks(std::ifstream& file, std::vector<SDHREvent>& events);
+
+	std::atomic<uint64_t> bytesDone { 0 };
+	std::atomic<uint64_t> bytesTotal { 0 };
+	std::string m_lastError;
+};
+
+#endif // TEXTEVENTSREADER_H
@@ -0,0 +1,448 @@
+#include "VCRFile.h"
+#include "miniz.h"
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <algorithm>
+
+static const char VCR_MAGIC[8] = { 'S', 'D', 'D', 'V', 'C', 'R', '\r', '\n' };
+constexpr size_t VCR_HEADER_SIZE = 8 + 4 + 4 + 1 + 1 + 2 + 4 + 8 + 8 + 4 + 4;
+constexpr size_t VCR_CHUNK_HEADER_SIZE = 1 + 1 + 2 + 4 + 4 + 4;
+constexpr uint32_t VCR_MAX_CHUNK_SIZE = 64 * 1024 * 1024;	// sanity limit when reading
+
+static void PutLE(uint8_t*& p, uint64_t value, int bytes)
+{
+	for (int i = 0; i < bytes; ++i)
+		*p++ = static_cast<uint8_t>(value >> (8 * i));
+}
+
+static uint64_t GetLE(const uint8_t*& p, int bytes)
+{
+	uint64_t _value = 0;
+	for (int i = 0; i < bytes; ++i)
+		_value |= static_cast<uint64_t>(*p++) << (8 * i);
+	return _value;
+}
+
+static uint32_t VCRCrc32(const uint8_t* data, size_t size)
+{
+	return static_cast<uint32_t>(mz_crc32(MZ_CRC32_INIT, data, size));
+}
+
+bool VCRFile::SetError(const std::string& error)
+{
+	m_lastError = error;
+	std::cerr << "VCR: " << error << std::endl;
+	return false;
+}
+
+bool VCRFile::HasMagic(std::ifstream& file)
+{
+	char _magic[sizeof(VCR_MAGIC)] = {};
+	const auto _pos = file.tellg();
+	file.read(_magic, sizeof(_magic));
+	const bool _hasMagic = file.good() && (std::memcmp(_magic, VCR_MAGIC, sizeof(VCR_MAGIC)) == 0);
+	file.clear();
+	file.seekg(_pos);
+	return _hasMagic;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Writing
+//////////////////////////////////////////////////////////////////////////
+
+bool VCRFile::WriteHeader(std::ofstream& file, const VCRHeader& header)
+{
+	uint8_t _buf[VCR_HEADER_SIZE];
+	uint8_t* _p = _buf;
+	std::memcpy(_p, VCR_MAGIC, sizeof(VCR_MAGIC));
+	_p += sizeof(VCR_MAGIC);
+	PutLE(_p, header.version, 4);
+	PutLE(_p, VCR_HEADER_SIZE, 4);
+	PutLE(_p, static_cast<uint8_t>(header.region), 1);
+	PutLE(_p, static_cast<uint8_t>(header.machine), 1);
+	PutLE(_p, header.flags, 2);
+	PutLE(_p, header.chunkEvents, 4);
+	PutLE(_p, header.eventCount, 8);
+	PutLE(_p, header.snapshotInterval, 8);
+	PutLE(_p, header.snapshotCount, 4);
+	PutLE(_p, VCRCrc32(_buf, _p - _buf), 4);
+	file.write(reinterpret_cast<const char*>(_buf), sizeof(_buf));
+	if (!file.good())
+		return SetError("Error writing the header");
+	return true;
+}
+
+void VCRFile::EncodeData(VCRChunk_e type, const uint8_t* data, size_t size, VCRChunk& chunk)
+{
+	chunk.type = type;
+	chunk.size = static_cast<uint32_t>(size);
+	// Deflate it, but keep it as is if that doesn't help
+	mz_ulong _storedSize = mz_compressBound(static_cast<mz_ulong>(size));
+	chunk.stored.resize(_storedSize);
+	if ((mz_compress2(chunk.stored.data(), &_storedSize, data, static_cast<mz_ulong>(size), VCR_COMPRESSION_LEVEL) == MZ_OK)
+		&& (_storedSize < size))
+	{
+		chunk.encoding = VCREncoding_e::Deflate;
+		chunk.stored.resize(_storedSize);
+	}
+	else {
+		chunk.encoding = VCREncoding_e::Stored;
+		chunk.stored.assign(data, data + size);
+	}
+	chunk.crc = VCRCrc32(chunk.stored.data(), chunk.stored.size());
+}
+
+// Event flags in the flags plane
+constexpr uint8_t VCR_EVENT_IIGS = 0x01;
+constexpr uint8_t VCR_EVENT_M2B0 = 0x02;
+constexpr uint8_t VCR_EVENT_M2SEL = 0x04;
+constexpr uint8_t VCR_EVENT_READ = 0x08;
+constexpr uint8_t VCR_EVENT_NEXT = 0x10;		// address is the previous one + 1
+constexpr uint8_t VCR_EVENT_RESUME = 0x20;		// address is where the last run of NEXT addresses stopped + 1
+constexpr uint8_t VCR_EVENT_DELAY = 0x40;		// a run of idle cycles, see SDHREvent::MakeDelay()
+
+// Guesses the address of each event like the 6502 would move: code is fetched at the next address,
+// and after a few accesses elsewhere it carries on from where it stopped. Only the addresses it
+// misses are stored. The encoder and the decoder keep the same state.
+struct VCRAddressPredictor
+{
+	uint16_t prev = 0xFFFF;
+	uint16_t resume = 0;
+	bool bPrevPredicted = false;
+
+	uint8_t Predict(uint16_t addr)
+	{
+		if (addr == static_cast<uint16_t>(prev + 1))
+			return VCR_EVENT_NEXT;
+		if (addr == resume)
+			return VCR_EVENT_RESUME;
+		return 0;
+	}
+	uint16_t Address(uint8_t prediction)
+	{
+		return (prediction == VCR_EVENT_NEXT) ? static_cast<uint16_t>(prev + 1) : resume;
+	}
+	void Update(uint16_t addr, uint8_t prediction)
+	{
+		if ((prediction == 0) && bPrevPredicted)
+			resume = static_cast<uint16_t>(prev + 1);
+		bPrevPredicted = (prediction != 0);
+		prev = addr;
+	}
+};
+
+void VCRFile::EncodeEvents(const SDHREvent* events, size_t count, VCRChunk& chunk)
+{
+	// The count, then the flags and data planes, then the low and high address bytes that
+	// weren't predicted. Each plane is far more regular than the events one after the other.
+	std::vector<uint8_t> _packed(4 + count * 4);
+	uint8_t* _p = _packed.data();
+	PutLE(_p, count, 4);
+	uint8_t* _flags = _p;
+	uint8_t* _data = _flags + count;
+	uint8_t* _addrLo = _data + count;
+	VCRAddressPredictor _predictor;
+	size_t _literals = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const SDHREvent& _e = events[i];
+		const uint8_t _prediction = _predictor.Predict(_e.addr);
+		_flags[i] = (_e.is_iigs ? VCR_EVENT_IIGS : 0) | (_e.m2b0 ? VCR_EVENT_M2B0 : 0)
+			| (_e.m2sel ? VCR_EVENT_M2SEL : 0) | (_e.rw ? VCR_EVENT_READ : 0) | (_e.is_delay ? VCR_EVENT_DELAY : 0) | _prediction;
+		_data[i] = _e.data;
+		if (_prediction == 0)
+			_addrLo[_literals++] = static_cast<uint8_t>(_e.addr);
+		_predictor.Update(_e.addr, _prediction);
+	}
+	// The high bytes go right after the low bytes
+	uint8_t* _addrHi = _addrLo + _literals;
+	_predictor = VCRAddressPredictor();
+	for (size_t i = 0, _l = 0; i < count; ++i)
+	{
+		const uint8_t _prediction = _flags[i] & (VCR_EVENT_NEXT | VCR_EVENT_RESUME);
+		if (_prediction == 0)
+			_addrHi[_l++] = static_cast<uint8_t>(events[i].addr >> 8);
+		_predictor.Update(events[i].addr, _prediction);
+	}
+	_packed.resize(4 + count * 2 + _literals * 2);
+	EncodeData(VCRChunk_e::Events, _packed.data(), _packed.size(), chunk);
+}
+
+void VCRFile::EncodeSnapshotDelta(const uint8_t* data, const uint8_t* keyframe, size_t size,
+	uint32_t keyframeIndex, VCRChunk& chunk)
+{
+	const size_t _pageCount = size / VCR_SNAPSHOT_PAGE_SIZE;
+	const size_t _bitmapSize = (_pageCount + 7) / 8;
+	std::vector<uint8_t> _delta(4 + _bitmapSize);
+	uint8_t* _p = _delta.data();
+	PutLE(_p, keyframeIndex, 4);
+	for (size_t _page = 0; _page < _pageCount; ++_page)
+	{
+		const size_t _offset = _page * VCR_SNAPSHOT_PAGE_SIZE;
+		if (std::memcmp(data + _offset, keyframe + _offset, VCR_SNAPSHOT_PAGE_SIZE) == 0)
+			continue;
+		_delta[4 + _page / 8] |= static_cast<uint8_t>(1 << (_page % 8));
+		_delta.insert(_delta.end(), data + _offset, data + _offset + VCR_SNAPSHOT_PAGE_SIZE);
+	}
+	EncodeData(VCRChunk_e::SnapshotDelta, _delta.data(), _delta.size(), chunk);
+}
+
+bool VCRFile::WriteChunk(std::ofstream& file, const VCRChunk& chunk)
+{
+	uint8_t _buf[VCR_CHUNK_HEADER_SIZE];
+	uint8_t* _p = _buf;
+	PutLE(_p, static_cast<uint8_t>(chunk.type), 1);
+	PutLE(_p, static_cast<uint8_t>(chunk.encoding), 1);
+	PutLE(_p, 0, 2);
+	PutLE(_p, chunk.size, 4);
+	PutLE(_p, chunk.stored.size(), 4);
+	PutLE(_p, chunk.crc, 4);
+	file.write(reinterpret_cast<const char*>(_buf), sizeof(_buf));
+	file.write(reinterpret_cast<const char*>(chunk.stored.data()), chunk.stored.size());
+	if (!file.good())
+		return SetError("Error writing a chunk");
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Reading
+//////////////////////////////////////////////////////////////////////////
+
+bool VCRFile::ReadHeader(std::ifstream& file, VCRHeader& header)
+{
+	uint8_t _buf[VCR_HEADER_SIZE];
+	file.read(reinterpret_cast<char*>(_buf), sizeof(VCR_MAGIC) + 8);
+	if (!file.good() || (std::memcmp(_buf, VCR_MAGIC, sizeof(VCR_MAGIC)) != 0))
+		return SetError("Not a .vcr file");
+	const uint8_t* _p = _buf + sizeof(VCR_MAGIC);
+	header.version = static_cast<uint32_t>(GetLE(_p, 4));
+	const uint32_t _headerSize = static_cast<uint32_t>(GetLE(_p, 4));
+	if (header.version > VCR_VERSION)
+		return SetError("Recording version " + std::to_string(header.version) + " is too recent");
+	if (_headerSize != VCR_HEADER_SIZE)
+		return SetError("Bad header size");
+	file.read(reinterpret_cast<char*>(_buf) + sizeof(VCR_MAGIC) + 8, VCR_HEADER_SIZE - sizeof(VCR_MAGIC) - 8);
+	if (!file.good())
+		return SetError("Truncated header");
+	const uint32_t _crc = VCRCrc32(_buf, VCR_HEADER_SIZE - 4);
+
+	header.region = static_cast<VideoRegion_e>(GetLE(_p, 1));
+	header.machine = static_cast<VCRMachine_e>(GetLE(_p, 1));
+	header.flags = static_cast<uint16_t>(GetLE(_p, 2));
+	header.chunkEvents = static_cast<uint32_t>(GetLE(_p, 4));
+	header.eventCount = GetLE(_p, 8);
+	header.snapshotInterval = GetLE(_p, 8);
+	header.snapshotCount = static_cast<uint32_t>(GetLE(_p, 4));
+	if (static_cast<uint32_t>(GetLE(_p, 4)) != _crc)
+		return SetError("Header checksum mismatch");
+	if ((header.chunkEvents == 0) || (header.chunkEvents > VCR_MAX_CHUNK_SIZE / 4) || (header.snapshotInterval == 0))
+		return SetError("Bad header values");
+	return true;
+}
+
+bool VCRFile::ReadChunkHeader(std::ifstream& file, VCRChunk& chunk, uint32_t& storedSize)
+{
+	uint8_t _buf[VCR_CHUNK_HEADER_SIZE];
+	file.read(reinterpret_cast<char*>(_buf), sizeof(_buf));
+	if (!file.good())
+		return SetError("Truncated file");
+	const uint8_t* _p = _buf;
+	chunk.type = static_cast<VCRChunk_e>(GetLE(_p, 1));
+	chunk.encoding = static_cast<VCREncoding_e>(GetLE(_p, 1));
+	GetLE(_p, 2);
+	chunk.size = static_cast<uint32_t>(GetLE(_p, 4));
+	storedSize = static_cast<uint32_t>(GetLE(_p, 4));
+	chunk.crc = static_cast<uint32_t>(GetLE(_p, 4));
+	if ((chunk.size > VCR_MAX_CHUNK_SIZE) || (storedSize > VCR_MAX_CHUNK_SIZE))
+		return SetError("Bad chunk size");
+	if ((chunk.encoding != VCREncoding_e::Stored) && (chunk.encoding != VCREncoding_e::Deflate))
+		return SetError("Unknown chunk encoding");
+	return true;
+}
+
+bool VCRFile::ReadChunk(std::ifstream& file, VCRChunk& chunk)
+{
+	uint32_t _storedSize = 0;
+	if (!ReadChunkHeader(file, chunk, _storedSize))
+		return false;
+	chunk.stored.resize(_storedSize);
+	file.read(reinterpret_cast<char*>(chunk.stored.data()), _storedSize);
+	if (!file.good())
+		return SetError("Truncated chunk");
+	return true;
+}
+
+bool VCRFile::SkipChunk(std::ifstream& file, VCRChunk_e& type)
+{
+	VCRChunk _chunk;
+	uint32_t _storedSize = 0;
+	if (!ReadChunkHeader(file, _chunk, _storedSize))
+		return false;
+	type = _chunk.type;
+	// Seeking past the end doesn't fail, check that the chunk is all there
+	const auto _end = file.tellg() + static_cast<std::streamoff>(_storedSize);
+	file.seekg(0, std::ios::end);
+	if (file.tellg() < _end)
+		return SetError("Truncated chunk");
+	file.seekg(_end);
+	return true;
+}
+
+bool VCRFile::DecodeData(const VCRChunk& chunk, uint8_t* data)
+{
+	if (VCRCrc32(chunk.stored.data(), chunk.stored.size()) != chunk.crc)
+		return false;
+	if (chunk.encoding == VCREncoding_e::Stored)
+	{
+		if (chunk.stored.size() != chunk.size)
+			return false;
+		std::memcpy(data, chunk.stored.data(), chunk.size);
+	}
+	else {
+		mz_ulong _outSize = chunk.size;
+		if ((mz_uncompress(data, &_outSize, chunk.stored.data(), static_cast<mz_ulong>(chunk.stored.size())) != MZ_OK)
+			|| (_outSize != chunk.size))
+			return false;
+	}
+	return true;
+}
+
+bool VCRFile::DecodeEvents(const VCRChunk& chunk, std::vector<SDHREvent>& events)
+{
+	if (chunk.size < 4)
+		return false;
+	std::vector<uint8_t> _packed(chunk.size);
+	if (!DecodeData(chunk, _packed.data()))
+		return false;
+	const uint8_t* _p = _packed.data();
+	const size_t _count = static_cast<size_t>(GetLE(_p, 4));
+	if (4 + _count * 2 > _packed.size())
+		return false;
+	const uint8_t* _flags = _p;
+	const uint8_t* _data = _flags + _count;
+	const uint8_t* _addrLo = _data + _count;
+	const size_t _literals = (_packed.size() - 4 - _count * 2) / 2;
+	const uint8_t* _addrHi = _addrLo + _literals;
+	events.reserve(events.size() + _count);
+	VCRAddressPredictor _predictor;
+	size_t _l = 0;
+	for (size_t i = 0; i < _count; ++i)
+	{
+		const uint8_t _f = _flags[i];
+		const uint8_t _prediction = _f & (VCR_EVENT_NEXT | VCR_EVENT_RESUME);
+		uint16_t _addr;
+		if (_prediction == 0)
+		{
+			if (_l >= _literals)
+				return false;
+			_addr = static_cast<uint16_t>(_addrLo[_l] | (_addrHi[_l] << 8));
+			++_l;
+		}
+		else
+			_addr = _predictor.Address(_prediction);
+		_predictor.Update(_addr, _prediction);
+		events.emplace_back(_f & VCR_EVENT_IIGS, _f & VCR_EVENT_M2B0, _f & VCR_EVENT_M2SEL, _f & VCR_EVENT_READ, _addr, _data[i]);
+		events.back().is_delay = (_f & VCR_EVENT_DELAY) != 0;
+	}
+	return _l == _literals;
+}
+
+bool VCRFile::GetDeltaKeyframe(const std::vector<uint8_t>& delta, uint32_t& keyframeIndex)
+{
+	if (delta.size() < 4)
+		return false;
+	const uint8_t* _p = delta.data();
+	keyframeIndex = static_cast<uint32_t>(GetLE(_p, 4));
+	return true;
+}
+
+bool VCRFile::ApplySnapshotDelta(const std::vector<uint8_t>& delta, uint8_t* data, size_t size)
+{
+	const size_t _pageCount = size / VCR_SNAPSHOT_PAGE_SIZE;
+	const size_t _bitmapSize = (_pageCount + 7) / 8;
+	if (delta.size() < 4 + _bitmapSize)
+		return false;
+	const uint8_t* _bitmap = delta.data() + 4;
+	const uint8_t* _pages = _bitmap + _bitmapSize;
+	const uint8_t* _end = delta.data() + delta.size();
+	for (size_t _page = 0; _page < _pageCount; ++_page)
+	{
+		if ((_bitmap[_page / 8] & (1 << (_page % 8))) == 0)
+			continue;
+		if (_pages + VCR_SNAPSHOT_PAGE_SIZE > _end)
+			return false;
+		std::memcpy(data + _page * VCR_SNAPSHOT_PAGE_SIZE, _pages, VCR_SNAPSHOT_PAGE_SIZE);
+		_pages += VCR_SNAPSHOT_PAGE_SIZE;
+	}
+	return _pages == _end;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Whole recordings
+//////////////////////////////////////////////////////////////////////////
+
+// Runs fn(i) for i in [0, count) on up to threadCount threads
+template <typename F>
+static void ParallelFor(size_t count, size_t threadCount, F fn)
+{
+	std::vector<std::thread> _threads;
+	for (size_t t = 1; t < std::min(threadCount, count); ++t)
+	{
+		_threads.emplace_back([=]() {
+			for (size_t i = t; i < count; i += threadCount)
+				fn(i);
+		});
+	}
+	for (size_t i = 0; i < count; i += threadCount)
+		fn(i);
+	for (auto& _thread : _threads)
+		_thread.join();
+}
+
+static size_t VCRThreadCount()
+{
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+bool VCRFile::WriteRecording(std::ofstream& file, const VCRHeader& header,
+	const std::vector<SDHREvent>& events, const std::vector<ByteBuffer>& snapshots, size_t snapshotSize)
+{
+	if (!WriteHeader(file, header))
+		return false;
+
+	// List the chunks in file order: each snapshot goes right before the events that start from it.
+	// For snapshots, first is the snapshot index.
+	struct Job { VCRChunk_e type; size_t first; size_t count; };
+	std::vector<Job> _jobs;
+	size_t _nextSnapshot = 0;
+	for (size_t _first = 0; _first < events.size(); _first += header.chunkEvents)
+	{
+		const size_t _count = std::min(events.size() - _first, static_cast<size_t>(header.chunkEvents));
+		for (; (_nextSnapshot < snapshots.size()) && (_nextSnapshot * header.snapshotInterval < _first + _count); ++_nextSnapshot)
+			_jobs.push_back({ VCRChunk_e::Snapshot, _nextSnapshot, 1 });
+		_jobs.push_back({ VCRChunk_e::Events, _first, _count });
+	}
+	for (; _nextSnapshot < snapshots.size(); ++_nextSnapshot)
+		_jobs.push_back({ VCRChunk_e::Snapshot, _nextSnapshot, 1 });
+
+	const size_t _threadCount = VCRThreadCount();
+	std::vector<VCRChunk> _chunks(_threadCount * VCR_BATCH_CHUNKS_PER_THREAD);
+	for (size_t _batchStart = 0; _batchStart < _jobs.size(); _batchStart += _chunks.size())
+	{
+		const size_t _batchCount = std::min(_chunks.size(), _jobs.size() - _batchStart);
+		ParallelFor(_batchCount, _threadCount, [&](size_t i) {
+			const Job& _job = _jobs[_batchStart + i];
+			if (_job.type == VCRChunk_e::Events)
+				EncodeEvents(events.data() + _job.first, _job.count, _chunks[i]);
+			else
+				EncodeData(VCRChunk_e::Snapshot, snapshots[_job.first].data(), snapshotSize, _chunks[i]);
+		});
+		for (size_t i = 0; i < _batchCount; ++i)
+		{
+			if (!WriteChunk(file, _chunks[i]))
+				return false;
+		}
+	}
+	return true;
+}
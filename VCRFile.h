@@ -0,0 +1,151 @@
+#pragma once
+#ifndef VCRFILE_H
+#define VCRFILE_H
+
+/*
+	The .vcr recording container.
+
+	A header, then a list of chunks, each compressed on its own with deflate and
+	checked with a CRC32:
+
+	Header:
+		8 bytes		magic "SDDVCR\r\n"
+		uint32		version
+		uint32		header size, including the magic and the CRC
+		uint8		video region (VideoRegion_e)
+		uint8		machine (VCRMachine_e)
+		uint16		flags (VCR_FLAG_*)
+		uint32		max events per event chunk
+		uint64		event count
+		uint64		memory snapshot interval, in events
+		uint32		memory snapshot count
+		uint32		CRC32 of all the above
+
+	Chunk:
+		uint8		type (VCRChunk_e)
+		uint8		encoding (VCREncoding_e)
+		uint16		0
+		uint32		uncompressed size
+		uint32		stored size
+		uint32		CRC32 of the stored content
+		...			stored content
+
+	An event chunk holds "max events per chunk" events, except the last one. They're split
+	into planes, which deflate far better than the events one after the other: the flags
+	with the address predictions, the data, then the low and high bytes of the addresses
+	that weren't predicted. Delay events have their own flag, and their cycle count in the
+	address and data.
+	The chunk CRC32 is of the stored content, deflate already checks what it uncompresses.
+	A snapshot is either a full copy of memory (a keyframe), or a delta: the 256-byte pages
+	that differ from an earlier keyframe. A delta chunk holds the index of its keyframe in
+	the snapshots, a bitmap of the pages it has, then those pages.
+	Snapshot chunks are written before the event chunk that holds their first event.
+	All values are little-endian.
+
+	Event chunks don't depend on each other, so whole recordings are compressed on all
+	cores, while the file itself is written in order.
+
+	Files that don't start with the magic are in the legacy format, which EventRecorder
+	still reads.
+*/
+
+#include "SDHRNetworking.h"	// for SDHREvent
+#include "CycleCounter.h"	// for VideoRegion_e
+#include "ByteBuffer.h"
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <fstream>
+
+constexpr uint32_t VCR_VERSION = 3;				// 2 added snapshot deltas, 3 delay events
+constexpr size_t VCR_SNAPSHOT_PAGE_SIZE = 256;
+constexpr uint32_t VCR_CHUNK_EVENTS = 1 << 16;
+constexpr int VCR_COMPRESSION_LEVEL = 1;		// deflate level, speed matters more than the last %
+constexpr uint32_t VCR_BATCH_CHUNKS_PER_THREAD = 4;	// chunks in memory at once, per thread
+
+// Header flags
+constexpr uint16_t VCR_FLAG_FILTERED = 0x0001;	// only the events that change state, with delay events for the others
+
+enum class VCRMachine_e : uint8_t
+{
+	Apple2e = 0,
+	Apple2gs = 1
+};
+
+enum class VCRChunk_e : uint8_t
+{
+	Events = 'E',
+	Snapshot = 'S',
+	SnapshotDelta = 'D'
+};
+
+enum class VCREncoding_e : uint8_t
+{
+	Stored = 0,
+	Deflate = 1
+};
+
+struct VCRHeader
+{
+	uint32_t version = VCR_VERSION;
+	VideoRegion_e region = VideoRegion_e::NTSC;
+	VCRMachine_e machine = VCRMachine_e::Apple2e;
+	uint16_t flags = 0;
+	uint32_t chunkEvents = VCR_CHUNK_EVENTS;
+	uint64_t eventCount = 0;
+	uint64_t snapshotInterval = 0;
+	uint32_t snapshotCount = 0;
+};
+
+// A chunk as stored in the file
+struct VCRChunk
+{
+	VCRChunk_e type = VCRChunk_e::Events;
+	VCREncoding_e encoding = VCREncoding_e::Stored;
+	uint32_t size = 0;			// uncompressed
+	uint32_t crc = 0;			// of the stored content
+	std::vector<uint8_t> stored;
+};
+
+class VCRFile
+{
+public:
+	// Returns true if the file starts with the .vcr magic. The read position is restored.
+	static bool HasMagic(std::ifstream& file);
+
+	// Whole recordings in memory, written as full snapshots of snapshotSize bytes each.
+	// VCRReader reads them back. All return false on error, with the reason in GetLastError()
+	bool WriteRecording(std::ofstream& file, const VCRHeader& header,
+		const std::vector<SDHREvent>& events, const std::vector<ByteBuffer>& snapshots, size_t snapshotSize);
+
+	// Building blocks. The static ones are safe to call from several threads at once.
+	bool WriteHeader(std::ofstream& file, const VCRHeader& header);
+	bool ReadHeader(std::ifstream& file, VCRHeader& header);
+	static void EncodeEvents(const SDHREvent* events, size_t count, VCRChunk& chunk);
+	static void EncodeData(VCRChunk_e type, const uint8_t* data, size_t size, VCRChunk& chunk);
+	// The pages of data that differ from keyframe, which is snapshot keyframeIndex
+	static void EncodeSnapshotDelta(const uint8_t* data, const uint8_t* keyframe, size_t size,
+		uint32_t keyframeIndex, VCRChunk& chunk);
+	bool WriteChunk(std::ofstream& file, const VCRChunk& chunk);
+	bool ReadChunk(std::ifstream& file, VCRChunk& chunk);
+	// Moves past the next chunk, for indexing
+	bool SkipChunk(std::ifstream& file, VCRChunk_e& type);
+	// Uncompresses and checks the chunk's content. Returns false if it's corrupt.
+	static bool DecodeData(const VCRChunk& chunk, uint8_t* data);
+	// Appends the events of an event chunk. Returns false if it's corrupt.
+	static bool DecodeEvents(const VCRChunk& chunk, std::vector<SDHREvent>& events);
+	// For the uncompressed content of a delta chunk: its keyframe, and applying it over a copy
+	// of that keyframe. Both return false if the content is corrupt.
+	static bool GetDeltaKeyframe(const std::vector<uint8_t>& delta, uint32_t& keyframeIndex);
+	static bool ApplySnapshotDelta(const std::vector<uint8_t>& delta, uint8_t* data, size_t size);
+
+	const std::string& GetLastError() { return m_lastError; };
+
+private:
+	bool ReadChunkHeader(std::ifstream& file, VCRChunk& chunk, uint32_t& storedSize);
+	bool SetError(const std::string& error);
+
+	std::string m_lastError;
+};
+
+#endif // VCRFILE_H
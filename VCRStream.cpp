@@ -0,0 +1,330 @@
+#include "VCRStream.h"
+#include <iostream>
+#include <algorithm>
+
+//////////////////////////////////////////////////////////////////////////
+// VCRWriter
+//////////////////////////////////////////////////////////////////////////
+
+bool VCRWriter::Open(const std::string& path, const VCRHeader& header)
+{
+	Close();
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		m_lastError = "Can't create " + path;
+		return false;
+	}
+	m_header = header;
+	m_header.eventCount = 0;
+	m_header.snapshotCount = 0;
+	eventCount = 0;
+	snapshotCount = 0;
+	bytesWritten = 0;
+	bFailed = false;
+	m_lastError.clear();
+	// The counts are 0 until Close(), which is how the reader knows the recording wasn't finished
+	if (!vcr.WriteHeader(file, m_header))
+	{
+		m_lastError = vcr.GetLastError();
+		file.close();
+		return false;
+	}
+	v_chunkEvents.clear();
+	v_chunkEvents.reserve(m_header.chunkEvents);
+	v_keyframe.clear();
+	m_keyframeIndex = 0;
+	q_jobs.clear();
+	thread_writer = std::thread(&VCRWriter::writer_thread, this);
+	return true;
+}
+
+void VCRWriter::AddEvent(const SDHREvent& event)
+{
+	if (eventCount == 0)
+		m_header.machine = (event.is_iigs ? VCRMachine_e::Apple2gs : VCRMachine_e::Apple2e);
+	v_chunkEvents.push_back(event);
+	++eventCount;
+	if (v_chunkEvents.size() == m_header.chunkEvents)
+		SubmitEvents();
+}
+
+void VCRWriter::AddSnapshot(const uint8_t* data, size_t size, bool bKeyframe)
+{
+	Job _job;
+	// The first snapshot has nothing to be a delta of
+	_job.type = (bKeyframe || (snapshotCount == 0)) ? VCRChunk_e::Snapshot : VCRChunk_e::SnapshotDelta;
+	_job.data.assign(data, data + size);
+	q_jobs.push(std::move(_job));
+	++snapshotCount;
+}
+
+void VCRWriter::SubmitEvents()
+{
+	Job _job;
+	_job.type = VCRChunk_e::Events;
+	_job.events.swap(v_chunkEvents);
+	q_jobs.push(std::move(_job));
+	v_chunkEvents.reserve(m_header.chunkEvents);
+}
+
+bool VCRWriter::Close()
+{
+	if (!thread_writer.joinable())
+		return !bFailed;
+	if (!v_chunkEvents.empty())
+		SubmitEvents();
+	Job _stop;
+	_stop.bStop = true;
+	q_jobs.push(std::move(_stop));
+	thread_writer.join();
+
+	m_header.eventCount = eventCount;
+	m_header.snapshotCount = snapshotCount;
+	file.seekp(0);
+	if (!vcr.WriteHeader(file, m_header))
+		bFailed = true;
+	file.close();
+	if (bFailed && m_lastError.empty())
+		m_lastError = vcr.GetLastError();
+	return !bFailed;
+}
+
+void VCRWriter::writer_thread()
+{
+	VCRChunk _chunk;
+	uint32_t _snapshotIndex = 0;
+	while (true)
+	{
+		Job _job = q_jobs.pop();
+		if (_job.bStop)
+			break;
+		if (bFailed)
+			continue;	// drain the queue, the file is unusable
+		if (_job.type == VCRChunk_e::Events)
+			VCRFile::EncodeEvents(_job.events.data(), _job.events.size(), _chunk);
+		else if (_job.type == VCRChunk_e::Snapshot)
+		{
+			VCRFile::EncodeData(_job.type, _job.data.data(), _job.data.size(), _chunk);
+			v_keyframe.swap(_job.data);
+			m_keyframeIndex = _snapshotIndex++;
+		}
+		else
+		{
+			VCRFile::EncodeSnapshotDelta(_job.data.data(), v_keyframe.data(), _job.data.size(), m_keyframeIndex, _chunk);
+			++_snapshotIndex;
+		}
+		if (!vcr.WriteChunk(file, _chunk))
+		{
+			std::cerr << "VCR: stopped writing the recording, " << vcr.GetLastError() << std::endl;
+			bFailed = true;
+			continue;
+		}
+		bytesWritten += _chunk.stored.size();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// VCRReader
+//////////////////////////////////////////////////////////////////////////
+
+bool VCRReader::Open(const std::string& path)
+{
+	Close();
+	m_path = path;
+	m_lastError.clear();
+	file.open(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		m_lastError = "Can't open " + path;
+		return false;
+	}
+	if (!vcr.ReadHeader(file, m_header))
+	{
+		m_lastError = vcr.GetLastError();
+		file.close();
+		return false;
+	}
+
+	// Index the chunks. A recording that wasn't closed has no counts in its header,
+	// and may end with a partly written chunk: keep everything before it.
+	const bool _bFinished = (m_header.eventCount > 0) || (m_header.snapshotCount > 0);
+	v_eventChunkOffsets.clear();
+	v_snapshotOffsets.clear();
+	while (true)
+	{
+		if (_bFinished && (v_snapshotOffsets.size() == m_header.snapshotCount)
+			&& (static_cast<uint64_t>(v_eventChunkOffsets.size()) * m_header.chunkEvents >= m_header.eventCount))
+			break;
+		const std::streamoff _offset = file.tellg();
+		if (file.peek() == std::char_traits<char>::eof())
+			break;
+		VCRChunk_e _type;
+		if (!vcr.SkipChunk(file, _type))
+		{
+			if (_bFinished)
+			{
+				m_lastError = vcr.GetLastError();
+				file.close();
+				return false;
+			}
+			break;
+		}
+		if (_type == VCRChunk_e::Events)
+			v_eventChunkOffsets.push_back(_offset);
+		else if ((_type == VCRChunk_e::Snapshot) || (_type == VCRChunk_e::SnapshotDelta))
+			v_snapshotOffsets.push_back(_offset);
+	}
+	file.clear();
+
+	// All event chunks are full except the last, decode it to count its events
+	uint64_t _eventCount = 0;
+	if (!v_eventChunkOffsets.empty())
+	{
+		VCRChunk _chunk;
+		std::vector<SDHREvent> _events;
+		if (!ReadChunkAt(v_eventChunkOffsets.back(), _chunk) || !VCRFile::DecodeEvents(_chunk, _events))
+		{
+			m_lastError = "Corrupt chunk";
+			file.close();
+			return false;
+		}
+		_eventCount = (v_eventChunkOffsets.size() - 1) * static_cast<uint64_t>(m_header.chunkEvents) + _events.size();
+	}
+	if (_bFinished && ((_eventCount != m_header.eventCount) || (v_snapshotOffsets.size() != m_header.snapshotCount)))
+	{
+		m_lastError = "Recording content doesn't match its header";
+		file.close();
+		return false;
+	}
+	if (!_bFinished)
+	{
+		std::cout << "VCR: recovered " << _eventCount << " events from unfinished recording " << path << std::endl;
+		m_header.eventCount = _eventCount;
+		m_header.snapshotCount = static_cast<uint32_t>(v_snapshotOffsets.size());
+	}
+	if (v_snapshotOffsets.empty() && _eventCount > 0)
+	{
+		m_lastError = "Recording has no memory snapshot";
+		file.close();
+		return false;
+	}
+
+	m_cache.clear();
+	v_keyframe.clear();
+	m_wantedChunk = 0;
+	bStopPrefetch = false;
+	thread_prefetch = std::thread(&VCRReader::prefetch_thread, this);
+	return true;
+}
+
+void VCRReader::Close()
+{
+	if (thread_prefetch.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> _lock(cacheMutex);
+			bStopPrefetch = true;
+		}
+		cacheCV.notify_all();
+		thread_prefetch.join();
+	}
+	m_cache.clear();
+	if (file.is_open())
+		file.close();
+}
+
+bool VCRReader::ReadChunkAt(std::streamoff offset, VCRChunk& chunk)
+{
+	std::lock_guard<std::mutex> _lock(fileMutex);
+	file.clear();
+	file.seekg(offset);
+	return vcr.ReadChunk(file, chunk);
+}
+
+bool VCRReader::ReadSnapshot(size_t snapshotIndex, uint8_t* data, size_t size)
+{
+	if (snapshotIndex >= v_snapshotOffsets.size())
+		return false;
+	VCRChunk _chunk;
+	if (!ReadChunkAt(v_snapshotOffsets[snapshotIndex], _chunk))
+		return false;
+	if (_chunk.type == VCRChunk_e::Snapshot)
+		return (_chunk.size == size) && VCRFile::DecodeData(_chunk, data);
+
+	// A delta: apply it over its keyframe, which is kept for the next deltas
+	std::vector<uint8_t> _delta(_chunk.size);
+	uint32_t _keyframeIndex = 0;
+	if (!VCRFile::DecodeData(_chunk, _delta.data()) || !VCRFile::GetDeltaKeyframe(_delta, _keyframeIndex)
+		|| (_keyframeIndex >= snapshotIndex))
+		return false;
+	if ((v_keyframe.size() != size) || (m_keyframeIndex != _keyframeIndex))
+	{
+		v_keyframe.clear();
+		if (!ReadChunkAt(v_snapshotOffsets[_keyframeIndex], _chunk) || (_chunk.type != VCRChunk_e::Snapshot)
+			|| (_chunk.size != size))
+			return false;
+		v_keyframe.resize(size);
+		if (!VCRFile::DecodeData(_chunk, v_keyframe.data()))
+		{
+			v_keyframe.clear();
+			return false;
+		}
+		m_keyframeIndex = _keyframeIndex;
+	}
+	std::copy(v_keyframe.begin(), v_keyframe.end(), data);
+	return VCRFile::ApplySnapshotDelta(_delta, data, size);
+}
+
+std::shared_ptr<const std::vector<SDHREvent>> VCRReader::GetEventChunk(size_t chunkIndex)
+{
+	std::unique_lock<std::mutex> _lock(cacheMutex);
+	if (chunkIndex >= v_eventChunkOffsets.size())
+		return nullptr;
+	if (m_wantedChunk != chunkIndex)
+	{
+		m_wantedChunk = chunkIndex;
+		cacheCV.notify_all();
+	}
+	cacheCV.wait(_lock, [&] { return (m_cache.count(chunkIndex) > 0) || bStopPrefetch; });
+	auto _it = m_cache.find(chunkIndex);
+	return (_it == m_cache.end()) ? nullptr : _it->second;
+}
+
+void VCRReader::prefetch_thread()
+{
+	VCRChunk _chunk;
+	std::unique_lock<std::mutex> _lock(cacheMutex);
+	while (!bStopPrefetch)
+	{
+		// Drop what's out of the window and decode the first missing chunk in it
+		const size_t _first = m_wantedChunk;
+		const size_t _last = std::min(_first + VCRSTREAM_PREFETCH_CHUNKS, v_eventChunkOffsets.size());
+		for (auto _it = m_cache.begin(); _it != m_cache.end();)
+		{
+			if ((_it->first < _first) || (_it->first >= _last))
+				_it = m_cache.erase(_it);
+			else
+				++_it;
+		}
+		size_t _next = _first;
+		while ((_next < _last) && (m_cache.count(_next) > 0))
+			++_next;
+		if (_next >= _last)
+		{
+			cacheCV.wait(_lock, [&] { return bStopPrefetch || (m_wantedChunk != _first); });
+			continue;
+		}
+
+		_lock.unlock();
+		auto _events = std::make_shared<std::vector<SDHREvent>>();
+		_events->reserve(m_header.chunkEvents);
+		const bool _ok = ReadChunkAt(v_eventChunkOffsets[_next], _chunk) && VCRFile::DecodeEvents(_chunk, *_events);
+		if (!_ok)
+			std::cerr << "VCR: corrupt event chunk " << _next << " in " << m_path << std::endl;
+		_lock.lock();
+		// Failed chunks are cached as nullptr so that the reader doesn't wait forever
+		m_cache[_next] = _ok ? std::shared_ptr<const std::vector<SDHREvent>>(std::move(_events)) : nullptr;
+		cacheCV.notify_all();
+	}
+}
@@ -0,0 +1,124 @@
+#pragma once
+#ifndef VCRSTREAM_H
+#define VCRSTREAM_H
+
+/*
+	Streams .vcr recordings to and from disk, so that their length is only limited by the disk.
+
+	VCRWriter is fed events and memory snapshots as they happen. It fills one event chunk at
+	a time and hands the full chunks to a thread that compresses and writes them. The header
+	is rewritten with the final counts when it's closed. If it never is, VCRReader recovers
+	the recording from its chunks.
+
+	VCRReader indexes the chunks of a file when it's opened, and only uncompresses the event
+	chunks around the read position: a thread decodes the next VCRSTREAM_PREFETCH_CHUNKS chunks
+	ahead of the reader. Memory snapshots are read from the file when they're needed, along
+	with the keyframe of a delta if it isn't the one of the previous delta.
+
+	The memory used by either is a few chunks, whatever the length of the recording.
+*/
+
+#include "VCRFile.h"
+#include "ConcurrentQueue.h"
+#include <memory>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+constexpr size_t VCRSTREAM_PREFETCH_CHUNKS = 4;		// event chunks decoded ahead of the reader
+
+class VCRWriter
+{
+public:
+	~VCRWriter() { Close(); };
+
+	// Creates the file and starts the writing thread
+	bool Open(const std::string& path, const VCRHeader& header);
+	// Both are meant for the thread that records. A snapshot is stored before the events that follow it.
+	// Snapshots that aren't keyframes are stored as a delta of the last keyframe.
+	void AddEvent(const SDHREvent& event);
+	void AddSnapshot(const uint8_t* data, size_t size, bool bKeyframe);
+	// Writes what's left and the final header. Returns false if anything failed to be written.
+	bool Close();
+
+	bool IsOpen() { return thread_writer.joinable(); };
+	uint64_t GetEventCount() { return eventCount; };
+	uint64_t GetBytesWritten() { return bytesWritten; };
+	const std::string& GetLastError() { return m_lastError; };
+
+private:
+	struct Job
+	{
+		VCRChunk_e type = VCRChunk_e::Events;
+		std::vector<SDHREvent> events;
+		std::vector<uint8_t> data;
+		bool bStop = false;
+	};
+	void writer_thread();
+	void SubmitEvents();
+
+	std::ofstream file;
+	VCRFile vcr;
+	VCRHeader m_header;
+	std::vector<SDHREvent> v_chunkEvents;	// the chunk being filled
+	ConcurrentQueue<Job> q_jobs;
+	std::thread thread_writer;
+	std::vector<uint8_t> v_keyframe;		// owned by the writer thread
+	uint32_t m_keyframeIndex = 0;
+	std::atomic<bool> bFailed { false };
+	uint64_t eventCount = 0;
+	uint32_t snapshotCount = 0;
+	std::atomic<uint64_t> bytesWritten { 0 };
+	std::string m_lastError;
+};
+
+class VCRReader
+{
+public:
+	~VCRReader() { Close(); };
+
+	// Indexes the file's chunks and starts the prefetch thread
+	bool Open(const std::string& path);
+	void Close();
+
+	bool IsOpen() { return thread_prefetch.joinable(); };
+	const VCRHeader& GetHeader() { return m_header; };
+	uint64_t GetEventCount() { return m_header.eventCount; };
+	size_t GetSnapshotCount() { return v_snapshotOffsets.size(); };
+	const std::string& GetPath() { return m_path; };
+
+	// Returns the event chunk, waiting for it to be decoded if needed. It stays valid while it's held.
+	// Returns nullptr if the chunk is corrupt.
+	std::shared_ptr<const std::vector<SDHREvent>> GetEventChunk(size_t chunkIndex);
+	// Reads a memory snapshot into data, which must hold size bytes
+	bool ReadSnapshot(size_t snapshotIndex, uint8_t* data, size_t size);
+
+	const std::string& GetLastError() { return m_lastError; };
+
+private:
+	void prefetch_thread();
+	bool ReadChunkAt(std::streamoff offset, VCRChunk& chunk);
+
+	std::string m_path;
+	std::ifstream file;
+	std::mutex fileMutex;
+	VCRFile vcr;
+	VCRHeader m_header;
+	std::vector<std::streamoff> v_eventChunkOffsets;
+	std::vector<std::streamoff> v_snapshotOffsets;	// keyframes and deltas
+	std::vector<uint8_t> v_keyframe;				// the keyframe of the last delta read
+	uint32_t m_keyframeIndex = 0;
+
+	// Decoded chunks, from the last requested one to VCRSTREAM_PREFETCH_CHUNKS after it
+	std::mutex cacheMutex;
+	std::condition_variable cacheCV;
+	std::map<size_t, std::shared_ptr<const std::vector<SDHREvent>>> m_cache;
+	size_t m_wantedChunk = 0;
+	bool bStopPrefetch = false;
+	std::thread thread_prefetch;
+	std::string m_lastError;
+};
+
+#endif // VCRSTREAM_H
@@ -18,6 +18,7 @@
 #include <algorithm>
 #include <thread>
 #include <atomic>
+#include <filesystem>
 
 #include "common.h"
 #include "shader.h"
@@ -38,6 +39,12 @@
 #include "extras/ImGuiFileDialog.h"
 #include "PostProcessor.h"
 #include "EventRecorder.h"
+#include "FrameCapture.h"
+#include "FlightRecorder.h"
+#include "HeadlessContext.h"
+#include "GPUProfiler.h"
+#include "AudioRenderer.h"
+#include "ReplayBenchmark.h"
 #include "MainMenu.h"
 
 #if defined(__NETWORKING_APPLE__) || defined (__NETWORKING_LINUX__)
@@ -359,17 +366,547 @@ void Main_ResetA2SS() {
 	memManager->SetSoftSwitch(A2SS_TEXT, true);
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Headless mode
+//////////////////////////////////////////////////////////////////////////
+
+// Command line options of the headless mode
+struct HeadlessOptions {
+	bool bEnabled = false;
+	int width = 1920;
+	int height = 1080;
+	uint64_t frameCount = 600;		// number of new Apple 2 frames to render
+	std::string replayPath;			// recording to replay (.vcr or PaintWorks animation)
+	std::string imagePath;			// memory image to display (.shr, .hgr, .dhr)
+	std::string screenshotPath;		// the last frame is saved here
+	bool bCapture = false;			// stream all frames to disk using the Frame Capture settings
+	bool bUseSettings = true;		// load the video and PP settings from Settings.json
+	bool bGPUTimings = false;		// log GPU timings per pass to profiling/gpu_timings.csv
+	std::string audioPath;			// render the replay's sound to this WAV file, without video
+	std::string audioSink;			// "sdl", "null" or a file. Empty is the mode's default
+	std::string benchmarkPath;		// recording to replay as fast as possible, timing each subsystem
+	bool bBenchmarkRender = true;	// render the frames of the benchmark replay on the GPU
+};
+
+static void Main_PrintUsage(const char* exe)
+{
+	std::cout << "Usage: " << exe << " [--audio-sink SINK] [--headless [options]] [--render-audio FILE --replay FILE]"
+		<< " [--benchmark FILE [--no-render]]" << std::endl
+		<< "  --headless           Render offscreen without a window, then exit" << std::endl
+		<< "  --size WxH           Output size (default 1920x1080)" << std::endl
+		<< "  --frames N           Number of Apple 2 frames to render (default 600)" << std::endl
+		<< "  --replay FILE        Replay a recording (.vcr, .csv events, .shra PaintWorks animation)" << std::endl
+		<< "  --image FILE         Display a memory image (.shr, .hgr, .dhr)" << std::endl
+		<< "  --screenshot FILE    Save the last frame (.png or .bmp)" << std::endl
+		<< "  --capture            Capture all frames using the Frame Capture settings" << std::endl
+		<< "  --gpu-timings        Log the GPU time of each pass to profiling/gpu_timings.csv" << std::endl
+		<< "  --no-settings        Ignore Settings.json and use the defaults" << std::endl
+		<< "  --render-audio FILE  Render the sound of --replay (.vcr or .csv events) to a WAV file" << std::endl
+		<< "                       as fast as possible, with no video and no audio device, then exit" << std::endl
+		<< "  --audio-sink SINK    Where the sound goes: sdl (the audio device), null (mixed then discarded)" << std::endl
+		<< "                       or a .wav or .raw file. null and files are paced by the Apple 2 cycles," << std::endl
+		<< "                       so they need no sound hardware and repeat exactly. Headless defaults to null" << std::endl
+		<< "  --benchmark FILE     Replay a recording (.vcr, .csv, PaintWorks animation) headless as fast as possible," << std::endl
+		<< "                       print events/s, frames/s and the time of each subsystem, then exit" << std::endl
+		<< "  --no-render          With --benchmark, run the beam and VRAM path but don't render the frames" << std::endl;
+}
+
+// Returns false if the command line is invalid. Unknown arguments are only an error
+// for the headless modes, the windowed app may be launched with arguments of the
+// launcher or the IDE (e.g. Xcode's -NSDocumentRevisionsDebugMode YES).
+static bool Main_ParseArguments(int argc, char* argv[], HeadlessOptions& opts)
+{
+	std::vector<std::string> _unknownArgs;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string _arg = argv[i];
+		bool _hasValue = (i + 1 < argc);
+		if (_arg == "--headless")
+			opts.bEnabled = true;
+		else if (_arg == "--size" && _hasValue) {
+			if (sscanf(argv[++i], "%dx%d", &opts.width, &opts.height) != 2 || opts.width <= 0 || opts.height <= 0)
+				return false;
+		}
+		else if (_arg == "--frames" && _hasValue)
+			opts.frameCount = std::strtoull(argv[++i], nullptr, 10);
+		else if (_arg == "--replay" && _hasValue)
+			opts.replayPath = argv[++i];
+		else if (_arg == "--image" && _hasValue)
+			opts.imagePath = argv[++i];
+		else if (_arg == "--screenshot" && _hasValue)
+			opts.screenshotPath = argv[++i];
+		else if (_arg == "--capture")
+			opts.bCapture = true;
+		else if (_arg == "--gpu-timings")
+			opts.bGPUTimings = true;
+		else if (_arg == "--no-settings")
+			opts.bUseSettings = false;
+		else if (_arg == "--render-audio" && _hasValue)
+			opts.audioPath = argv[++i];
+		else if (_arg == "--audio-sink" && _hasValue)
+			opts.audioSink = argv[++i];
+		else if (_arg == "--benchmark" && _hasValue) {
+			opts.benchmarkPath = argv[++i];
+			opts.bEnabled = true;
+		}
+		else if (_arg == "--no-render")
+			opts.bBenchmarkRender = false;
+		else if (_arg.rfind("-psn_", 0) == 0)
+			continue;	// macOS Finder process serial number
+		else
+			_unknownArgs.push_back(_arg);
+	}
+	if (!_unknownArgs.empty())
+	{
+		if (opts.bEnabled || !opts.audioPath.empty())
+			return false;
+		for (auto& _arg : _unknownArgs)
+			std::cerr << "Ignoring unknown argument: " << _arg << std::endl;
+	}
+	for (auto _path : { &opts.replayPath, &opts.imagePath, &opts.screenshotPath, &opts.audioPath, &opts.benchmarkPath })
+	{
+		if (!_path->empty())
+			*_path = std::filesystem::absolute(*_path).string();
+	}
+	if (!opts.audioSink.empty() && opts.audioSink != "sdl" && opts.audioSink != "null")
+		opts.audioSink = std::filesystem::absolute(opts.audioSink).string();
+	return true;
+}
+
+// Must be called before anything creates the sound singletons
+static void Main_SetAudioSink(const std::string& sink, AudioSink_e defaultSink)
+{
+	if (sink.empty())
+		SoundManager::SetSink(defaultSink);
+	else if (sink == "sdl")
+		SoundManager::SetSink(AudioSink_e::SDL);
+	else if (sink == "null")
+		SoundManager::SetSink(AudioSink_e::Null);
+	else
+		SoundManager::SetSink(AudioSink_e::File, sink);
+}
+
+// Loads a memory image and sets the soft switches for its mode
+static bool Main_LoadImageFile(const std::string& path)
+{
+	auto memManager = MemoryManager::GetInstance();
+	std::string _ext = std::filesystem::path(path).extension().string();
+	std::transform(_ext.begin(), _ext.end(), _ext.begin(), ::tolower);
+	Main_ResetA2SS();
+	memManager->SetSoftSwitch(A2SS_TEXT, false);
+	if (_ext == ".shr" || _ext == ".#c10000") {
+		memManager->SetSoftSwitch(A2SS_SHR, true);
+		return MemoryLoadSHR(path);
+	}
+	if (_ext == ".hgr" || _ext == ".#062000") {
+		memManager->SetSoftSwitch(A2SS_HIRES, true);
+		return MemoryLoadHGR(path);
+	}
+	if (_ext == ".dhr") {
+		memManager->SetSoftSwitch(A2SS_80COL, true);
+		memManager->SetSoftSwitch(A2SS_HIRES, true);
+		memManager->SetSoftSwitch(A2SS_DHGR, true);
+		return MemoryLoadDHR(path);
+	}
+	std::cerr << "Headless: unknown image type " << path << std::endl;
+	return false;
+}
+
+// Replays opts.benchmarkPath through the whole bus path as fast as possible, rendering the
+// frames into the headless framebuffer unless --no-render, and prints where the time went.
+static int Main_RunBenchmark(const HeadlessOptions& opts, HeadlessContext& context)
+{
+	auto eventRecorder = EventRecorder::GetInstance();
+	auto a2VideoManager = A2VideoManager::GetInstance();
+	auto postProcessor = PostProcessor::GetInstance();
+
+	std::ifstream file(opts.benchmarkPath, std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "Benchmark: can't open " << opts.benchmarkPath << std::endl;
+		return 1;
+	}
+	std::string _ext = std::filesystem::path(opts.benchmarkPath).extension().string();
+	std::transform(_ext.begin(), _ext.end(), _ext.begin(), ::tolower);
+	if (_ext == ".vcr")
+	{
+		if (!eventRecorder->ReadRecordingFile(opts.benchmarkPath))
+		{
+			std::cerr << "Benchmark: can't load " << opts.benchmarkPath << ": " << eventRecorder->GetLastError() << std::endl;
+			return 1;
+		}
+	}
+	else if (_ext == ".csv")
+	{
+		if (!eventRecorder->ReadTextEventsFromFile(file))
+		{
+			std::cerr << "Benchmark: can't load " << opts.benchmarkPath << ": " << eventRecorder->GetLastError() << std::endl;
+			return 1;
+		}
+	}
+	else if (!eventRecorder->ReadPaintWorksAnimationsFile(file))
+	{
+		std::cerr << "Benchmark: can't load " << opts.benchmarkPath << ": " << eventRecorder->GetLastError() << std::endl;
+		return 1;
+	}
+	file.close();
+	if (eventRecorder->GetEventCount() == 0)
+	{
+		std::cerr << "Benchmark: no events in " << opts.benchmarkPath << std::endl;
+		return 1;
+	}
+
+	const GLuint _fbo = context.GetFramebuffer();
+	uint64_t _glErrorCount = 0;
+	auto _onNewFrame = [&]() {
+		// Nobody waits on the new frame events here
+		SDL_FlushEvent(SDL_USEREVENT);
+		if (!opts.bBenchmarkRender)
+			return;
+		GLuint _texUnit = 0;
+		if (!a2VideoManager->Render(_texUnit))
+			return;
+		glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+		glClearColor(window_bgcolor[0], window_bgcolor[1], window_bgcolor[2], window_bgcolor[3]);
+		glClear(GL_COLOR_BUFFER_BIT);
+		postProcessor->Render(nullptr, _texUnit, a2VideoManager->ScreenSize().y);
+		glFinish();		// count the GPU time in the frame
+		while (glGetError() != GL_NO_ERROR)
+			++_glErrorCount;
+	};
+
+	ReplayBenchmark benchmark;
+	// Each pass starts from the recording's start state, with the sound engines reset
+	auto _resetState = [eventRecorder]() {
+		eventRecorder->ApplyReplayStart();
+		SoundManager::GetInstance()->BeginPlay();
+	};
+	benchmark.Run(eventRecorder->GetEventCount(),
+		[eventRecorder](size_t i) { return eventRecorder->GetEvent(i); }, _resetState, _onNewFrame);
+	std::cout << benchmark.GetSummary() << std::endl;
+	if (_glErrorCount > 0)
+	{
+		std::cerr << "Benchmark: " << _glErrorCount << " GL errors" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Runs the Apple 2 video and postprocessing into an offscreen framebuffer, without
+// any window, USB device, GUI or vsync. It exits after opts.frameCount Apple 2 frames.
+// Returns non-zero if there were GL errors or the frames stopped coming, so scripts
+// can use it to catch rendering regressions.
+static int Main_RunHeadless(const HeadlessOptions& opts)
+{
+	// By default the sound is mixed at the pace of the Apple 2 cycles and discarded, so
+	// the audio CPU cost is included without needing any sound hardware
+	Main_SetAudioSink(opts.audioSink, AudioSink_e::Null);
+	// The A2 video manager signals new frames through SDL events
+	if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_EVENTS) != 0)
+	{
+		std::cerr << "Error: " << SDL_GetError() << std::endl;
+		return -1;
+	}
+
+	HeadlessContext context;
+	if (!context.Create(opts.width, opts.height))
+	{
+		SDL_Quit();
+		return 1;
+	}
+	std::cout << "Headless context: " << context.GetDescription() << std::endl;
+	const GLuint _fbo = context.GetFramebuffer();
+
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	auto glhelper = OpenGLHelper::GetInstance();
+	[[maybe_unused]] auto logTextManager = LogTextManager::GetInstance();
+	[[maybe_unused]] auto memManager = MemoryManager::GetInstance();
+	auto a2VideoManager = A2VideoManager::GetInstance();
+	auto postProcessor = PostProcessor::GetInstance();
+	auto eventRecorder = EventRecorder::GetInstance();
+	auto cycleCounter = CycleCounter::GetInstance();
+	auto soundManager = SoundManager::GetInstance();
+	auto mockingboardManager = MockingboardManager::GetInstance();
+	auto frameCapture = FrameCapture::GetInstance();
+	auto gpuProfiler = GPUProfiler::GetInstance();
+	gpuProfiler->LoadExtensions(context.GetProcLoader());
+	while (!a2VideoManager->IsReady())
+	{
+		// Wait for shaders to compile
+	}
+
+	// Use the same rendering settings as the windowed app, but never save them
+	std::ifstream inFile("Settings.json");
+	if (opts.bUseSettings && inFile.is_open()) {
+		nlohmann::json settingsState;
+		inFile >> settingsState;
+		if (settingsState.contains("Post Processor"))
+			postProcessor->DeserializeState(settingsState["Post Processor"]);
+		if (settingsState.contains("Apple 2 Video"))
+			a2VideoManager->DeserializeState(settingsState["Apple 2 Video"]);
+		if (settingsState.contains("Frame Capture"))
+			frameCapture->DeserializeState(settingsState["Frame Capture"]);
+		if (settingsState.contains("Sound"))
+			soundManager->DeserializeState(settingsState["Sound"]);
+		if (settingsState.contains("Mockingboard"))
+			mockingboardManager->DeserializeState(settingsState["Mockingboard"]);
+		if (settingsState.contains("Main")) {
+			auto _sm = settingsState["Main"];
+			auto _region = (VideoRegion_e)_sm.value("videoregion", VideoRegion_e::NTSC);
+			cycleCounter->SetVideoRegion(_region == VideoRegion_e::Unknown ? VideoRegion_e::NTSC : _region);
+			if (_sm.contains("window background color") && _sm["window background color"].is_array()) {
+				for (size_t i = 0; i < 4; ++i) {
+					window_bgcolor[i] = _sm["window background color"][i].get<float>();
+				}
+			}
+		}
+	}
+	postProcessor->SetOutputFramebuffer(_fbo, context.GetWidth(), context.GetHeight());
+	if (opts.bGPUTimings)
+	{
+		gpuProfiler->SetLogToCSV(true);
+		gpuProfiler->SetEnabled(true);
+	}
+
+	if (!opts.benchmarkPath.empty())
+	{
+		const int _result = Main_RunBenchmark(opts, context);
+		soundManager->StopPlay();
+		soundManager->CloseSink();
+		postProcessor->SetOutputFramebuffer(0, 0, 0);
+		gpuProfiler->SetEnabled(false);
+		context.Destroy();
+		SDL_Quit();
+		return _result;
+	}
+
+	int _exitCode = 0;
+	if (!opts.replayPath.empty())
+	{
+		std::ifstream file(opts.replayPath, std::ios::binary);
+		if (!file.is_open()) {
+			std::cerr << "Headless: can't open " << opts.replayPath << std::endl;
+			_exitCode = 1;
+		}
+		else {
+			bool _loaded = false;
+			std::string _ext = std::filesystem::path(opts.replayPath).extension().string();
+			std::transform(_ext.begin(), _ext.end(), _ext.begin(), ::tolower);
+			if (_ext == ".vcr")
+				_loaded = eventRecorder->ReadRecordingFile(opts.replayPath);
+			else if (_ext == ".csv")
+				_loaded = eventRecorder->ReadTextEventsFromFile(file);
+			else
+				_loaded = eventRecorder->ReadPaintWorksAnimationsFile(file);
+			if (!_loaded) {
+				std::cerr << "Headless: can't load " << opts.replayPath << ": " << eventRecorder->GetLastError() << std::endl;
+				_exitCode = 1;
+			}
+			else if (eventRecorder->GetEventCount() == 0) {
+				std::cerr << "Headless: no events in " << opts.replayPath << std::endl;
+				_exitCode = 1;
+			}
+			else
+				eventRecorder->StartReplay();
+		}
+	}
+	else {
+		if (opts.imagePath.empty())
+			Main_DisplaySplashScreen();
+		else if (!Main_LoadImageFile(opts.imagePath))
+			_exitCode = 1;
+		// A static image never produces new frames on its own
+		a2VideoManager->bAlwaysRenderBuffer = true;
+		a2VideoManager->ForceBeamFullScreenRender(3);
+	}
+
+	if (opts.bCapture && _exitCode == 0)
+		frameCapture->StartCapture();
+
+	// Give up if the Apple 2 frames stop coming, e.g. a recording that doesn't render
+	const uint64_t _stallTimeout = 5 * pfreq;
+	uint64_t _framesRendered = 0;
+	uint64_t _glErrorCount = 0;
+	uint64_t _tStart = SDL_GetPerformanceCounter();
+	uint64_t _tLastFrame = _tStart;
+	GLenum glerr;
+	while ((_exitCode == 0) && (_framesRendered < opts.frameCount))
+	{
+		SDL_Event event;
+		while (SDL_PollEvent(&event))
+		{
+			// Only new frame notifications and quit requests come through here
+			if (event.type == SDL_QUIT)
+				_exitCode = 1;
+		}
+		if (a2VideoManager->bShouldReboot)
+		{
+			a2VideoManager->bShouldReboot = false;
+			a2VideoManager->ResetComputer();
+		}
+		a2VideoManager->CheckSetBordersWithReinit();
+
+		GLuint _texUnit = 0;
+		gpuProfiler->BeginFrame();
+		if (!a2VideoManager->Render(_texUnit))
+		{
+			if (_texUnit == A2VIDEORENDER_ERROR) {
+				std::cerr << "ERROR: NO RENDERER OUTPUT!" << std::endl;
+				_exitCode = 1;
+			}
+			else if ((SDL_GetPerformanceCounter() - _tLastFrame) > _stallTimeout) {
+				std::cerr << "Headless: no new Apple 2 frame for 5 seconds" << std::endl;
+				_exitCode = 1;
+			}
+			else
+				SDL_Delay(1);
+			continue;
+		}
+		_tLastFrame = SDL_GetPerformanceCounter();
+
+		glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+		glClearColor(
+			window_bgcolor[0],
+			window_bgcolor[1],
+			window_bgcolor[2],
+			window_bgcolor[3]);
+		glClear(GL_COLOR_BUFFER_BIT);
+		gpuProfiler->BeginPass(GPUPass_e::POSTPROCESS);
+		postProcessor->Render(nullptr, _texUnit, a2VideoManager->ScreenSize().y);
+		gpuProfiler->EndPass(GPUPass_e::POSTPROCESS);
+		if (frameCapture->IsCapturing())
+			frameCapture->CaptureFramebuffer(_fbo, context.GetWidth(), context.GetHeight(), true);
+		++_framesRendered;
+
+		while ((glerr = glGetError()) != GL_NO_ERROR) {
+			std::cerr << "OpenGL headless render error: " << glerr << " at frame " << _framesRendered << std::endl;
+			++_glErrorCount;
+		}
+	}
+	glFinish();
+	double _seconds = (SDL_GetPerformanceCounter() - _tStart) / (double)pfreq;
+	std::cout << "Headless: " << _framesRendered << " frames in " << _seconds << "s ("
+		<< (_seconds > 0 ? _framesRendered / _seconds : 0) << " fps), "
+		<< _glErrorCount << " GL errors" << std::endl;
+	if (gpuProfiler->IsEnabled())
+		std::cout << "Headless GPU timings: " << gpuProfiler->GetSummary() << std::endl;
+
+	if (!opts.screenshotPath.empty() && _framesRendered > 0)
+	{
+		bool _usePNG = (std::filesystem::path(opts.screenshotPath).extension() != ".bmp");
+		glhelper->SaveFramebufferToFile(_fbo, context.GetWidth(), context.GetHeight(),
+			opts.screenshotPath, _usePNG, true);
+	}
+
+	eventRecorder->StopReplay();
+	frameCapture->StopCapture();
+	soundManager->StopPlay();
+	soundManager->CloseSink();
+	if (SoundManager::GetSink() != AudioSink_e::SDL)
+		std::cout << "Headless audio: " << soundManager->GetSinkSampleCount() << " samples ("
+			<< (double)soundManager->GetSinkSampleCount() / soundManager->GetSampleRate() << "s) mixed" << std::endl;
+	postProcessor->SetOutputFramebuffer(0, 0, 0);
+	gpuProfiler->SetEnabled(false);
+	context.Destroy();
+	SDL_Quit();
+
+	if (_glErrorCount > 0)
+		_exitCode = 1;
+	return _exitCode;
+}
+
+// Renders the beeper and Mockingboard sound of a recording to a WAV file. No window,
+// GL context or audio device is created, so it runs on any machine. The output only
+// depends on the events and the sound settings, scripts can compare it byte for byte.
+static int Main_RenderAudio(const HeadlessOptions& opts)
+{
+	if (opts.replayPath.empty())
+	{
+		std::cerr << "Audio render: --render-audio needs a --replay file" << std::endl;
+		return 1;
+	}
+	// Must happen before anything creates the sound singletons
+	SoundManager::SetSink(AudioSink_e::Offline);
+	auto soundManager = SoundManager::GetInstance();
+	auto mockingboardManager = MockingboardManager::GetInstance();
+	auto eventRecorder = EventRecorder::GetInstance();
+
+	// Use the same sound settings as the windowed app, but never save them
+	std::ifstream inFile("Settings.json");
+	if (opts.bUseSettings && inFile.is_open()) {
+		nlohmann::json settingsState;
+		inFile >> settingsState;
+		if (settingsState.contains("Sound"))
+			soundManager->DeserializeState(settingsState["Sound"]);
+		if (settingsState.contains("Mockingboard"))
+			mockingboardManager->DeserializeState(settingsState["Mockingboard"]);
+	}
+
+	std::ifstream file(opts.replayPath, std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "Audio render: can't open " << opts.replayPath << std::endl;
+		return 1;
+	}
+	std::string _ext = std::filesystem::path(opts.replayPath).extension().string();
+	std::transform(_ext.begin(), _ext.end(), _ext.begin(), ::tolower);
+	if (_ext == ".vcr")
+	{
+		if (!eventRecorder->ReadRecordingFile(opts.replayPath))
+		{
+			std::cerr << "Audio render: can't load " << opts.replayPath << ": " << eventRecorder->GetLastError() << std::endl;
+			return 1;
+		}
+	}
+	else if (_ext == ".csv")
+	{
+		if (!eventRecorder->ReadTextEventsFromFile(file))
+		{
+			std::cerr << "Audio render: can't load " << opts.replayPath << ": " << eventRecorder->GetLastError() << std::endl;
+			return 1;
+		}
+	}
+	else {
+		std::cerr << "Audio render: unknown recording type " << opts.replayPath << std::endl;
+		return 1;
+	}
+	file.close();
+
+	// Start from the machine state of the recording, with its sound registers
+	eventRecorder->ApplyReplayStart();
+	AudioRenderer renderer;
+	if (!renderer.Render(eventRecorder->GetEventCount(),
+		[eventRecorder](size_t i) { return eventRecorder->GetEvent(i); }, opts.audioPath))
+		return 1;
+	std::cout << renderer.GetSummary() << std::endl;
+	return 0;
+}
+
 // Main code
 int main(int argc, char* argv[])
 {
-	(void)argc;		// mark as unused
-	(void)argv;		// mark as unused
+	// Parse before changing directory, the file paths are relative to the caller's directory
+	HeadlessOptions headlessOptions;
+	if (!Main_ParseArguments(argc, argv, headlessOptions))
+	{
+		Main_PrintUsage(argv[0]);
+		return 1;
+	}
+
 #if defined(__NETWORKING_APPLE__) || defined (__NETWORKING_LINUX__)
 	// when double-clicking the app, change to its working directory
 	char *dir = dirname(strdup(argv[0]));
 	chdir(dir);
 #endif
 
+	if (!headlessOptions.audioPath.empty())
+		return Main_RenderAudio(headlessOptions);
+	if (headlessOptions.bEnabled)
+		return Main_RunHeadless(headlessOptions);
+	Main_SetAudioSink(headlessOptions.audioSink, AudioSink_e::SDL);
+
 	GLenum glerr;
 	// Setup SDL
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) != 0)
@@ -525,6 +1062,13 @@ int main(int argc, char* argv[])
 	std::cout << "Loaded SoundManager " << soundManager << std::endl;
 	[[maybe_unused]] auto mockingboardManager = MockingboardManager::GetInstance();
 	std::cout << "Loaded MockingboardManager " << mockingboardManager << std::endl;
+	[[maybe_unused]] auto frameCapture = FrameCapture::GetInstance();
+	std::cout << "Loaded FrameCapture " << frameCapture << std::endl;
+	[[maybe_unused]] auto flightRecorder = FlightRecorder::GetInstance();
+	std::cout << "Loaded FlightRecorder " << flightRecorder << std::endl;
+	[[maybe_unused]] auto gpuProfiler = GPUProfiler::GetInstance();
+	gpuProfiler->LoadExtensions((GLADloadproc)SDL_GL_GetProcAddress);
+	std::cout << "Loaded GPUProfiler " << gpuProfiler << std::endl;
 
 	std::cout << "Renderer Initializing..." << std::endl;
 	while (!a2VideoManager->IsReady())
@@ -568,6 +1112,15 @@ int main(int argc, char* argv[])
 		if (settingsState.contains("Log")) {
 			logTextManager->DeserializeState(settingsState["Log"]);
 		}
+		if (settingsState.contains("Frame Capture")) {
+			frameCapture->DeserializeState(settingsState["Frame Capture"]);
+		}
+		if (settingsState.contains("Flight Recorder")) {
+			flightRecorder->DeserializeState(settingsState["Flight Recorder"]);
+		}
+		if (settingsState.contains("GPU Profiler")) {
+			gpuProfiler->DeserializeState(settingsState["GPU Profiler"]);
+		}
 		if (settingsState.contains("Main")) {
 			SDL_GetWindowPosition(window, &g_wx, &g_wy);
 			SDL_GetWindowSize(window, &g_ww, &g_wh);
@@ -780,6 +1333,15 @@ int main(int argc, char* argv[])
 							glhelper->SaveFramebufferToFile(glhelper->GetScreenshotSaveFilePath(), bUsePNGForScreenshots);
 						}
 					}
+					else if (event.key.keysym.sym == SDLK_F7) {	// Frame capture to disk
+						if (frameCapture->IsCapturing())
+							frameCapture->StopCapture();
+						else
+							frameCapture->StartCapture();
+					}
+					else if (event.key.keysym.sym == SDLK_F11) {	// Dump the flight recorder
+						flightRecorder->Dump("user request");
+					}
 					else if (event.key.keysym.sym == SDLK_F8) {
 						if (SDL_GetModState() & KMOD_SHIFT) {
 							// Reset FPS on Shift-F8
@@ -853,6 +1415,7 @@ int main(int argc, char* argv[])
 							// always overrun, so we max the # of frame events in the queue at MAX_USEREVENTS_IN_QUEUE
 							if (!bShouldRenderA2Video)
 								break;
+							gpuProfiler->BeginFrame();
 							bA2VideoDidRender = a2VideoManager->Render(A2VIDEO_TEX_UNIT);
 							// if (bA2VideoDidRender == false)
 								// std::cerr << "Multiple A2 frames in one loop" << std::endl;
@@ -865,12 +1428,22 @@ int main(int argc, char* argv[])
 								window_bgcolor[2],
 								window_bgcolor[3]);
 							glClear(GL_COLOR_BUFFER_BIT);
+							gpuProfiler->BeginPass(GPUPass_e::POSTPROCESS);
 							postProcessor->Render(window, A2VIDEO_TEX_UNIT, a2VideoManager->ScreenSize().y);
+							gpuProfiler->EndPass(GPUPass_e::POSTPROCESS);
 							if (!postProcessor->ShouldFrameBeSkipped())
 							{
+								if (frameCapture->IsCapturing())
+								{
+									int _dw, _dh;
+									SDL_GL_GetDrawableSize(window, &_dw, &_dh);
+									frameCapture->CaptureFramebuffer(0, _dw, _dh, bA2VideoDidRender);
+								}
 								if (Main_IsImGuiOn())
 								{
+									gpuProfiler->BeginPass(GPUPass_e::IMGUI);
 									menu->Render();
+									gpuProfiler->EndPass(GPUPass_e::IMGUI);
 								}
 								else {
 									/*	DISABLE HIDDEN MOUSE CURSOR NOW THAT WE HAVE MOUSE LOCKING
@@ -897,6 +1470,7 @@ int main(int argc, char* argv[])
 			// if (sdhrManager->IsSdhrEnabled())
 			// 		A2VIDEO_TEX_UNIT = sdhrManager->Render();
 			// else
+			gpuProfiler->BeginFrame();
 			if (bShouldRenderA2Video)
 				bA2VideoDidRender = a2VideoManager->Render(A2VIDEO_TEX_UNIT);
 			if (A2VIDEO_TEX_UNIT == A2VIDEORENDER_ERROR)
@@ -912,7 +1486,9 @@ int main(int argc, char* argv[])
 			glClear(GL_COLOR_BUFFER_BIT);
 
 			// Now run the postprocessing (not for IsSwapApple2Bus)
+			gpuProfiler->BeginPass(GPUPass_e::POSTPROCESS);
 			postProcessor->Render(window, A2VIDEO_TEX_UNIT, a2VideoManager->ScreenSize().y);
+			gpuProfiler->EndPass(GPUPass_e::POSTPROCESS);
 
 			// Determine if frame should be swapped, or nothing done
 			// Do that after the postprocessing phase, because PP may
@@ -922,10 +1498,19 @@ int main(int argc, char* argv[])
 
 			if (bShouldSwapFrame)
 			{
+				// Capture before ImGui draws over the frame
+				if (frameCapture->IsCapturing())
+				{
+					int _dw, _dh;
+					SDL_GL_GetDrawableSize(window, &_dw, &_dh);
+					frameCapture->CaptureFramebuffer(0, _dw, _dh, bA2VideoDidRender);
+				}
 				// This frame will be shown, so update ImGui and swap
 				if (Main_IsImGuiOn())
 				{
+					gpuProfiler->BeginPass(GPUPass_e::IMGUI);
 					menu->Render();
+					gpuProfiler->EndPass(GPUPass_e::IMGUI);
 				}
 				else {
 					/*	DISABLE HIDDEN MOUSE CURSOR NOW THAT WE HAVE MOUSE LOCKING
@@ -1008,6 +1593,7 @@ int main(int argc, char* argv[])
 				// a2VideoManager->EraseOverlayRange(6, 13, 1);
 				// a2VideoManager->DrawOverlayString(fps_str_buf, 10, 0b10010010, 13, 1);
 			}
+			gpuProfiler->UpdateOverlay();
 			// Reset for next calculation
 			fps_frame_count = 0;
 			fps_last_counter_display = dt_NOW;
@@ -1020,6 +1606,7 @@ int main(int argc, char* argv[])
 
 	eventRecorder->StopReplay();
 	soundManager->StopPlay();
+	frameCapture->StopCapture();
 
 	// Stop all threads
 	bShouldTerminateProcessing = true;
@@ -1031,6 +1618,7 @@ int main(int argc, char* argv[])
 		pthread_override_qos_class_end_np(server_pthread_qos_override);
 #endif
 	thread_server.join();
+	soundManager->CloseSink();		// no more bus events
 
 	// Serialize settings and save them
 	{
@@ -1046,6 +1634,9 @@ int main(int argc, char* argv[])
 		settingsState["Sound"] = soundManager->SerializeState();
 		settingsState["Mockingboard"] = mockingboardManager->SerializeState();
 		settingsState["Log"] = logTextManager->SerializeState();
+		settingsState["Frame Capture"] = frameCapture->SerializeState();
+		settingsState["Flight Recorder"] = flightRecorder->SerializeState();
+		settingsState["GPU Profiler"] = gpuProfiler->SerializeState();
 		settingsState["Main"] = {
 			{"display index", SDL_GetWindowDisplayIndex(window)},
 			{"window x", _wx},
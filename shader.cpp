@@ -1,8 +1,134 @@
 #include "shader.h"
+#include <filesystem>
+#include <iomanip>
+#include <vector>
 
 // compile‑time dispatch for glUniform*
 template<typename T> inline constexpr bool always_false_v = false;
 
+// Program binary cache
+// Linked programs are saved in SHADER_CACHE_DIR, one file per program. The file name is a hash
+// of both shader sources and of the GL vendor, renderer and version strings, so a driver update
+// or a GPU change simply misses the cache. Any problem loading a binary falls back to compiling.
+#define SHADER_CACHE_DIR "shadercache"
+constexpr uint32_t SHADER_CACHE_MAGIC = 0x42504453;		// "SDPB"
+constexpr uint32_t SHADER_CACHE_VERSION = 1;
+
+#pragma pack(push, 1)
+struct ShaderCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t hash;
+	uint32_t binaryFormat;
+	uint32_t binaryLength;
+};
+#pragma pack(pop)
+
+static int g_numProgramBinaryFormats = -1;	// -1 is not yet queried
+
+static bool ProgramBinaryCacheIsAvailable()
+{
+	if (g_numProgramBinaryFormats < 0)
+	{
+		GLint _n = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &_n);
+		if (glGetError() != GL_NO_ERROR)
+			_n = 0;
+		g_numProgramBinaryFormats = _n;
+		if (_n == 0)
+			std::cout << "Shader program binaries not supported by the driver, cache disabled" << std::endl;
+	}
+	return (g_numProgramBinaryFormats > 0);
+}
+
+// 64-bit FNV-1a
+static void HashBytes(uint64_t& h, const char* data, size_t len)
+{
+	for (size_t i = 0; i < len; ++i)
+	{
+		h ^= static_cast<uint8_t>(data[i]);
+		h *= 0x100000001b3ULL;
+	}
+	h ^= 0xFF;	// separator so that "ab"+"c" != "a"+"bc"
+	h *= 0x100000001b3ULL;
+}
+
+static uint64_t ProgramCacheKey(const std::string* pvertexCode, const std::string* pfragmentCode)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	HashBytes(h, pvertexCode->data(), pvertexCode->size());
+	HashBytes(h, pfragmentCode->data(), pfragmentCode->size());
+	const GLenum _strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (auto _s : _strings)
+	{
+		auto _str = reinterpret_cast<const char*>(glGetString(_s));
+		if (_str != nullptr)
+			HashBytes(h, _str, strlen(_str));
+	}
+	return h;
+}
+
+static std::string ProgramCachePath(uint64_t key)
+{
+	std::stringstream ss;
+	ss << SHADER_CACHE_DIR << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+	return ss.str();
+}
+
+// Returns a linked program, or 0 if the cache can't provide one
+static GLuint LoadCachedProgram(uint64_t key)
+{
+	std::ifstream file(ProgramCachePath(key), std::ios::binary);
+	if (!file.is_open())
+		return 0;
+	ShaderCacheHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+		return 0;
+	if ((header.magic != SHADER_CACHE_MAGIC) || (header.version != SHADER_CACHE_VERSION)
+		|| (header.hash != key) || (header.binaryLength == 0))
+		return 0;
+	std::vector<char> binary(header.binaryLength);
+	if (!file.read(binary.data(), header.binaryLength))
+		return 0;
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, header.binaryFormat, binary.data(), (GLsizei)header.binaryLength);
+	GLint success = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if ((glGetError() != GL_NO_ERROR) || !success)
+	{
+		// The driver rejected it. It'll be recompiled and the cache file overwritten.
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+static void SaveCachedProgram(uint64_t key, GLuint program)
+{
+	GLint _length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &_length);
+	if (_length <= 0)
+		return;
+	std::vector<char> binary(_length);
+	GLenum _format = 0;
+	GLsizei _written = 0;
+	glGetProgramBinary(program, _length, &_written, &_format, binary.data());
+	if ((glGetError() != GL_NO_ERROR) || (_written <= 0))
+		return;
+
+	std::error_code ec;
+	std::filesystem::create_directories(SHADER_CACHE_DIR, ec);
+	if (ec)
+		return;
+	std::ofstream file(ProgramCachePath(key), std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return;
+	ShaderCacheHeader header = { SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, key, _format, (uint32_t)_written };
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(binary.data(), _written);
+}
+
 void Shader::Build(const char* vertexPath, const char* fragmentPath)
 {
 	s_vertexPath = std::string(vertexPath);
@@ -44,6 +170,21 @@ void Shader::Build(const char* vertexPath, const char* fragmentPath)
 void Shader::_Compile(const std::string* pvertexCode, const std::string* pfragmentCode)
 {
 	uniformCache.clear();
+
+	const bool _useCache = ProgramBinaryCacheIsAvailable();
+	uint64_t _cacheKey = 0;
+	if (_useCache)
+	{
+		_cacheKey = ProgramCacheKey(pvertexCode, pfragmentCode);
+		GLuint _cached = LoadCachedProgram(_cacheKey);
+		if (_cached != 0)
+		{
+			ID = _cached;
+			isReady = true;
+			return;
+		}
+	}
+
 	const char* vShaderCode = pvertexCode->c_str();
 	const char* fShaderCode = pfragmentCode->c_str();
 	// 2. compile shaders
@@ -62,11 +203,15 @@ void Shader::_Compile(const std::string* pvertexCode, const std::string* pfragme
 	ID = glCreateProgram();
 	glAttachShader(ID, vertex);
 	glAttachShader(ID, fragment);
+	if (_useCache)
+		glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ID);
 	CheckCompileErrors(ID, "PROGRAM");
 	// delete the shaders as they're linked into our program now and no longer necessary
 	glDeleteShader(vertex);
 	glDeleteShader(fragment);
+	if (_useCache)
+		SaveCachedProgram(_cacheKey, ID);
 	isReady = true;
 }
 
@@ -28,6 +28,10 @@
 	Assign the uniform in the render loop:
 		glUniform1i(u_ticks, SDL_GetTicks());
 
+	Linked programs are cached on disk in shadercache/ when the driver supports program
+	binaries. A later Build() with the same sources on the same GPU and driver loads the
+	binary instead of compiling. Delete the directory to force a full recompile.
+
  */
 
 using UniformValue = std::variant<